@@ -3,10 +3,12 @@
  * 
  * Educational Linux kernel module demonstrating:
  * - Input subsystem integration
- * - Scan code to keycode translation
- * - IRQ simulation with tasklets
- * - Sysfs interface for testing
- * - Proper locking and buffering
+ * - Runtime scan code to keycode translation (EVIOCSKEYCODE, 0xE0 prefix)
+ * - Typematic autorepeat of held keys (EVIOCSREP delay and period)
+ * - A protocol decoder on top of the shared vinput_core module, which
+ *   provides the ring, budgeted bottom half, sysfs/character device
+ *   injection, load generator, statistics and tracing
+ * - Multiple independent instances with per-CPU bottom halves
  *
  * License: MIT
  */
@@ -15,33 +17,133 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/input.h>
-#include <linux/interrupt.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
 #include <linux/device.h>
 #include <linux/sysfs.h>
+#include <linux/moduleparam.h>
+#include <linux/bitmap.h>
+#include <linux/hash.h>
+#include <linux/hrtimer.h>
+
+#include "vinput_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "keyboard_trace.h"
 
 #define DRIVER_NAME "virtual_keyboard"
-#define BUFFER_SIZE 128
+#define BUFFER_SIZE 128  /* Default ring_size */
+#define SCANCODE_EXT_PREFIX 0xE0
+#define KEYMAP_EXT  0x80                /* Keymap index bit for 0xE0 codes */
+#define KEYMAP_SIZE (2 * KEYMAP_EXT)    /* Base page + 0xE0 page */
 
-/* Driver data structure */
+/* Driver data structure, one per instance */
 struct vkbd_device {
-    struct input_dev *input;
-    struct tasklet_struct tasklet;
-    spinlock_t buffer_lock;
-    unsigned char buffer[BUFFER_SIZE];
-    unsigned int head;
-    unsigned int tail;
-    bool shift_pressed;
+    struct vinput_device core;            /* Ring, bottom half, injection */
+    unsigned short keymap[KEYMAP_SIZE];   /* Live table, see EVIOCSKEYCODE */
+    bool ext_prefix;                      /* 0xE0 seen, next code is extended */
+    DECLARE_BITMAP(keys_down, KEY_CNT);   /* Reported state, see keys_down in sysfs */
+    spinlock_t rep_lock;                  /* Typematic state, against the timer */
+    struct hrtimer rep_timer;
+    unsigned short rep_key;               /* Typematic key, KEY_RESERVED = none */
+    unsigned int rep_index;               /* ... and its keymap index */
+    unsigned int rep_gen;                 /* Bumped on every key-down, never 0 */
+    unsigned int rep_armed;               /* Key-down the timer was started for */
+    unsigned int rep_due;                 /* Key-down owed a repeat, 0 = none */
+    u64 rep_due_ns;                       /* Expiry the owed repeat is stamped with */
+    bool rep_dead;                        /* Instance going away, no more arming */
+    DECLARE_BITMAP(frame_keys, KEY_CNT);  /* Keys reported in open frame */
+    unsigned int frame_len;
+    u64 frame_start_ns;                   /* Enqueue time of oldest key */
+    u64 frame_last_ns;                    /* ... and of the newest, the frame's timestamp */
 };
 
-static struct vkbd_device *vkbd_dev;
+#define to_vkbd(vdev) container_of(vdev, struct vkbd_device, core)
+
+static struct vkbd_device *vkbd_devs[VINPUT_MAX_DEVICES];
+static unsigned int vkbd_count;
+
+/*
+ * Instances
+ * Each instance is a separate input device with its own ring, bottom
+ * half, sysfs nodes, injection device and statistics. Instance 0 keeps
+ * the unsuffixed names; instance N appends N (vkbd_inject2, ...).
+ */
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of keyboard instances (1-" __stringify(VINPUT_MAX_DEVICES) ")");
+
+/*
+ * SYN_REPORT coalescing
+ * 1 (default) syncs after every key, N > 1 groups up to N keys per frame,
+ * 0 emits one frame per bottom-half run. Writable at runtime via
+ * /sys/module/keyboard_driver/parameters/sync_frame_size.
+ */
+static unsigned int sync_frame_size = 1;
+module_param(sync_frame_size, uint, 0644);
+MODULE_PARM_DESC(sync_frame_size,
+                 "Keys per SYN_REPORT frame (1 = every key, 0 = one frame per bottom-half run)");
+
+/*
+ * Ring capacity and overflow policy
+ * ring_size is rounded up to a power of two. When the ring is full,
+ * drop-newest discards what does not fit, drop-oldest overwrites the
+ * oldest queued scan codes and block makes the writer sleep until the
+ * bottom half makes room (write() honours O_NONBLOCK). Under drop-newest
+ * write() and VINPUT_IOC_KICK report a short count instead of dropping.
+ */
+static unsigned int ring_size = BUFFER_SIZE;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Ring capacity in scan codes, rounded up to a power of two (16-65536)");
+
+static char *overflow = "drop-newest";
+module_param(overflow, charp, 0444);
+MODULE_PARM_DESC(overflow, "Full-ring policy: drop-newest, drop-oldest or block");
+
+/*
+ * Bottom-half execution
+ * bh_mode selects the backend at load time; bh_budget caps the scan codes
+ * processed per run (0 = until the ring is empty) and may be changed at
+ * runtime; bh_cpu pins the kthread/workqueue backends to one CPU, while
+ * bh_spread gives every instance its own CPU instead.
+ */
+static char *bh_mode = "tasklet";
+module_param(bh_mode, charp, 0444);
+MODULE_PARM_DESC(bh_mode, "Bottom-half backend: tasklet, workqueue or kthread");
+
+static unsigned int bh_budget = 256;
+module_param(bh_budget, uint, 0644);
+MODULE_PARM_DESC(bh_budget, "Max scan codes per bottom-half run before rescheduling (0 = unlimited)");
+
+static int bh_cpu = -1;
+module_param(bh_cpu, int, 0444);
+MODULE_PARM_DESC(bh_cpu, "CPU for the kthread/workqueue backends (-1 = any)");
+
+static bool bh_spread;
+module_param(bh_spread, bool, 0444);
+MODULE_PARM_DESC(bh_spread, "Spread instance kthread/workqueue bottom halves across CPUs");
 
 /*
- * Scan Code to Linux Keycode Translation Table
- * PS/2 Set 1 scan codes (make codes, release = make | 0x80)
+ * Typematic autorepeat
+ * Initial input->rep[] of every instance, in ms. Setting them keeps the
+ * input core's own soft repeat off; EVIOCSREP (kbdrate, xset r rate)
+ * changes them per device at runtime, a period of 0 disables repeat.
  */
-static const unsigned short scancode_to_keycode[128] = {
+static unsigned int repeat_delay = 250;
+module_param(repeat_delay, uint, 0444);
+MODULE_PARM_DESC(repeat_delay, "Hold time before a key repeats, in ms (at least 1)");
+
+static unsigned int repeat_period = 33;
+module_param(repeat_period, uint, 0444);
+MODULE_PARM_DESC(repeat_period, "Time between repeats, in ms (0 = no autorepeat)");
+
+/*
+ * Default Scan Code to Linux Keycode Translation Table
+ * PS/2 Set 1 scan codes (make codes, release = make | 0x80).
+ * Two dense pages: index 0x00-0x7F is the base set, index
+ * KEYMAP_EXT | code is the 0xE0-prefixed set. Copied into each device
+ * at init; user space can remap entries at runtime with EVIOCSKEYCODE.
+ */
+static const unsigned short default_keymap[KEYMAP_SIZE] = {
     [0x01] = KEY_ESC,
     [0x02] = KEY_1,
     [0x03] = KEY_2,
@@ -110,112 +212,441 @@ static const unsigned short scancode_to_keycode[128] = {
     [0x42] = KEY_F8,
     [0x43] = KEY_F9,
     [0x44] = KEY_F10,
+    [0x45] = KEY_NUMLOCK,
+    [0x46] = KEY_SCROLLLOCK,
+    [0x47] = KEY_KP7,
+    [0x48] = KEY_KP8,
+    [0x49] = KEY_KP9,
+    [0x4A] = KEY_KPMINUS,
+    [0x4B] = KEY_KP4,
+    [0x4C] = KEY_KP5,
+    [0x4D] = KEY_KP6,
+    [0x4E] = KEY_KPPLUS,
+    [0x4F] = KEY_KP1,
+    [0x50] = KEY_KP2,
+    [0x51] = KEY_KP3,
+    [0x52] = KEY_KP0,
+    [0x53] = KEY_KPDOT,
+    [0x56] = KEY_102ND,
+    [0x57] = KEY_F11,
+    [0x58] = KEY_F12,
+    
+    /* 0xE0-prefixed (extended) keys */
+    [KEYMAP_EXT | 0x10] = KEY_PREVIOUSSONG,
+    [KEYMAP_EXT | 0x19] = KEY_NEXTSONG,
+    [KEYMAP_EXT | 0x1C] = KEY_KPENTER,
+    [KEYMAP_EXT | 0x1D] = KEY_RIGHTCTRL,
+    [KEYMAP_EXT | 0x20] = KEY_MUTE,
+    [KEYMAP_EXT | 0x22] = KEY_PLAYPAUSE,
+    [KEYMAP_EXT | 0x24] = KEY_STOPCD,
+    [KEYMAP_EXT | 0x2E] = KEY_VOLUMEDOWN,
+    [KEYMAP_EXT | 0x30] = KEY_VOLUMEUP,
+    [KEYMAP_EXT | 0x35] = KEY_KPSLASH,
+    [KEYMAP_EXT | 0x37] = KEY_SYSRQ,
+    [KEYMAP_EXT | 0x38] = KEY_RIGHTALT,
+    [KEYMAP_EXT | 0x47] = KEY_HOME,
+    [KEYMAP_EXT | 0x48] = KEY_UP,
+    [KEYMAP_EXT | 0x49] = KEY_PAGEUP,
+    [KEYMAP_EXT | 0x4B] = KEY_LEFT,
+    [KEYMAP_EXT | 0x4D] = KEY_RIGHT,
+    [KEYMAP_EXT | 0x4F] = KEY_END,
+    [KEYMAP_EXT | 0x50] = KEY_DOWN,
+    [KEYMAP_EXT | 0x51] = KEY_PAGEDOWN,
+    [KEYMAP_EXT | 0x52] = KEY_INSERT,
+    [KEYMAP_EXT | 0x53] = KEY_DELETE,
+    [KEYMAP_EXT | 0x5B] = KEY_LEFTMETA,
+    [KEYMAP_EXT | 0x5C] = KEY_RIGHTMETA,
+    [KEYMAP_EXT | 0x5D] = KEY_COMPOSE,
 };
 
 /*
- * Buffer Management Functions
- * Circular buffer for scan codes with proper locking
+ * Keymap Scan Code Encoding
+ * EVIOCGKEYCODE/EVIOCSKEYCODE scan codes are 0x00-0x7F for the base set
+ * and 0xE000-0xE07F for extended keys, matching setkeycodes(8) notation.
  */
-static bool buffer_empty(struct vkbd_device *dev)
+static unsigned int keymap_index_to_scancode(unsigned int index)
 {
-    return dev->head == dev->tail;
+    if (index & KEYMAP_EXT)
+        return (SCANCODE_EXT_PREFIX << 8) | (index & 0x7F);
+    return index;
 }
 
-static bool buffer_full(struct vkbd_device *dev)
+static unsigned int keymap_scancode_to_index(unsigned int scancode)
 {
-    return ((dev->head + 1) % BUFFER_SIZE) == dev->tail;
+    if (scancode < KEYMAP_EXT)
+        return scancode;
+    if ((scancode >> 8) == SCANCODE_EXT_PREFIX && (scancode & 0xFF) < KEYMAP_EXT)
+        return KEYMAP_EXT | (scancode & 0x7F);
+    return KEYMAP_SIZE;  /* Invalid */
 }
 
-static void buffer_push(struct vkbd_device *dev, unsigned char scancode)
+static int keymap_entry_to_index(const struct input_keymap_entry *ke,
+                                 unsigned int *index)
 {
-    unsigned long flags;
+    unsigned int scancode;
+    int error;
     
-    spin_lock_irqsave(&dev->buffer_lock, flags);
-    
-    if (!buffer_full(dev)) {
-        dev->buffer[dev->head] = scancode;
-        dev->head = (dev->head + 1) % BUFFER_SIZE;
+    if (ke->flags & INPUT_KEYMAP_BY_INDEX) {
+        *index = ke->index;
     } else {
-        pr_warn("%s: Buffer overflow, dropping scan code 0x%02x\n",
-                DRIVER_NAME, scancode);
+        error = input_scancode_to_scalar(ke, &scancode);
+        if (error)
+            return error;
+        *index = keymap_scancode_to_index(scancode);
     }
     
-    spin_unlock_irqrestore(&dev->buffer_lock, flags);
+    return *index < KEYMAP_SIZE ? 0 : -EINVAL;
 }
 
-static int buffer_pop(struct vkbd_device *dev, unsigned char *scancode)
+/*
+ * Rebuild keybit from the live keymap
+ * Called at init and after every remap so the advertised capabilities
+ * always match what the table can generate.
+ */
+static void vkbd_refresh_keybits(struct vkbd_device *dev)
 {
-    unsigned long flags;
-    int ret = 0;
+    int i;
+    
+    bitmap_zero(dev->core.input->keybit, KEY_CNT);
+    for (i = 0; i < KEYMAP_SIZE; i++) {
+        if (dev->keymap[i] != KEY_RESERVED)
+            __set_bit(dev->keymap[i], dev->core.input->keybit);
+    }
+}
+
+/*
+ * Input core keymap callbacks (EVIOCGKEYCODE/EVIOCSKEYCODE)
+ * Called with the input device's event_lock held.
+ */
+static int vkbd_getkeycode(struct input_dev *input,
+                           struct input_keymap_entry *ke)
+{
+    struct vkbd_device *dev = to_vkbd(input_get_drvdata(input));
+    unsigned int index, scancode;
+    int error;
+    
+    error = keymap_entry_to_index(ke, &index);
+    if (error)
+        return error;
     
-    spin_lock_irqsave(&dev->buffer_lock, flags);
+    scancode = keymap_index_to_scancode(index);
+    ke->keycode = dev->keymap[index];
+    ke->index = index;
+    ke->len = sizeof(scancode);
+    memcpy(ke->scancode, &scancode, sizeof(scancode));
     
-    if (!buffer_empty(dev)) {
-        *scancode = dev->buffer[dev->tail];
-        dev->tail = (dev->tail + 1) % BUFFER_SIZE;
-        ret = 1;
+    return 0;
+}
+
+static int vkbd_setkeycode(struct input_dev *input,
+                           const struct input_keymap_entry *ke,
+                           unsigned int *old_keycode)
+{
+    struct vkbd_device *dev = to_vkbd(input_get_drvdata(input));
+    unsigned int index;
+    int error;
+    
+    error = keymap_entry_to_index(ke, &index);
+    if (error)
+        return error;
+    
+    if (ke->keycode > KEY_MAX)
+        return -EINVAL;
+    
+    *old_keycode = dev->keymap[index];
+    WRITE_ONCE(dev->keymap[index], ke->keycode);
+    vkbd_refresh_keybits(dev);
+    
+    /* The input core releases a held key that is no longer mapped */
+    if (!test_bit(*old_keycode, input->keybit)) {
+        clear_bit(*old_keycode, dev->keys_down);
+        spin_lock(&dev->rep_lock);
+        if (dev->rep_key == *old_keycode)
+            dev->rep_key = KEY_RESERVED;  /* The timer stops at its next expiry */
+        spin_unlock(&dev->rep_lock);
     }
     
-    spin_unlock_irqrestore(&dev->buffer_lock, flags);
+    pr_debug("%s: Remapped scan code 0x%x: keycode %u -> %u\n",
+             DRIVER_NAME, keymap_index_to_scancode(index),
+             *old_keycode, ke->keycode);
     
+    return 0;
+}
+
+/*
+ * Close the open frame, if any, with a single input_sync
+ */
+static void vkbd_flush_frame(struct vkbd_device *dev)
+{
+    u64 latency;
+    
+    if (!dev->frame_len)
+        return;
+    
+    latency = vinput_sync_frame(&dev->core, dev->frame_start_ns,
+                                dev->frame_last_ns);
+    trace_vkbd_report(&dev->core, dev->frame_len, latency);
+    
+    bitmap_zero(dev->frame_keys, KEY_CNT);
+    dev->frame_len = 0;
+}
+
+/*
+ * Typematic Engine
+ * Like a PS/2 keyboard, the most recently pressed key repeats while it
+ * is held, whatever else is released meanwhile. The timer only marks a
+ * repeat as due and kicks the bottom half, which reports it after the
+ * ring is drained, so repeats are ordered with the decoded scan codes
+ * and cost no injection at all. Overdue repeats of a busy bottom half
+ * collapse into one, like those of a keyboard whose host is not reading.
+ *
+ * rep_lock serializes the hardirq callback with the bottom half. Every
+ * key-down gets a new generation: the callback only marks a repeat due
+ * for the key-down it was started for, and the bottom half only reports
+ * one owed to the current key-down, so an expiry racing with a press or
+ * release never repeats the wrong key or shortens the new key's delay.
+ */
+static enum hrtimer_restart vkbd_rep_timer(struct hrtimer *timer)
+{
+    struct vkbd_device *dev = container_of(timer, struct vkbd_device,
+                                           rep_timer);
+    enum hrtimer_restart ret = HRTIMER_NORESTART;
+    unsigned int period;
+    
+    spin_lock(&dev->rep_lock);
+    
+    /* Restarted for a newer key-down while this callback waited */
+    if (hrtimer_is_queued(timer))
+        goto out;
+    if (dev->rep_dead || dev->rep_key == KEY_RESERVED ||
+        dev->rep_armed != dev->rep_gen)
+        goto out;
+    
+    dev->rep_due = dev->rep_gen;
+    dev->rep_due_ns = ktime_get_ns();
+    vinput_schedule_bh(&dev->core);
+    
+    period = READ_ONCE(dev->core.input->rep[REP_PERIOD]);
+    if (period) {
+        hrtimer_forward_now(timer, ms_to_ktime(period));
+        ret = HRTIMER_RESTART;
+    }
+
+out:
+    spin_unlock(&dev->rep_lock);
     return ret;
 }
 
+/* Bottom half: a key was reported down or up */
+static void vkbd_rep_update(struct vkbd_device *dev, unsigned short keycode,
+                            unsigned int index, bool down)
+{
+    struct input_dev *input = dev->core.input;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&dev->rep_lock, flags);
+    if (down) {
+        dev->rep_key = keycode;
+        dev->rep_index = index;
+        if (!++dev->rep_gen)
+            dev->rep_gen = 1;
+        dev->rep_due = 0;
+        if (READ_ONCE(input->rep[REP_PERIOD]) && !dev->rep_dead) {
+            dev->rep_armed = dev->rep_gen;
+            hrtimer_start(&dev->rep_timer,
+                          ms_to_ktime(READ_ONCE(input->rep[REP_DELAY])),
+                          HRTIMER_MODE_REL);
+        } else {
+            hrtimer_try_to_cancel(&dev->rep_timer);
+        }
+    } else if (keycode == dev->rep_key) {
+        /*
+         * A callback that is already running waits for rep_lock and
+         * then finds no key to repeat; if it cannot be cancelled here it
+         * simply does not restart
+         */
+        dev->rep_key = KEY_RESERVED;
+        dev->rep_due = 0;
+        hrtimer_try_to_cancel(&dev->rep_timer);
+    }
+    spin_unlock_irqrestore(&dev->rep_lock, flags);
+}
+
+/* Bottom half, once the open frame is closed: report an owed repeat */
+static void vkbd_rep_report(struct vkbd_device *dev)
+{
+    unsigned int index = 0;
+    unsigned short keycode = KEY_RESERVED;
+    unsigned long flags;
+    u64 due_ns = 0, latency;
+    
+    spin_lock_irqsave(&dev->rep_lock, flags);
+    if (dev->rep_due && dev->rep_due == dev->rep_gen) {
+        keycode = dev->rep_key;
+        index = dev->rep_index;
+        due_ns = dev->rep_due_ns;
+    }
+    dev->rep_due = 0;
+    spin_unlock_irqrestore(&dev->rep_lock, flags);
+    
+    /* The key may have been remapped away meanwhile */
+    if (keycode == KEY_RESERVED || !test_bit(keycode, dev->keys_down))
+        return;
+    
+    input_event(dev->core.input, EV_MSC, MSC_SCAN,
+                keymap_index_to_scancode(index));
+    input_event(dev->core.input, EV_KEY, keycode, 2);
+    dev->core.stats.events_reported++;
+    
+    latency = vinput_sync_frame(&dev->core, due_ns, due_ns);
+    trace_vkbd_report(&dev->core, 1, latency);
+}
+
 /*
- * Tasklet Bottom-Half Handler
- * Processes buffered scan codes and reports events to input subsystem
+ * Stop the typematic timer for good, before the input device goes away
+ * Once rep_dead is set nothing arms the timer again, so a single
+ * hrtimer_cancel() suffices. Process context only.
  */
-static void vkbd_tasklet_handler(unsigned long data)
+static void vkbd_rep_stop(struct vkbd_device *dev)
 {
-    struct vkbd_device *dev = (struct vkbd_device *)data;
-    unsigned char scancode;
+    unsigned long flags;
+    
+    spin_lock_irqsave(&dev->rep_lock, flags);
+    dev->rep_dead = true;
+    spin_unlock_irqrestore(&dev->rep_lock, flags);
+    hrtimer_cancel(&dev->rep_timer);
+}
+
+/*
+ * Translate one scan code and report it to the input subsystem
+ * A 0xE0 byte only arms the prefix state; the following code is then
+ * looked up in the extended page of the keymap.
+ */
+static void vkbd_process_scancode(struct vkbd_device *dev,
+                                  const struct vinput_entry *entry)
+{
+    unsigned char scancode = entry->data[0];
     unsigned short keycode;
+    unsigned int frame_size, index;
     bool key_release;
     
-    while (buffer_pop(dev, &scancode)) {
-        /* Check if this is a key release (bit 7 set) */
-        key_release = (scancode & 0x80) != 0;
-        scancode &= 0x7F;  /* Clear release bit to get base scan code */
-        
-        /* Translate scan code to Linux keycode */
-        if (scancode >= ARRAY_SIZE(scancode_to_keycode)) {
-            pr_debug("%s: Unknown scan code 0x%02x\n", DRIVER_NAME, scancode);
-            continue;
-        }
-        
-        keycode = scancode_to_keycode[scancode];
-        if (keycode == 0) {
-            pr_debug("%s: No mapping for scan code 0x%02x\n", DRIVER_NAME, scancode);
-            continue;
-        }
-        
-        /* Track shift key state for demonstration */
-        if (keycode == KEY_LEFTSHIFT || keycode == KEY_RIGHTSHIFT) {
-            dev->shift_pressed = !key_release;
-        }
-        
-        /* Report key event to input subsystem */
-        input_report_key(dev->input, keycode, !key_release);
-        input_sync(dev->input);
-        
-        pr_debug("%s: Scan code 0x%02x -> keycode %d (%s)\n",
-                 DRIVER_NAME, scancode, keycode, 
-                 key_release ? "release" : "press");
+    if (scancode == SCANCODE_EXT_PREFIX) {
+        dev->ext_prefix = true;
+        return;
+    }
+    
+    /* Check if this is a key release (bit 7 set) */
+    key_release = (scancode & 0x80) != 0;
+    scancode &= 0x7F;  /* Clear release bit to get base scan code */
+    
+    index = scancode;
+    if (dev->ext_prefix) {
+        index |= KEYMAP_EXT;
+        dev->ext_prefix = false;
+    }
+    
+    /* Translate scan code to Linux keycode */
+    keycode = READ_ONCE(dev->keymap[index]);
+    trace_vkbd_decode(&dev->core, keymap_index_to_scancode(index), keycode,
+                      key_release);
+    if (keycode == KEY_RESERVED)
+        return;
+    
+    /*
+     * Only state changes are reported: a make code of a held key or a
+     * break code of a released one would be filtered by the input core
+     * anyway, so it never opens a frame
+     */
+    if (test_bit(keycode, dev->keys_down) == !key_release) {
+        dev->core.stats.redundant++;
+        return;
     }
+    
+    /*
+     * A key already in this frame must start a new one, otherwise a
+     * press/release pair would collapse into a single state change
+     */
+    if (test_bit(keycode, dev->frame_keys))
+        vkbd_flush_frame(dev);
+    
+    if (!dev->frame_len)
+        dev->frame_start_ns = entry->enqueue_ns;
+    dev->frame_last_ns = entry->enqueue_ns;
+    
+    /* Report raw scan code and key event to input subsystem */
+    input_event(dev->core.input, EV_MSC, MSC_SCAN,
+                keymap_index_to_scancode(index));
+    input_report_key(dev->core.input, keycode, !key_release);
+    if (key_release)
+        clear_bit(keycode, dev->keys_down);
+    else
+        set_bit(keycode, dev->keys_down);
+    vkbd_rep_update(dev, keycode, index, !key_release);
+    __set_bit(keycode, dev->frame_keys);
+    dev->frame_len++;
+    dev->core.stats.events_reported++;
+    
+    frame_size = READ_ONCE(sync_frame_size);
+    if (frame_size && dev->frame_len >= frame_size)
+        vkbd_flush_frame(dev);
 }
 
 /*
- * Simulated IRQ Handler (Top Half)
- * In real driver, this would be called by hardware interrupt
- * Here, triggered by sysfs injection
+ * Decoder Callbacks (Bottom Half)
+ * vinput_core hands over each drained span of scan codes, then asks for
+ * whatever is left of the last (or only) coalesced frame to be synced.
  */
-static void vkbd_simulate_irq(unsigned char scancode)
+static void vkbd_process(struct vinput_device *vdev,
+                         const struct vinput_entry *entries, unsigned int count)
+{
+    struct vkbd_device *dev = to_vkbd(vdev);
+    unsigned int i;
+    
+    for (i = 0; i < count; i++)
+        vkbd_process_scancode(dev, &entries[i]);
+}
+
+static void vkbd_flush(struct vinput_device *vdev)
+{
+    struct vkbd_device *dev = to_vkbd(vdev);
+    
+    vkbd_flush_frame(dev);
+    vkbd_rep_report(dev);
+}
+
+/*
+ * Load Generator Callbacks
+ * Without a pattern the generator types pseudo-random letter
+ * press/release pairs; stopping it never leaves a key held down.
+ */
+static const unsigned char gen_keys[] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,  /* Q-P */
+    0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26,        /* A-L */
+    0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32,                    /* Z-M */
+};
+
+static void vkbd_gen_record(struct vinput_device *vdev, u64 seq,
+                            unsigned char *record)
 {
-    /* Buffer the scan code */
-    buffer_push(vkbd_dev, scancode);
+    unsigned char code;
     
-    /* Schedule tasklet for bottom-half processing */
-    tasklet_schedule(&vkbd_dev->tasklet);
+    /* Press on even steps, release the same key on odd ones */
+    code = gen_keys[hash_64(seq >> 1, 32) % ARRAY_SIZE(gen_keys)];
+    record[0] = (seq & 1) ? code | 0x80 : code;
+}
+
+/* Called with gen->lock held, after the timer was cancelled */
+static void vkbd_gen_stop(struct vinput_device *vdev)
+{
+    struct vinput_gen *gen = &vdev->gen;
+    unsigned char release;
+    
+    if (!gen->pattern_len && (gen->seq & 1)) {
+        vkbd_gen_record(vdev, gen->seq, &release);
+        if (vinput_push(vdev, &release, 1))
+            gen->seq++;
+        vinput_schedule_bh(vdev);
+    }
 }
 
 /*
@@ -226,29 +657,67 @@ static ssize_t inject_scancode_store(struct device *dev,
                                       struct device_attribute *attr,
                                       const char *buf, size_t count)
 {
-    unsigned long scancode;
-    int ret;
+    return vinput_store_text(dev_get_drvdata(dev), buf, count, true);
+}
+
+static DEVICE_ATTR_WO(inject_scancode);
+
+/*
+ * Batched injection: echo "0x2A 0x1E 0x9E 0xAA" > inject_scancodes
+ * The whole sequence is buffered under one lock hold and the bottom
+ * half is scheduled once, instead of once per scan code.
+ */
+static ssize_t inject_scancodes_store(struct device *dev,
+                                       struct device_attribute *attr,
+                                       const char *buf, size_t count)
+{
+    return vinput_store_text(dev_get_drvdata(dev), buf, count, false);
+}
+
+static DEVICE_ATTR_WO(inject_scancodes);
+
+/*
+ * Key state for health checks, without attaching an evdev reader
+ * keys_down: keycodes currently held, as a list ("29,42")
+ * modifiers: held modifiers as a bit mask in HID order (bit 0 left ctrl,
+ *            1 left shift, 2 left alt, 3 left meta, 4-7 the right ones)
+ */
+static const unsigned short modifier_keys[] = {
+    KEY_LEFTCTRL, KEY_LEFTSHIFT, KEY_LEFTALT, KEY_LEFTMETA,
+    KEY_RIGHTCTRL, KEY_RIGHTSHIFT, KEY_RIGHTALT, KEY_RIGHTMETA,
+};
+
+static ssize_t keys_down_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct vkbd_device *vkbd = to_vkbd(dev_get_drvdata(dev));
     
-    ret = kstrtoul(buf, 0, &scancode);
-    if (ret)
-        return ret;
+    return sysfs_emit(buf, "%*pbl\n", KEY_CNT, vkbd->keys_down);
+}
+
+static DEVICE_ATTR_RO(keys_down);
+
+static ssize_t modifiers_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct vkbd_device *vkbd = to_vkbd(dev_get_drvdata(dev));
+    unsigned int i, mask = 0;
     
-    if (scancode > 0xFF) {
-        pr_warn("%s: Invalid scan code 0x%lx (must be 0-255)\n",
-                DRIVER_NAME, scancode);
-        return -EINVAL;
+    for (i = 0; i < ARRAY_SIZE(modifier_keys); i++) {
+        if (test_bit(modifier_keys[i], vkbd->keys_down))
+            mask |= 1U << i;
     }
     
-    pr_info("%s: Injecting scan code 0x%02lx\n", DRIVER_NAME, scancode);
-    vkbd_simulate_irq((unsigned char)scancode);
-    
-    return count;
+    return sysfs_emit(buf, "0x%02x\n", mask);
 }
 
-static DEVICE_ATTR_WO(inject_scancode);
+static DEVICE_ATTR_RO(modifiers);
 
 static struct attribute *vkbd_attrs[] = {
     &dev_attr_inject_scancode.attr,
+    &dev_attr_inject_scancodes.attr,
+    &dev_attr_keys_down.attr,
+    &dev_attr_modifiers.attr,
     NULL,
 };
 
@@ -256,87 +725,164 @@ static const struct attribute_group vkbd_attr_group = {
     .attrs = vkbd_attrs,
 };
 
+static const struct attribute_group *vkbd_groups[] = {
+    &vkbd_attr_group,
+    NULL,
+};
+
+static const struct vinput_ops vkbd_ops = {
+    .process    = vkbd_process,
+    .flush      = vkbd_flush,
+    .gen_record = vkbd_gen_record,
+    .gen_stop   = vkbd_gen_stop,
+};
+
+/* Every byte is a scan code, so records are one byte and never invalid */
+static struct vinput_class vkbd_class = {
+    .name        = DRIVER_NAME,
+    .short_name  = "vkbd",
+    .unit        = "scan codes",
+    .stat_unit   = "bytes",
+    .record_size = 1,
+    .ops         = &vkbd_ops,
+    .groups      = vkbd_groups,
+};
+
 /*
- * Module Initialization
+ * Instance Creation
+ * vinput_core sets up the ring, bottom half and input device; the driver
+ * adds the keyboard capabilities and keymap before registration. The
+ * KUnit suites use the unregistered instance of vkbd_alloc().
  */
-static int __init vkbd_init(void)
+static struct vkbd_device *vkbd_alloc(unsigned int id)
 {
+    struct vkbd_device *dev;
+    struct input_dev *input;
     int ret;
-    int i;
-    
-    pr_info("%s: Initializing virtual keyboard driver\n", DRIVER_NAME);
     
     /* Allocate driver data structure */
-    vkbd_dev = kzalloc(sizeof(struct vkbd_device), GFP_KERNEL);
-    if (!vkbd_dev)
-        return -ENOMEM;
-    
-    /* Initialize buffer and lock */
-    spin_lock_init(&vkbd_dev->buffer_lock);
-    vkbd_dev->head = 0;
-    vkbd_dev->tail = 0;
-    vkbd_dev->shift_pressed = false;
-    
-    /* Initialize tasklet for bottom-half processing */
-    tasklet_init(&vkbd_dev->tasklet, vkbd_tasklet_handler,
-                 (unsigned long)vkbd_dev);
-    
-    /* Allocate input device */
-    vkbd_dev->input = input_allocate_device();
-    if (!vkbd_dev->input) {
-        pr_err("%s: Failed to allocate input device\n", DRIVER_NAME);
-        ret = -ENOMEM;
-        goto err_free_dev;
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    
+    memcpy(dev->keymap, default_keymap, sizeof(dev->keymap));
+    
+    ret = vinput_init(&dev->core, &vkbd_class, id);
+    if (ret) {
+        kfree(dev);
+        return ERR_PTR(ret);
     }
+    input = dev->core.input;
     
     /* Setup input device properties */
-    vkbd_dev->input->name = "Virtual PS/2 Keyboard";
-    vkbd_dev->input->phys = "virtual/input0";
-    vkbd_dev->input->id.bustype = BUS_HOST;
-    vkbd_dev->input->id.vendor = 0x0001;
-    vkbd_dev->input->id.product = 0x0001;
-    vkbd_dev->input->id.version = 0x0100;
+    input->name = "Virtual PS/2 Keyboard";
+    input->id.vendor = 0x0001;
+    input->id.product = 0x0001;
+    input->id.version = 0x0100;
+    
+    /* Set event types: key events plus raw scan codes */
+    input->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP) | BIT_MASK(EV_MSC);
+    set_bit(MSC_SCAN, input->mscbit);
     
-    /* Set event types: we generate key events */
-    vkbd_dev->input->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REP);
+    /* Expose the live keymap to EVIOCGKEYCODE/EVIOCSKEYCODE */
+    input->keycode = dev->keymap;
+    input->keycodesize = sizeof(dev->keymap[0]);
+    input->keycodemax = KEYMAP_SIZE;
+    input->getkeycode = vkbd_getkeycode;
+    input->setkeycode = vkbd_setkeycode;
     
     /* Set which keys we can generate */
-    for (i = 0; i < ARRAY_SIZE(scancode_to_keycode); i++) {
-        if (scancode_to_keycode[i] != 0)
-            set_bit(scancode_to_keycode[i], vkbd_dev->input->keybit);
-    }
+    vkbd_refresh_keybits(dev);
+    
+    /* Driver-side autorepeat, see vkbd_rep_timer() */
+    input->rep[REP_DELAY] = repeat_delay;
+    input->rep[REP_PERIOD] = repeat_period;
+    spin_lock_init(&dev->rep_lock);
+    vinput_hrtimer_init(&dev->rep_timer, vkbd_rep_timer, HRTIMER_MODE_REL);
+    
+    return dev;
+}
+
+/* The timer kicks the bottom half, so it stops before vinput_core's */
+static void vkbd_destroy(struct vkbd_device *dev)
+{
+    vkbd_rep_stop(dev);
+    vinput_destroy(&dev->core);
+    kfree(dev);
+}
+
+static struct vkbd_device *vkbd_create(unsigned int id)
+{
+    struct vkbd_device *dev;
+    int ret;
+    
+    dev = vkbd_alloc(id);
+    if (IS_ERR(dev))
+        return dev;
     
-    /* Register input device with the input subsystem */
-    ret = input_register_device(vkbd_dev->input);
+    /* Register input device, sysfs, injection device and statistics */
+    ret = vinput_register(&dev->core, THIS_MODULE);
     if (ret) {
-        pr_err("%s: Failed to register input device\n", DRIVER_NAME);
-        goto err_free_input;
+        vkbd_destroy(dev);
+        return ERR_PTR(ret);
     }
     
-    /* Create sysfs interface for scan code injection */
-    ret = sysfs_create_group(&vkbd_dev->input->dev.kobj, &vkbd_attr_group);
-    if (ret) {
-        pr_err("%s: Failed to create sysfs group\n", DRIVER_NAME);
-        goto err_unregister_input;
+    return dev;
+}
+
+static void vkbd_destroy_all(void)
+{
+    while (vkbd_count)
+        vkbd_destroy(vkbd_devs[--vkbd_count]);
+}
+
+/*
+ * Module Initialization
+ */
+static int __init vkbd_init(void)
+{
+    const struct vinput_params params = {
+        .ring_size = ring_size,
+        .overflow  = overflow,
+        .bh_mode   = bh_mode,
+        .bh_budget = &bh_budget,
+        .bh_cpu    = bh_cpu,
+        .bh_spread = bh_spread,
+    };
+    struct vkbd_device *dev;
+    int ret;
+    
+    pr_info("%s: Initializing virtual keyboard driver\n", DRIVER_NAME);
+    
+    if (!num_devices || num_devices > VINPUT_MAX_DEVICES) {
+        pr_err("%s: num_devices must be 1-%d\n", DRIVER_NAME,
+               VINPUT_MAX_DEVICES);
+        return -EINVAL;
     }
     
-    pr_info("%s: Successfully registered as %s\n", DRIVER_NAME,
-            dev_name(&vkbd_dev->input->dev));
-    pr_info("%s: Inject scan codes via: /sys/devices/virtual/input/%s/inject_scancode\n",
-            DRIVER_NAME, dev_name(&vkbd_dev->input->dev));
+    /* rep[] all zero would hand autorepeat back to the input core */
+    if (!repeat_delay) {
+        pr_err("%s: repeat_delay must be at least 1 ms\n", DRIVER_NAME);
+        return -EINVAL;
+    }
+    
+    ret = vinput_setup(&vkbd_class, &params);
+    if (ret)
+        return ret;
+    
+    while (vkbd_count < num_devices) {
+        dev = vkbd_create(vkbd_count);
+        if (IS_ERR(dev)) {
+            vkbd_destroy_all();
+            return PTR_ERR(dev);
+        }
+        vkbd_devs[vkbd_count++] = dev;
+    }
+    
+    if (num_devices > 1)
+        pr_info("%s: Created %u instances\n", DRIVER_NAME, num_devices);
     
     return 0;
-
-err_unregister_input:
-    input_unregister_device(vkbd_dev->input);
-    vkbd_dev->input = NULL;  /* input_unregister_device frees it */
-err_free_input:
-    if (vkbd_dev->input)
-        input_free_device(vkbd_dev->input);
-err_free_dev:
-    tasklet_kill(&vkbd_dev->tasklet);
-    kfree(vkbd_dev);
-    return ret;
 }
 
 /*
@@ -346,17 +892,7 @@ static void __exit vkbd_exit(void)
 {
     pr_info("%s: Cleaning up virtual keyboard driver\n", DRIVER_NAME);
     
-    /* Remove sysfs interface */
-    sysfs_remove_group(&vkbd_dev->input->dev.kobj, &vkbd_attr_group);
-    
-    /* Kill tasklet */
-    tasklet_kill(&vkbd_dev->tasklet);
-    
-    /* Unregister input device */
-    input_unregister_device(vkbd_dev->input);
-    
-    /* Free driver data */
-    kfree(vkbd_dev);
+    vkbd_destroy_all();
     
     pr_info("%s: Driver unloaded\n", DRIVER_NAME);
 }
@@ -364,6 +900,10 @@ static void __exit vkbd_exit(void)
 module_init(vkbd_init);
 module_exit(vkbd_exit);
 
+#if IS_ENABLED(CONFIG_VINPUT_KUNIT_TEST)
+#include "keyboard_test.c"
+#endif
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("OS Course Project");
 MODULE_DESCRIPTION("Virtual PS/2 Keyboard Driver for Educational Purposes");
@@ -0,0 +1,414 @@
+/*
+ * keyboard_test.c - KUnit suites for scan code translation
+ *
+ * Included at the end of keyboard_driver.c when CONFIG_VINPUT_KUNIT_TEST
+ * is set. Every case gets an instance from vkbd_alloc() whose input
+ * device is registered with the input core, but not with vinput_core:
+ * no sysfs, injection device or debugfs, and the scan codes are handed
+ * straight to the decoder callbacks instead of going through the ring.
+ *
+ * vkbd_bench times the decoder over a few million make/break codes of
+ * the generator's letters and reports ns/scan code with kunit_info().
+ *
+ * License: MIT
+ */
+
+#include <kunit/test.h>
+#include <linux/delay.h>
+
+#define BENCH_SCANCODES (2U << 20)
+#define BENCH_SPAN      32  /* DRAIN_CHUNK of vinput_core.c */
+
+static unsigned int vkbd_test_frame_size;  /* sync_frame_size to restore */
+
+static int vkbd_test_init(struct kunit *test)
+{
+    const struct vinput_params params = {
+        .ring_size = ring_size,
+        .overflow  = overflow,
+        .bh_mode   = bh_mode,
+        .bh_budget = &bh_budget,
+        .bh_cpu    = -1,
+    };
+    struct vkbd_device *dev;
+    int ret;
+    
+    /* Resolved by vkbd_init(), unless the suite runs first */
+    if (!vkbd_class.ring_size) {
+        ret = vinput_setup(&vkbd_class, &params);
+        if (ret)
+            return ret;
+    }
+    
+    dev = vkbd_alloc(0);
+    if (IS_ERR(dev))
+        return PTR_ERR(dev);
+    
+    /* Input events need a registered device */
+    ret = input_register_device(dev->core.input);
+    if (ret) {
+        vkbd_destroy(dev);
+        return ret;
+    }
+    
+    vkbd_test_frame_size = sync_frame_size;
+    test->priv = dev;
+    return 0;
+}
+
+static void vkbd_test_exit(struct kunit *test)
+{
+    struct vkbd_device *dev = test->priv;
+    
+    sync_frame_size = vkbd_test_frame_size;
+    
+    /*
+     * A key left held keeps the repeat timer running: stop it first. A
+     * bottom-half run it kicked may still report, so the input device
+     * stays referenced until vinput_destroy() has stopped the bottom
+     * half; its input_free_device() drops the reference taken here.
+     */
+    vkbd_rep_stop(dev);
+    input_get_device(dev->core.input);
+    input_unregister_device(dev->core.input);
+    vkbd_destroy(dev);
+}
+
+/* Decode codes as one bottom-half run */
+static void vkbd_test_feed(struct vkbd_device *dev, const unsigned char *codes,
+                           unsigned int count)
+{
+    struct vinput_entry entries[16];
+    unsigned int i;
+    
+    for (i = 0; i < count && i < ARRAY_SIZE(entries); i++) {
+        entries[i].enqueue_ns = ktime_get_ns();
+        entries[i].data[0] = codes[i];
+    }
+    vkbd_process(&dev->core, entries, i);
+    vkbd_flush(&dev->core);
+}
+
+/* Reported state and the input core's view of it must agree */
+static void vkbd_test_expect_key(struct kunit *test, struct vkbd_device *dev,
+                                 unsigned int keycode, bool down)
+{
+    KUNIT_EXPECT_EQ(test, test_bit(keycode, dev->keys_down), down);
+    KUNIT_EXPECT_EQ(test, test_bit(keycode, dev->core.input->key), down);
+}
+
+/*
+ * Translation
+ */
+static void vkbd_test_make_break(struct kunit *test)
+{
+    static const unsigned char make[] = { 0x1E }, brk[] = { 0x9E };
+    struct vkbd_device *dev = test->priv;
+    
+    vkbd_test_feed(dev, make, 1);
+    vkbd_test_expect_key(test, dev, KEY_A, true);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 1);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 1);
+    
+    vkbd_test_feed(dev, brk, 1);
+    vkbd_test_expect_key(test, dev, KEY_A, false);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 2);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 2);
+    KUNIT_EXPECT_TRUE(test, bitmap_empty(dev->keys_down, KEY_CNT));
+}
+
+static void vkbd_test_extended(struct kunit *test)
+{
+    static const unsigned char codes[] = {
+        0xE0, 0x1D,   /* Right Ctrl down */
+        0x1D,         /* Left Ctrl down, the prefix applies once */
+        0xE0, 0x9D,   /* Right Ctrl up */
+    };
+    struct vkbd_device *dev = test->priv;
+    
+    vkbd_test_feed(dev, codes, 3);
+    vkbd_test_expect_key(test, dev, KEY_RIGHTCTRL, true);
+    vkbd_test_expect_key(test, dev, KEY_LEFTCTRL, true);
+    KUNIT_EXPECT_FALSE(test, dev->ext_prefix);
+    
+    /* A prefix at the end of a run carries over to the next one */
+    vkbd_test_feed(dev, &codes[3], 1);
+    KUNIT_EXPECT_TRUE(test, dev->ext_prefix);
+    vkbd_test_feed(dev, &codes[4], 1);
+    vkbd_test_expect_key(test, dev, KEY_RIGHTCTRL, false);
+    vkbd_test_expect_key(test, dev, KEY_LEFTCTRL, true);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 3);
+}
+
+static void vkbd_test_redundant(struct kunit *test)
+{
+    static const unsigned char codes[] = {
+        0x1E, 0x1E,   /* Held key: the second make changes nothing */
+        0x9E, 0x9E,   /* ... nor does the second break */
+        0xB0,         /* Break of a key that was never pressed */
+    };
+    struct vkbd_device *dev = test->priv;
+    
+    vkbd_test_feed(dev, codes, ARRAY_SIZE(codes));
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 2);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.redundant, 3);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 2);
+}
+
+static void vkbd_test_unmapped(struct kunit *test)
+{
+    static const unsigned char codes[] = { 0x00, 0x80, 0xE0, 0x01, 0xE0, 0x81 };
+    struct vkbd_device *dev = test->priv;
+    
+    /* KEY_RESERVED entries are dropped without touching any state */
+    vkbd_test_feed(dev, codes, ARRAY_SIZE(codes));
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.redundant, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 0);
+    KUNIT_EXPECT_FALSE(test, dev->ext_prefix);
+}
+
+static void vkbd_test_remap(struct kunit *test)
+{
+    static const unsigned char codes[] = { 0x1E, 0xE0, 0x5B };
+    struct vkbd_device *dev = test->priv;
+    struct input_keymap_entry ke = {
+        .len = sizeof(unsigned int),
+        .keycode = KEY_B,
+    };
+    unsigned int scancode = 0x1E;
+    
+    /* EVIOCSKEYCODE notation: 0x1E for A, 0xE05B for Left Meta */
+    memcpy(ke.scancode, &scancode, sizeof(scancode));
+    KUNIT_ASSERT_EQ(test, input_set_keycode(dev->core.input, &ke), 0);
+    scancode = 0xE05B;
+    ke.keycode = KEY_F13;
+    memcpy(ke.scancode, &scancode, sizeof(scancode));
+    KUNIT_ASSERT_EQ(test, input_set_keycode(dev->core.input, &ke), 0);
+    
+    KUNIT_EXPECT_FALSE(test, test_bit(KEY_A, dev->core.input->keybit));
+    KUNIT_EXPECT_TRUE(test, test_bit(KEY_F13, dev->core.input->keybit));
+    
+    vkbd_test_feed(dev, codes, ARRAY_SIZE(codes));
+    vkbd_test_expect_key(test, dev, KEY_B, true);
+    vkbd_test_expect_key(test, dev, KEY_F13, true);
+    vkbd_test_expect_key(test, dev, KEY_A, false);
+    vkbd_test_expect_key(test, dev, KEY_LEFTMETA, false);
+    
+    /* Scan codes outside both pages are refused */
+    scancode = 0xE080;
+    memcpy(ke.scancode, &scancode, sizeof(scancode));
+    KUNIT_EXPECT_EQ(test, input_set_keycode(dev->core.input, &ke), -EINVAL);
+}
+
+static void vkbd_test_keymap_index(struct kunit *test)
+{
+    unsigned int i;
+    
+    for (i = 0; i < KEYMAP_SIZE; i++)
+        KUNIT_EXPECT_EQ(test,
+                        keymap_scancode_to_index(keymap_index_to_scancode(i)), i);
+    
+    KUNIT_EXPECT_EQ(test, keymap_index_to_scancode(KEYMAP_EXT | 0x1D), 0xE01D);
+    KUNIT_EXPECT_EQ(test, keymap_scancode_to_index(0x80), KEYMAP_SIZE);
+    KUNIT_EXPECT_EQ(test, keymap_scancode_to_index(0xE080), KEYMAP_SIZE);
+    KUNIT_EXPECT_EQ(test, keymap_scancode_to_index(0xE11D), KEYMAP_SIZE);
+}
+
+static void vkbd_test_frames(struct kunit *test)
+{
+    static const unsigned char codes[] = {
+        0x1E, 0x30,   /* A and B down share a frame */
+        0x9E,         /* A again: new frame, or the press would be lost */
+        0xB0,
+    };
+    struct vkbd_device *dev = test->priv;
+    
+    sync_frame_size = 0;
+    vkbd_test_feed(dev, codes, ARRAY_SIZE(codes));
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 4);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 2);
+    KUNIT_EXPECT_EQ(test, dev->frame_len, 0);
+    KUNIT_EXPECT_TRUE(test, bitmap_empty(dev->keys_down, KEY_CNT));
+}
+
+/*
+ * Typematic repeat
+ * Most expiries are simulated by marking the current key-down due, the
+ * timer is only checked for being armed; vkbd_test_repeat_timer is the
+ * one case that lets it run.
+ */
+static void vkbd_test_expire(struct vkbd_device *dev, unsigned int gen)
+{
+    spin_lock_irq(&dev->rep_lock);
+    dev->rep_due = gen;
+    dev->rep_due_ns = ktime_get_ns();
+    spin_unlock_irq(&dev->rep_lock);
+}
+
+static void vkbd_test_repeat(struct kunit *test)
+{
+    static const unsigned char codes[] = {
+        0x1E, 0x30,   /* A down, then B: B is the one that repeats */
+        0x9E,         /* A up: B keeps repeating */
+        0xB0,         /* B up: repeat stops */
+    };
+    struct vkbd_device *dev = test->priv;
+    unsigned int gen;
+    
+    vkbd_test_feed(dev, codes, 2);
+    KUNIT_EXPECT_EQ(test, dev->rep_key, KEY_B);
+    KUNIT_EXPECT_EQ(test, dev->rep_armed, dev->rep_gen);
+    KUNIT_EXPECT_TRUE(test, hrtimer_active(&dev->rep_timer));
+    
+    vkbd_test_expire(dev, dev->rep_gen);
+    vkbd_test_feed(dev, &codes[2], 1);
+    vkbd_test_expect_key(test, dev, KEY_A, false);
+    vkbd_test_expect_key(test, dev, KEY_B, true);
+    KUNIT_EXPECT_EQ(test, dev->rep_key, KEY_B);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 4);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 4);
+    
+    /* A flush with nothing decoded still reports the owed repeat */
+    vkbd_test_expire(dev, dev->rep_gen);
+    vkbd_test_feed(dev, codes, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 5);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 5);
+    
+    vkbd_test_feed(dev, &codes[3], 1);
+    KUNIT_EXPECT_EQ(test, dev->rep_key, KEY_RESERVED);
+    KUNIT_EXPECT_FALSE(test, hrtimer_active(&dev->rep_timer));
+    
+    /* An expiry that raced with the release reports nothing */
+    vkbd_test_expire(dev, dev->rep_gen);
+    vkbd_test_feed(dev, codes, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 6);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 6);
+    
+    /* ... nor one of A's key-down that lands after B was pressed */
+    vkbd_test_feed(dev, codes, 1);
+    gen = dev->rep_gen;
+    vkbd_test_feed(dev, &codes[1], 1);
+    KUNIT_EXPECT_NE(test, dev->rep_gen, gen);
+    vkbd_test_expire(dev, gen);
+    vkbd_test_feed(dev, codes, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 8);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 8);
+    KUNIT_EXPECT_EQ(test, dev->rep_due, 0);
+}
+
+static void vkbd_test_repeat_off(struct kunit *test)
+{
+    static const unsigned char codes[] = { 0x1E, 0x9E };
+    struct vkbd_device *dev = test->priv;
+    
+    /* EVIOCSREP with a period of 0 */
+    dev->core.input->rep[REP_PERIOD] = 0;
+    vkbd_test_feed(dev, codes, 1);
+    KUNIT_EXPECT_EQ(test, dev->rep_key, KEY_A);
+    KUNIT_EXPECT_NE(test, dev->rep_armed, dev->rep_gen);
+    KUNIT_EXPECT_FALSE(test, hrtimer_active(&dev->rep_timer));
+    vkbd_test_feed(dev, &codes[1], 1);
+    KUNIT_EXPECT_EQ(test, dev->rep_key, KEY_RESERVED);
+}
+
+/*
+ * The real timer, with the bottom half reporting the repeats. The key is
+ * left held on purpose: vkbd_test_exit() must stop the timer before the
+ * input device goes away.
+ */
+static void vkbd_test_repeat_timer(struct kunit *test)
+{
+    static const unsigned char codes[] = { 0x1E };
+    struct vkbd_device *dev = test->priv;
+    
+    dev->core.input->rep[REP_DELAY] = 1;
+    dev->core.input->rep[REP_PERIOD] = 1;
+    vkbd_test_feed(dev, codes, 1);
+    msleep(50);
+    
+    vkbd_test_expect_key(test, dev, KEY_A, true);
+    KUNIT_EXPECT_GT(test, READ_ONCE(dev->core.stats.events_reported), 1);
+    KUNIT_EXPECT_TRUE(test, hrtimer_active(&dev->rep_timer));
+}
+
+static struct kunit_case vkbd_test_cases[] = {
+    KUNIT_CASE(vkbd_test_make_break),
+    KUNIT_CASE(vkbd_test_extended),
+    KUNIT_CASE(vkbd_test_redundant),
+    KUNIT_CASE(vkbd_test_unmapped),
+    KUNIT_CASE(vkbd_test_remap),
+    KUNIT_CASE(vkbd_test_keymap_index),
+    KUNIT_CASE(vkbd_test_frames),
+    KUNIT_CASE(vkbd_test_repeat),
+    KUNIT_CASE(vkbd_test_repeat_off),
+    KUNIT_CASE(vkbd_test_repeat_timer),
+    {}
+};
+
+static struct kunit_suite vkbd_test_suite = {
+    .name       = "vkbd",
+    .init       = vkbd_test_init,
+    .exit       = vkbd_test_exit,
+    .test_cases = vkbd_test_cases,
+};
+
+/*
+ * Microbenchmarks
+ * Spans of BENCH_SPAN codes, the way vinput_bh_run() hands them over
+ */
+static void vkbd_bench_run(struct kunit *test, const char *what)
+{
+    struct vkbd_device *dev = test->priv;
+    struct vinput_entry entries[2 * ARRAY_SIZE(gen_keys)];
+    unsigned int done, i, n;
+    u64 start, ns;
+    
+    for (i = 0; i < ARRAY_SIZE(entries); i++) {
+        entries[i].enqueue_ns = ktime_get_ns();
+        vkbd_gen_record(&dev->core, i, entries[i].data);
+    }
+    
+    start = ktime_get_ns();
+    for (done = 0; done < BENCH_SCANCODES; done += ARRAY_SIZE(entries)) {
+        for (i = 0; i < ARRAY_SIZE(entries); i += n) {
+            n = min_t(unsigned int, BENCH_SPAN, ARRAY_SIZE(entries) - i);
+            vkbd_process(&dev->core, &entries[i], n);
+        }
+        vkbd_flush(&dev->core);
+        cond_resched();
+    }
+    ns = ktime_get_ns() - start;
+    
+    KUNIT_EXPECT_TRUE(test, bitmap_empty(dev->keys_down, KEY_CNT));
+    kunit_info(test, "%s: %u scan codes, %llu events, %llu frames: %llu ns/scan code\n",
+               what, done, dev->core.stats.events_reported,
+               dev->core.stats.frames, div_u64(ns, done));
+}
+
+static void vkbd_bench_decode(struct kunit *test)
+{
+    sync_frame_size = 1;
+    vkbd_bench_run(test, "sync per key");
+}
+
+static void vkbd_bench_decode_coalesced(struct kunit *test)
+{
+    sync_frame_size = 0;
+    vkbd_bench_run(test, "sync per run");
+}
+
+static struct kunit_case vkbd_bench_cases[] = {
+    KUNIT_CASE(vkbd_bench_decode),
+    KUNIT_CASE(vkbd_bench_decode_coalesced),
+    {}
+};
+
+static struct kunit_suite vkbd_bench_suite = {
+    .name       = "vkbd_bench",
+    .init       = vkbd_test_init,
+    .exit       = vkbd_test_exit,
+    .test_cases = vkbd_bench_cases,
+};
+
+kunit_test_suites(&vkbd_test_suite, &vkbd_bench_suite);
@@ -0,0 +1,70 @@
+/*
+ * keyboard_trace.h - Tracepoints for the virtual keyboard driver
+ *
+ * Decode and frame report events, tagged with the instance name, cost
+ * nothing when tracing is off; injection and ring events are traced by
+ * vinput_core (vinput:*).
+ * Capture them with ftrace or perf:
+ *
+ *   echo 1 > /sys/kernel/tracing/events/vkbd/enable
+ *   perf record -e 'vkbd:*' -a
+ *
+ * License: MIT
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vkbd
+
+#if !defined(_KEYBOARD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _KEYBOARD_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "vinput_core.h"
+
+TRACE_EVENT(vkbd_decode,
+    TP_PROTO(const struct vinput_device *vdev, unsigned int scancode,
+             unsigned int keycode, bool release),
+    TP_ARGS(vdev, scancode, keycode, release),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(unsigned int, scancode)
+        __field(unsigned int, keycode)
+        __field(bool, release)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->scancode = scancode;
+        __entry->keycode = keycode;
+        __entry->release = release;
+    ),
+    TP_printk("%s scancode=0x%x keycode=%u %s", __entry->dev,
+              __entry->scancode, __entry->keycode,
+              __entry->release ? "release" : "press")
+);
+
+TRACE_EVENT(vkbd_report,
+    TP_PROTO(const struct vinput_device *vdev, unsigned int keys,
+             u64 latency_ns),
+    TP_ARGS(vdev, keys, latency_ns),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(unsigned int, keys)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->keys = keys;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("%s keys=%u latency_ns=%llu", __entry->dev, __entry->keys,
+              __entry->latency_ns)
+);
+
+#endif /* _KEYBOARD_TRACE_H */
+
+/* Out-of-tree module: the header lives next to the source */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE keyboard_trace
+#include <trace/define_trace.h>
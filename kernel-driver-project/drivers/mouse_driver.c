@@ -3,17 +3,28 @@
  * 
  * Educational Linux kernel module demonstrating:
  * - Input subsystem integration for mouse events
- * - PS/2 3-byte packet parsing
+ * - PS/2 3-byte, IntelliMouse 4-byte and 16-bit delta packet parsing
  * - Relative motion and button tracking
- * - IRQ simulation with tasklets
- * - Sysfs interface for testing
- * - Proper locking and buffering
+ * - Fixed-point pointer acceleration with sub-count remainder carry
+ * - A protocol decoder on top of the shared vinput_core module, which
+ *   provides the ring, budgeted bottom half, sysfs/character device
+ *   injection, load generator, statistics and tracing
+ * - Multiple independent instances with per-CPU bottom halves
  *
  * PS/2 Mouse Packet Format (3 bytes):
  * Byte 0: [Y_overflow | X_overflow | Y_sign | X_sign | 1 | Middle | Right | Left]
  * Byte 1: X movement (8-bit signed)
  * Byte 2: Y movement (8-bit signed)
  *
+ * protocol=imps (IntelliMouse) adds Byte 3: wheel (8-bit signed).
+ * protocol=exps (IntelliMouse Explorer) adds Byte 3:
+ *   [0 | 0 | Button 5 | Button 4 | Wheel (4-bit signed)]
+ * protocol=hires (7 bytes) carries 16-bit little-endian deltas:
+ * Byte 0:    [0 | 0 | Button 5 | Button 4 | 1 | Middle | Right | Left]
+ * Byte 1-2:  X movement, Byte 3-4: Y movement
+ * Byte 5-6:  wheel in 1/120 detent units (REL_WHEEL_HI_RES)
+ * All formats use the PS/2 conventions: Y up and wheel down are positive.
+ *
  * License: MIT
  */
 
@@ -21,29 +32,155 @@
 #include <linux/kernel.h>
 #include <linux/init.h>
 #include <linux/input.h>
-#include <linux/interrupt.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
 #include <linux/device.h>
 #include <linux/sysfs.h>
+#include <linux/moduleparam.h>
+#include <linux/hash.h>
+#include <linux/mutex.h>
+#include <linux/rcupdate.h>
+#include <linux/overflow.h>
+
+#include "vinput_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "mouse_trace.h"
 
 #define DRIVER_NAME "virtual_mouse"
-#define BUFFER_SIZE 256  /* Must be multiple of 3 for packet alignment */
-#define PACKET_SIZE 3
+#define BUFFER_SIZE 128  /* Default ring_size, in packets */
 
-/* Driver data structure */
+/*
+ * Decoded packet, in Linux conventions
+ * buttons uses the VMOUSE_BTN_* bits; wheel is in REL_WHEEL_HI_RES units
+ * (120 per detent).
+ */
+struct vmouse_sample {
+    unsigned int buttons;
+    int dx, dy;
+    int wheel;
+};
+
+/* Driver data structure, one per instance */
 struct vmouse_device {
-    struct input_dev *input;
-    struct tasklet_struct tasklet;
-    spinlock_t buffer_lock;
-    unsigned char buffer[BUFFER_SIZE];
-    unsigned int head;
-    unsigned int tail;
-    unsigned char packet[PACKET_SIZE];
-    unsigned int packet_idx;
+    struct vinput_device core;        /* Ring, bottom half, injection */
+    struct vmouse_sample acc;         /* Motion coalesced into the open frame */
+    unsigned int acc_packets;
+    u64 acc_ns;                       /* Enqueue time of the oldest one */
+    u64 acc_last_ns;                  /* ... and of the newest */
+    int wheel_rem;                    /* Hi-res wheel not yet a full detent */
+    unsigned int buttons;             /* Reported state, see buttons in sysfs */
+    int pos_x, pos_y;                 /* Sum of reported motion */
+    struct vmouse_accel __rcu *accel; /* Filter profile, see accel/ in sysfs */
+    struct mutex accel_lock;          /* Serializes profile updates */
+    int rem_x, rem_y;                 /* Scaled motion below one count, Q8 */
+    unsigned int speed;               /* Smoothed speed estimate, Q8 */
+};
+
+#define to_vmouse(vdev) container_of(vdev, struct vmouse_device, core)
+
+static struct vmouse_device *vmouse_devs[VINPUT_MAX_DEVICES];
+static unsigned int vmouse_count;
+
+/*
+ * Instances
+ * Each instance is a separate input device with its own ring, bottom
+ * half, sysfs node, injection device and statistics. Instance 0 keeps
+ * the unsuffixed names; instance N appends N (vmouse_inject2, ...).
+ */
+static unsigned int num_devices = 1;
+module_param(num_devices, uint, 0444);
+MODULE_PARM_DESC(num_devices, "Number of mouse instances (1-" __stringify(VINPUT_MAX_DEVICES) ")");
+
+/*
+ * Motion coalescing
+ * With coalesce_motion set, consecutive packets of one bottom-half run
+ * that share a button state are summed into a single REL frame; a button
+ * transition flushes the accumulated motion first. coalesce_max caps the
+ * packets per frame (0 = whole run). Both are writable at runtime.
+ */
+static bool coalesce_motion;
+module_param(coalesce_motion, bool, 0644);
+MODULE_PARM_DESC(coalesce_motion, "Sum motion of same-button packets into one frame per bottom-half run");
+
+static unsigned int coalesce_max;
+module_param(coalesce_max, uint, 0644);
+MODULE_PARM_DESC(coalesce_max, "Max packets coalesced into one frame (0 = unlimited)");
+
+/*
+ * Ring capacity and overflow policy
+ * ring_size (packets) is rounded up to a power of two. When the ring is
+ * full, drop-newest discards the packets that do not fit, drop-oldest
+ * overwrites the oldest queued packets and block makes the writer sleep
+ * until the bottom half makes room (write() honours O_NONBLOCK). Drops
+ * always remove whole packets, so framing survives an overflow. Under
+ * drop-newest write() and VINPUT_IOC_KICK report a short count instead.
+ */
+static unsigned int ring_size = BUFFER_SIZE;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Ring capacity in packets, rounded up to a power of two (16-65536)");
+
+static char *overflow = "drop-newest";
+module_param(overflow, charp, 0444);
+MODULE_PARM_DESC(overflow, "Full-ring policy: drop-newest, drop-oldest or block");
+
+/*
+ * Packet protocol
+ * ps2 is the classic 3-byte packet. imps and exps add the IntelliMouse
+ * wheel byte (exps also carries buttons 4 and 5), and hires is a native
+ * format with 16-bit deltas and a hi-res wheel, so a large motion is one
+ * packet instead of many 8-bit ones. The choice applies to every
+ * injection path and to all instances.
+ */
+enum vmouse_protocol {
+    PROTO_PS2,
+    PROTO_IMPS,
+    PROTO_EXPS,
+    PROTO_HIRES,
+};
+
+static const char * const protocol_names[] = {
+    [PROTO_PS2]   = "ps2",
+    [PROTO_IMPS]  = "imps",
+    [PROTO_EXPS]  = "exps",
+    [PROTO_HIRES] = "hires",
+};
+
+static const unsigned int protocol_sizes[] = {
+    [PROTO_PS2]   = 3,
+    [PROTO_IMPS]  = 4,
+    [PROTO_EXPS]  = 4,
+    [PROTO_HIRES] = 7,
 };
 
-static struct vmouse_device *vmouse_dev;
+static char *protocol = "ps2";
+module_param(protocol, charp, 0444);
+MODULE_PARM_DESC(protocol, "Packet format: ps2, imps, exps or hires");
+
+static int vmouse_protocol;                 /* protocol resolved at load time */
+static unsigned int vmouse_packet_size = 3;  /* Bytes per packet */
+
+/*
+ * Bottom-half execution
+ * bh_mode selects the backend at load time; bh_budget caps the packets
+ * processed per run (0 = until the ring is empty) and may be changed at
+ * runtime; bh_cpu pins the kthread/workqueue backends to one CPU, while
+ * bh_spread gives every instance its own CPU instead.
+ */
+static char *bh_mode = "tasklet";
+module_param(bh_mode, charp, 0444);
+MODULE_PARM_DESC(bh_mode, "Bottom-half backend: tasklet, workqueue or kthread");
+
+static unsigned int bh_budget = 85;
+module_param(bh_budget, uint, 0644);
+MODULE_PARM_DESC(bh_budget, "Max packets per bottom-half run before rescheduling (0 = unlimited)");
+
+static int bh_cpu = -1;
+module_param(bh_cpu, int, 0444);
+MODULE_PARM_DESC(bh_cpu, "CPU for the kthread/workqueue backends (-1 = any)");
+
+static bool bh_spread;
+module_param(bh_spread, bool, 0444);
+MODULE_PARM_DESC(bh_spread, "Spread instance kthread/workqueue bottom halves across CPUs");
 
 /*
  * PS/2 Packet Bit Definitions
@@ -56,147 +193,414 @@ static struct vmouse_device *vmouse_dev;
 #define PS2_Y_SIGN      (1 << 5)
 #define PS2_X_OVERFLOW  (1 << 6)
 #define PS2_Y_OVERFLOW  (1 << 7)
+#define PS2_BTN_MASK    (PS2_LEFT_BTN | PS2_RIGHT_BTN | PS2_MIDDLE_BTN)
+
+/* Buttons 4 and 5: exps byte 3, hires byte 0 */
+#define PS2_BTN4        (1 << 4)
+#define PS2_BTN5        (1 << 5)
+#define EXPS_WHEEL_SIGN (1 << 3)
+#define EXPS_WHEEL_MASK 0x07
+
+/* Decoded button bits (struct vmouse_sample) */
+#define VMOUSE_BTN_LEFT   (1 << 0)
+#define VMOUSE_BTN_RIGHT  (1 << 1)
+#define VMOUSE_BTN_MIDDLE (1 << 2)
+#define VMOUSE_BTN_SIDE   (1 << 3)
+#define VMOUSE_BTN_EXTRA  (1 << 4)
+
+/* Button code of each VMOUSE_BTN_* bit */
+static const unsigned short vmouse_btn_codes[] = {
+    BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_SIDE, BTN_EXTRA,
+};
+
+#define WHEEL_DETENT 120  /* REL_WHEEL_HI_RES units per REL_WHEEL step */
+
+/*
+ * Pointer Acceleration and Filtering
+ * An optional stage between decode and input_report_rel(). Each delta is
+ * scaled by a gain chosen from the packet's speed (counts per packet)
+ * and the device's profile:
+ *
+ *   flat   - constant gain
+ *   linear - 1.0 up to threshold, then slope more per count, capped at
+ *            max_gain
+ *   curve  - table of gains every ACCEL_CURVE_STEP counts, interpolated
+ *
+ * sensitivity multiplies the result of every profile. All math is Q8
+ * fixed point (256 = 1.0) with constant work per packet, so it is safe
+ * in the bottom half. The fraction of a count left over by scaling is
+ * carried into the next packet, so slow motion is never rounded away.
+ * smoothing low-pass filters the speed estimate, which keeps sensor
+ * jitter from flickering the gain. The defaults (flat, 1.0) are an exact
+ * pass-through.
+ */
+#define ACCEL_SHIFT       8
+#define ACCEL_ONE         (1 << ACCEL_SHIFT)  /* Gain 1.0 */
+#define ACCEL_GAIN_MAX    (16 * ACCEL_ONE)    /* Bounds deltas to 2^27 */
+#define ACCEL_SPEED_MAX   4096                /* Counts/packet, faster is clamped */
+#define ACCEL_CURVE_MAX   16                  /* Points in a curve */
+#define ACCEL_CURVE_SHIFT (ACCEL_SHIFT + 2)   /* Q8 speed -> curve point */
+#define ACCEL_CURVE_STEP  (1 << (ACCEL_CURVE_SHIFT - ACCEL_SHIFT))
+
+enum vmouse_accel_profile {
+    ACCEL_FLAT,
+    ACCEL_LINEAR,
+    ACCEL_CURVE,
+};
+
+static const char * const accel_profile_names[] = {
+    [ACCEL_FLAT]   = "flat",
+    [ACCEL_LINEAR] = "linear",
+    [ACCEL_CURVE]  = "curve",
+};
 
 /*
- * Buffer Management Functions
- * Circular buffer for packet bytes with proper locking
+ * Filter profile, replaced as a whole (RCU) so the bottom half never
+ * sees a half-updated one
  */
-static bool buffer_empty(struct vmouse_device *dev)
+struct vmouse_accel {
+    int profile;                        /* enum vmouse_accel_profile */
+    unsigned int sensitivity;           /* Q8 gain applied on top */
+    unsigned int threshold;             /* linear: counts/packet at gain 1.0 */
+    unsigned int slope;                 /* linear: Q8 gain per count above */
+    unsigned int max_gain;              /* linear: Q8 cap */
+    unsigned int smoothing;             /* Q8 weight of the previous speed */
+    unsigned int curve_len;
+    unsigned int curve[ACCEL_CURVE_MAX];  /* Q8 gains */
+    struct rcu_head rcu;
+};
+
+static const struct vmouse_accel accel_defaults = {
+    .profile     = ACCEL_FLAT,
+    .sensitivity = ACCEL_ONE,
+    .threshold   = 4,
+    .slope       = ACCEL_ONE / 8,
+    .max_gain    = 4 * ACCEL_ONE,
+};
+
+/*
+ * Speed of one packet in Q8 counts, max + min/2 approximating the
+ * Euclidean length without a square root
+ */
+static unsigned int vmouse_speed(int dx, int dy)
 {
-    return dev->head == dev->tail;
+    unsigned int ax = abs(dx), ay = abs(dy);
+    unsigned int speed = max(ax, ay) + min(ax, ay) / 2;
+    
+    return min_t(unsigned int, speed, ACCEL_SPEED_MAX) << ACCEL_SHIFT;
 }
 
-static bool buffer_full(struct vmouse_device *dev)
+static unsigned int vmouse_accel_gain(const struct vmouse_accel *a,
+                                      unsigned int speed)
 {
-    return ((dev->head + 1) % BUFFER_SIZE) == dev->tail;
+    unsigned int gain = ACCEL_ONE, thr, idx, frac;
+    int lo, hi;
+    
+    switch (a->profile) {
+    case ACCEL_LINEAR:
+        thr = a->threshold << ACCEL_SHIFT;
+        if (speed > thr)
+            gain += min_t(u64, ((u64)(speed - thr) * a->slope) >> ACCEL_SHIFT,
+                          ACCEL_GAIN_MAX);
+        gain = min(gain, a->max_gain);
+        break;
+    case ACCEL_CURVE:
+        if (!a->curve_len)
+            break;
+        idx = speed >> ACCEL_CURVE_SHIFT;
+        if (idx >= a->curve_len - 1) {
+            gain = a->curve[a->curve_len - 1];
+            break;
+        }
+        /* Interpolate between the two surrounding points */
+        frac = speed & ((1 << ACCEL_CURVE_SHIFT) - 1);
+        lo = a->curve[idx];
+        hi = a->curve[idx + 1];
+        gain = lo + (((hi - lo) * (int)frac) >> ACCEL_CURVE_SHIFT);
+        break;
+    }
+    
+    gain = (gain * a->sensitivity) >> ACCEL_SHIFT;
+    return min_t(unsigned int, gain, ACCEL_GAIN_MAX);
+}
+
+/* Scale one delta, carrying the sub-count remainder (rounds toward zero) */
+static int vmouse_accel_scale(int delta, unsigned int gain, int *rem)
+{
+    int v = delta * (int)gain + *rem;
+    int out = v / ACCEL_ONE;
+    
+    *rem = v - out * ACCEL_ONE;
+    return out;
 }
 
-static void buffer_push(struct vmouse_device *dev, unsigned char byte)
+/*
+ * Decode a validated packet of the active protocol
+ */
+static void vmouse_decode(const unsigned char *packet, struct vmouse_sample *s)
 {
-    unsigned long flags;
+    unsigned char status = packet[0];
     
-    spin_lock_irqsave(&dev->buffer_lock, flags);
+    /* Extract button states */
+    s->buttons = status & PS2_BTN_MASK;
+    s->wheel = 0;
     
-    if (!buffer_full(dev)) {
-        dev->buffer[dev->head] = byte;
-        dev->head = (dev->head + 1) % BUFFER_SIZE;
-    } else {
-        pr_warn("%s: Buffer overflow, dropping byte 0x%02x\n",
-                DRIVER_NAME, byte);
+    switch (vmouse_protocol) {
+    case PROTO_HIRES:
+        s->dx = (s16)(packet[1] | packet[2] << 8);
+        s->dy = (s16)(packet[3] | packet[4] << 8);
+        s->wheel = (s16)(packet[5] | packet[6] << 8);
+        if (status & PS2_BTN4)
+            s->buttons |= VMOUSE_BTN_SIDE;
+        if (status & PS2_BTN5)
+            s->buttons |= VMOUSE_BTN_EXTRA;
+        break;
+    default:
+        /* Calculate relative movement (already signed) */
+        s->dx = (signed char)packet[1];
+        s->dy = (signed char)packet[2];
+        if (vmouse_protocol == PROTO_IMPS) {
+            s->wheel = (signed char)packet[3] * WHEEL_DETENT;
+        } else if (vmouse_protocol == PROTO_EXPS) {
+            s->wheel = ((int)(packet[3] & EXPS_WHEEL_MASK) -
+                        (int)(packet[3] & EXPS_WHEEL_SIGN)) * WHEEL_DETENT;
+            if (packet[3] & PS2_BTN4)
+                s->buttons |= VMOUSE_BTN_SIDE;
+            if (packet[3] & PS2_BTN5)
+                s->buttons |= VMOUSE_BTN_EXTRA;
+        }
+        break;
     }
     
-    spin_unlock_irqrestore(&dev->buffer_lock, flags);
+    /* PS/2 Y axis and wheel are inverted compared to Linux convention */
+    s->dy = -s->dy;
+    s->wheel = -s->wheel;
 }
 
-static int buffer_pop(struct vmouse_device *dev, unsigned char *byte)
+/*
+ * Report one frame: changed buttons, relative motion and SYN_REPORT
+ * start_ns and last_ns are the enqueue times of the oldest and newest
+ * packet in the frame; the frame carries last_ns as its timestamp. Hi-res
+ * wheel motion is reported as is; REL_WHEEL follows once whole detents
+ * have accumulated. Only buttons that differ from the reported state
+ * and nonzero axes are sent; a frame with neither is not synced at all.
+ * Returns false for such an empty frame.
+ */
+static bool vmouse_report(struct vmouse_device *dev,
+                          const struct vmouse_sample *s, u64 start_ns,
+                          u64 last_ns)
 {
-    unsigned long flags;
-    int ret = 0;
+    struct input_dev *input = dev->core.input;
+    unsigned int changed = s->buttons ^ dev->buttons;
+    unsigned int i;
+    int detents;
+    u64 latency;
     
-    spin_lock_irqsave(&dev->buffer_lock, flags);
+    if (!changed && !s->dx && !s->dy && !s->wheel)
+        return false;
     
-    if (!buffer_empty(dev)) {
-        *byte = dev->buffer[dev->tail];
-        dev->tail = (dev->tail + 1) % BUFFER_SIZE;
-        ret = 1;
+    /* Report button transitions */
+    for (i = 0; changed; i++, changed >>= 1) {
+        if (changed & 1)
+            input_report_key(input, vmouse_btn_codes[i],
+                             s->buttons & (1U << i));
     }
+    WRITE_ONCE(dev->buttons, s->buttons);
     
-    spin_unlock_irqrestore(&dev->buffer_lock, flags);
+    /* Report relative motion */
+    if (s->dx != 0)
+        input_report_rel(input, REL_X, s->dx);
+    if (s->dy != 0)
+        input_report_rel(input, REL_Y, s->dy);
+    WRITE_ONCE(dev->pos_x, dev->pos_x + s->dx);
+    WRITE_ONCE(dev->pos_y, dev->pos_y + s->dy);
+    
+    if (s->wheel != 0) {
+        input_report_rel(input, REL_WHEEL_HI_RES, s->wheel);
+        dev->wheel_rem += s->wheel;
+        detents = dev->wheel_rem / WHEEL_DETENT;
+        if (detents) {
+            input_report_rel(input, REL_WHEEL, detents);
+            dev->wheel_rem -= detents * WHEEL_DETENT;
+        }
+    }
     
-    return ret;
+    /* Sync to indicate complete event */
+    latency = vinput_sync_frame(&dev->core, start_ns, last_ns);
+    trace_vmouse_report(&dev->core, s->buttons, s->dx, s->dy, s->wheel,
+                        latency);
+    return true;
 }
 
 /*
- * Parse and Process PS/2 Mouse Packet
- * Returns true if packet is valid
+ * Add one packet's motion to the open frame
+ * Returns false, leaving the frame untouched, if a sum would overflow.
  */
-static bool process_packet(struct vmouse_device *dev)
+static bool vmouse_coalesce(struct vmouse_sample *acc,
+                            const struct vmouse_sample *s)
 {
-    unsigned char status = dev->packet[0];
-    signed char dx_raw = (signed char)dev->packet[1];
-    signed char dy_raw = (signed char)dev->packet[2];
-    int dx, dy;
-    bool left, right, middle;
+    int dx, dy, wheel;
     
-    /* Validate packet - bit 3 should always be 1 */
-    if (!(status & PS2_ALWAYS_ONE)) {
-        pr_debug("%s: Invalid packet - bit 3 not set (0x%02x 0x%02x 0x%02x)\n",
-                 DRIVER_NAME, dev->packet[0], dev->packet[1], dev->packet[2]);
+    if (check_add_overflow(acc->dx, s->dx, &dx) ||
+        check_add_overflow(acc->dy, s->dy, &dy) ||
+        check_add_overflow(acc->wheel, s->wheel, &wheel))
         return false;
-    }
     
-    /* Check for overflow - just log and clamp if needed */
-    if (status & PS2_X_OVERFLOW) {
-        pr_debug("%s: X overflow detected\n", DRIVER_NAME);
-    }
-    if (status & PS2_Y_OVERFLOW) {
-        pr_debug("%s: Y overflow detected\n", DRIVER_NAME);
+    acc->dx = dx;
+    acc->dy = dy;
+    acc->wheel = wheel;
+    return true;
+}
+
+/*
+ * Emit the coalesced frame, if any
+ */
+static void vmouse_flush_motion(struct vmouse_device *dev)
+{
+    if (!dev->acc_packets)
+        return;
+    
+    if (vmouse_report(dev, &dev->acc, dev->acc_ns, dev->acc_last_ns))
+        dev->core.stats.events_reported += dev->acc_packets;
+    else
+        dev->core.stats.redundant += dev->acc_packets;
+    dev->acc_packets = 0;
+}
+
+/*
+ * Run the filter stage on one decoded packet (bottom half)
+ */
+static void vmouse_accel_apply(struct vmouse_device *dev,
+                               struct vmouse_sample *s)
+{
+    const struct vmouse_accel *a;
+    unsigned int speed, gain;
+    
+    if (!s->dx && !s->dy)
+        return;
+    
+    rcu_read_lock();
+    a = rcu_dereference(dev->accel);
+    if (a->profile == ACCEL_FLAT && a->sensitivity == ACCEL_ONE) {
+        rcu_read_unlock();
+        return;  /* Pass-through */
     }
     
-    /* Extract button states */
-    left = (status & PS2_LEFT_BTN) != 0;
-    right = (status & PS2_RIGHT_BTN) != 0;
-    middle = (status & PS2_MIDDLE_BTN) != 0;
+    speed = vmouse_speed(s->dx, s->dy);
+    if (a->smoothing)
+        speed = (dev->speed * a->smoothing +
+                 speed * (ACCEL_ONE - a->smoothing)) >> ACCEL_SHIFT;
+    dev->speed = speed;
+    gain = vmouse_accel_gain(a, speed);
+    rcu_read_unlock();
     
-    /* Calculate relative movement (already signed) */
-    dx = dx_raw;
-    dy = dy_raw;
+    s->dx = vmouse_accel_scale(s->dx, gain, &dev->rem_x);
+    s->dy = vmouse_accel_scale(s->dy, gain, &dev->rem_y);
+}
+
+/*
+ * Process one queued packet
+ * The packet was validated at enqueue time.
+ */
+static void process_packet(struct vmouse_device *dev,
+                           const struct vinput_entry *entry)
+{
+    struct vmouse_sample s;
+    unsigned int max;
     
-    /* PS/2 Y axis is inverted compared to Linux convention */
-    dy = -dy;
+    trace_vmouse_decode(&dev->core, entry->data, vmouse_packet_size);
+    vmouse_decode(entry->data, &s);
+    vmouse_accel_apply(dev, &s);
     
-    pr_debug("%s: Packet: buttons[L:%d R:%d M:%d] dx:%d dy:%d\n",
-             DRIVER_NAME, left, right, middle, dx, dy);
+    if (!READ_ONCE(coalesce_motion)) {
+        if (vmouse_report(dev, &s, entry->enqueue_ns, entry->enqueue_ns))
+            dev->core.stats.events_reported++;
+        else
+            dev->core.stats.redundant++;
+        return;
+    }
     
-    /* Report button events */
-    input_report_key(dev->input, BTN_LEFT, left);
-    input_report_key(dev->input, BTN_RIGHT, right);
-    input_report_key(dev->input, BTN_MIDDLE, middle);
+    /*
+     * A button transition closes the frame under the old state, motion
+     * that no longer fits in the sums closes it as is
+     */
+    if (dev->acc_packets && (s.buttons != dev->acc.buttons ||
+                             !vmouse_coalesce(&dev->acc, &s)))
+        vmouse_flush_motion(dev);
     
-    /* Report relative motion */
-    if (dx != 0)
-        input_report_rel(dev->input, REL_X, dx);
-    if (dy != 0)
-        input_report_rel(dev->input, REL_Y, dy);
+    if (!dev->acc_packets) {
+        dev->acc = s;
+        dev->acc_ns = entry->enqueue_ns;
+    }
+    dev->acc_last_ns = entry->enqueue_ns;
+    dev->acc_packets++;
     
-    /* Sync to indicate complete event */
-    input_sync(dev->input);
+    max = READ_ONCE(coalesce_max);
+    if (max && dev->acc_packets >= max)
+        vmouse_flush_motion(dev);
+}
+
+/*
+ * Decoder Callbacks (Bottom Half)
+ * vinput_core hands over each drained span of packets; coalesced motion
+ * never outlives the run that drained it.
+ */
+static void vmouse_process(struct vinput_device *vdev,
+                           const struct vinput_entry *entries, unsigned int count)
+{
+    struct vmouse_device *dev = to_vmouse(vdev);
+    unsigned int i;
     
-    return true;
+    for (i = 0; i < count; i++)
+        process_packet(dev, &entries[i]);
+}
+
+static void vmouse_flush(struct vinput_device *vdev)
+{
+    vmouse_flush_motion(to_vmouse(vdev));
 }
 
 /*
- * Tasklet Bottom-Half Handler
- * Assembles 3-byte packets and processes them
+ * Validation: bit 3 of the status byte is always set
+ * Checked at enqueue time, and used by the raw byte framer to resync.
  */
-static void vmouse_tasklet_handler(unsigned long data)
-{
-    struct vmouse_device *dev = (struct vmouse_device *)data;
-    unsigned char byte;
-    
-    while (buffer_pop(dev, &byte)) {
-        dev->packet[dev->packet_idx++] = byte;
-        
-        /* Wait until we have a complete 3-byte packet */
-        if (dev->packet_idx >= PACKET_SIZE) {
-            process_packet(dev);
-            dev->packet_idx = 0;  /* Reset for next packet */
-        }
-    }
+static bool vmouse_record_start(unsigned char status)
+{
+    return status & PS2_ALWAYS_ONE;
 }
 
 /*
- * Simulated IRQ Handler (Top Half)
- * In real driver, this would be called by hardware interrupt
- * Here, triggered by sysfs injection
+ * Load Generator Callback
+ * Without a pattern the generator produces small pseudo-random moves of
+ * the active protocol with no buttons held.
  */
-static void vmouse_simulate_irq(unsigned char byte)
+static void vmouse_gen_record(struct vinput_device *vdev, u64 seq,
+                              unsigned char *packet)
 {
-    /* Buffer the byte */
-    buffer_push(vmouse_dev, byte);
+    u32 h;
+    int dx, dy;
     
-    /* Schedule tasklet for bottom-half processing */
-    tasklet_schedule(&vmouse_dev->tasklet);
+    /* Moves of -8..7 counts on each axis */
+    h = hash_64(seq, 32);
+    dx = (int)(h & 0xF) - 8;
+    dy = (int)((h >> 4) & 0xF) - 8;
+    
+    memset(packet, 0, vmouse_packet_size);
+    packet[0] = PS2_ALWAYS_ONE;
+    if (vmouse_protocol == PROTO_HIRES) {
+        packet[1] = dx & 0xFF;
+        packet[2] = (dx >> 8) & 0xFF;
+        packet[3] = dy & 0xFF;
+        packet[4] = (dy >> 8) & 0xFF;
+        return;
+    }
+    
+    if (dx < 0)
+        packet[0] |= PS2_X_SIGN;
+    if (dy < 0)
+        packet[0] |= PS2_Y_SIGN;
+    packet[1] = dx & 0xFF;
+    packet[2] = dy & 0xFF;
 }
 
 /*
@@ -207,57 +611,71 @@ static ssize_t inject_packet_store(struct device *dev,
                                      struct device_attribute *attr,
                                      const char *buf, size_t count)
 {
-    unsigned long bytes[3];
-    int i, n;
-    const char *p = buf;
-    char *endp;
-    
-    /* Parse up to 3 space-separated hex values */
-    for (i = 0; i < 3; i++) {
-        /* Skip whitespace */
-        while (*p && (*p == ' ' || *p == '\t' || *p == '\n'))
-            p++;
-        
-        if (!*p)
-            break;
-        
-        bytes[i] = simple_strtoul(p, &endp, 0);
-        if (endp == p) {
-            pr_warn("%s: Invalid packet format\n", DRIVER_NAME);
-            return -EINVAL;
-        }
-        
-        if (bytes[i] > 0xFF) {
-            pr_warn("%s: Invalid byte value 0x%lx (must be 0-255)\n",
-                    DRIVER_NAME, bytes[i]);
-            return -EINVAL;
-        }
-        
-        p = endp;
-    }
-    
-    n = i;
-    
-    if (n != 3) {
-        pr_warn("%s: Expected 3 bytes, got %d\n", DRIVER_NAME, n);
-        return -EINVAL;
-    }
-    
-    pr_info("%s: Injecting packet: 0x%02lx 0x%02lx 0x%02lx\n",
-            DRIVER_NAME, bytes[0], bytes[1], bytes[2]);
+    return vinput_store_text(dev_get_drvdata(dev), buf, count, true);
+}
+
+static DEVICE_ATTR_WO(inject_packet);
+
+/*
+ * Bulk injection: echo "0x08 0x05 0x00 0x08 0x05 0x00" > inject_packets
+ * Any number of packets in one write (up to a page of text).
+ */
+static ssize_t inject_packets_store(struct device *dev,
+                                    struct device_attribute *attr,
+                                    const char *buf, size_t count)
+{
+    return vinput_store_text(dev_get_drvdata(dev), buf, count, false);
+}
+
+static DEVICE_ATTR_WO(inject_packets);
+
+/*
+ * Binary bulk injection: raw 3-byte packets back to back, e.g.
+ * printf '\x08\x05\x00\x08\x05\x00' > inject_packets_raw
+ * Up to a page per write; the length must be a multiple of the packet size.
+ */
+static ssize_t inject_packets_raw_store(struct device *dev,
+                                        struct device_attribute *attr,
+                                        const char *buf, size_t count)
+{
+    return vinput_store_raw(dev_get_drvdata(dev), buf, count);
+}
+
+static DEVICE_ATTR_WO(inject_packets_raw);
+
+/*
+ * Pointer state for health checks, without attaching an evdev reader
+ * buttons:  held buttons as VMOUSE_BTN_* bits (0x01 left, 0x02 right,
+ *           0x04 middle, 0x08 side, 0x10 extra)
+ * position: sum of the reported REL_X/REL_Y motion since load, "x y"
+ */
+static ssize_t buttons_show(struct device *dev,
+                            struct device_attribute *attr, char *buf)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
     
-    /* Inject the packet bytes */
-    for (i = 0; i < 3; i++) {
-        vmouse_simulate_irq((unsigned char)bytes[i]);
-    }
+    return sysfs_emit(buf, "0x%02x\n", READ_ONCE(vmouse->buttons));
+}
+
+static DEVICE_ATTR_RO(buttons);
+
+static ssize_t position_show(struct device *dev,
+                             struct device_attribute *attr, char *buf)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
     
-    return count;
+    return sysfs_emit(buf, "%d %d\n", READ_ONCE(vmouse->pos_x),
+                      READ_ONCE(vmouse->pos_y));
 }
 
-static DEVICE_ATTR_WO(inject_packet);
+static DEVICE_ATTR_RO(position);
 
 static struct attribute *vmouse_attrs[] = {
     &dev_attr_inject_packet.attr,
+    &dev_attr_inject_packets.attr,
+    &dev_attr_inject_packets_raw.attr,
+    &dev_attr_buttons.attr,
+    &dev_attr_position.attr,
     NULL,
 };
 
@@ -266,92 +684,401 @@ static const struct attribute_group vmouse_attr_group = {
 };
 
 /*
- * Module Initialization
+ * Filter profile in sysfs: accel/{profile,sensitivity,threshold,slope,
+ * max_gain,smoothing,curve}. Gains are Q8 (256 = 1.0). Every write
+ * publishes a new copy of the profile; the bottom half picks it up with
+ * the next packet.
  */
-static int __init vmouse_init(void)
+static struct vmouse_accel *vmouse_accel_begin(struct vmouse_device *dev)
+{
+    struct vmouse_accel *a;
+    
+    mutex_lock(&dev->accel_lock);
+    a = kmemdup(rcu_dereference_protected(dev->accel,
+                                          lockdep_is_held(&dev->accel_lock)),
+                sizeof(*a), GFP_KERNEL);
+    if (!a)
+        mutex_unlock(&dev->accel_lock);
+    return a;
+}
+
+static void vmouse_accel_commit(struct vmouse_device *dev,
+                                struct vmouse_accel *a)
+{
+    struct vmouse_accel *old;
+    
+    old = rcu_dereference_protected(dev->accel,
+                                    lockdep_is_held(&dev->accel_lock));
+    rcu_assign_pointer(dev->accel, a);
+    mutex_unlock(&dev->accel_lock);
+    kfree_rcu(old, rcu);
+}
+
+static ssize_t vmouse_accel_show_uint(struct device *dev, size_t offset,
+                                      char *buf)
 {
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    unsigned int val;
+    
+    rcu_read_lock();
+    val = *(const unsigned int *)((const char *)rcu_dereference(vmouse->accel) +
+                                  offset);
+    rcu_read_unlock();
+    
+    return sysfs_emit(buf, "%u\n", val);
+}
+
+static ssize_t vmouse_accel_store_uint(struct device *dev, size_t offset,
+                                       unsigned int max, const char *buf,
+                                       size_t count)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    struct vmouse_accel *a;
+    unsigned int val;
     int ret;
     
-    pr_info("%s: Initializing virtual mouse driver\n", DRIVER_NAME);
+    ret = kstrtouint(buf, 0, &val);
+    if (ret)
+        return ret;
+    if (val > max)
+        return -EINVAL;
     
-    /* Allocate driver data structure */
-    vmouse_dev = kzalloc(sizeof(struct vmouse_device), GFP_KERNEL);
-    if (!vmouse_dev)
+    a = vmouse_accel_begin(vmouse);
+    if (!a)
         return -ENOMEM;
+    *(unsigned int *)((char *)a + offset) = val;
+    vmouse_accel_commit(vmouse, a);
     
-    /* Initialize buffer and lock */
-    spin_lock_init(&vmouse_dev->buffer_lock);
-    vmouse_dev->head = 0;
-    vmouse_dev->tail = 0;
-    vmouse_dev->packet_idx = 0;
-    
-    /* Initialize tasklet for bottom-half processing */
-    tasklet_init(&vmouse_dev->tasklet, vmouse_tasklet_handler,
-                 (unsigned long)vmouse_dev);
-    
-    /* Allocate input device */
-    vmouse_dev->input = input_allocate_device();
-    if (!vmouse_dev->input) {
-        pr_err("%s: Failed to allocate input device\n", DRIVER_NAME);
-        ret = -ENOMEM;
-        goto err_free_dev;
+    return count;
+}
+
+#define ACCEL_UINT_ATTR(field, max)                                          \
+static ssize_t accel_##field##_show(struct device *dev,                      \
+                                    struct device_attribute *attr, char *buf) \
+{                                                                            \
+    return vmouse_accel_show_uint(dev, offsetof(struct vmouse_accel, field),  \
+                                  buf);                                      \
+}                                                                            \
+static ssize_t accel_##field##_store(struct device *dev,                     \
+                                     struct device_attribute *attr,          \
+                                     const char *buf, size_t count)          \
+{                                                                            \
+    return vmouse_accel_store_uint(dev, offsetof(struct vmouse_accel, field), \
+                                   max, buf, count);                         \
+}                                                                            \
+static struct device_attribute dev_attr_accel_##field =                      \
+    __ATTR(field, 0644, accel_##field##_show, accel_##field##_store)
+
+ACCEL_UINT_ATTR(sensitivity, ACCEL_GAIN_MAX);
+ACCEL_UINT_ATTR(threshold, ACCEL_SPEED_MAX);
+ACCEL_UINT_ATTR(slope, ACCEL_GAIN_MAX);
+ACCEL_UINT_ATTR(max_gain, ACCEL_GAIN_MAX);
+ACCEL_UINT_ATTR(smoothing, ACCEL_ONE - 1);
+
+static ssize_t accel_profile_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    int profile;
+    
+    rcu_read_lock();
+    profile = rcu_dereference(vmouse->accel)->profile;
+    rcu_read_unlock();
+    
+    return sysfs_emit(buf, "%s\n", accel_profile_names[profile]);
+}
+
+static ssize_t accel_profile_store(struct device *dev,
+                                   struct device_attribute *attr,
+                                   const char *buf, size_t count)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    struct vmouse_accel *a;
+    int profile;
+    
+    profile = sysfs_match_string(accel_profile_names, buf);
+    if (profile < 0)
+        return profile;
+    
+    a = vmouse_accel_begin(vmouse);
+    if (!a)
+        return -ENOMEM;
+    a->profile = profile;
+    vmouse_accel_commit(vmouse, a);
+    
+    return count;
+}
+
+static ssize_t accel_curve_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    const struct vmouse_accel *a;
+    unsigned int i;
+    int len = 0;
+    
+    rcu_read_lock();
+    a = rcu_dereference(vmouse->accel);
+    for (i = 0; i < a->curve_len; i++)
+        len += sysfs_emit_at(buf, len, "%s%u", i ? " " : "", a->curve[i]);
+    rcu_read_unlock();
+    
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+
+/*
+ * Up to ACCEL_CURVE_MAX Q8 gains, one per ACCEL_CURVE_STEP counts/packet
+ * starting at 0: echo "256 256 320 448 640" > accel/curve
+ */
+static ssize_t accel_curve_store(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    struct vmouse_device *vmouse = to_vmouse(dev_get_drvdata(dev));
+    unsigned int curve[ACCEL_CURVE_MAX];
+    struct vmouse_accel *a;
+    char *copy, *p, *tok;
+    unsigned int n = 0;
+    int ret = 0;
+    
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+    
+    p = copy;
+    while ((tok = strsep(&p, " \t\n")) != NULL) {
+        if (!*tok)
+            continue;
+        if (n == ACCEL_CURVE_MAX) {
+            ret = -E2BIG;
+            break;
+        }
+        ret = kstrtouint(tok, 0, &curve[n]);
+        if (!ret && curve[n] > ACCEL_GAIN_MAX)
+            ret = -EINVAL;
+        if (ret)
+            break;
+        n++;
     }
+    kfree(copy);
+    if (ret)
+        return ret;
+    
+    a = vmouse_accel_begin(vmouse);
+    if (!a)
+        return -ENOMEM;
+    memcpy(a->curve, curve, n * sizeof(curve[0]));
+    a->curve_len = n;
+    vmouse_accel_commit(vmouse, a);
+    
+    return count;
+}
+
+static struct device_attribute dev_attr_accel_profile =
+    __ATTR(profile, 0644, accel_profile_show, accel_profile_store);
+static struct device_attribute dev_attr_accel_curve =
+    __ATTR(curve, 0644, accel_curve_show, accel_curve_store);
+
+static struct attribute *vmouse_accel_attrs[] = {
+    &dev_attr_accel_profile.attr,
+    &dev_attr_accel_sensitivity.attr,
+    &dev_attr_accel_threshold.attr,
+    &dev_attr_accel_slope.attr,
+    &dev_attr_accel_max_gain.attr,
+    &dev_attr_accel_smoothing.attr,
+    &dev_attr_accel_curve.attr,
+    NULL,
+};
+
+static const struct attribute_group vmouse_accel_group = {
+    .name  = "accel",
+    .attrs = vmouse_accel_attrs,
+};
+
+static const struct attribute_group *vmouse_groups[] = {
+    &vmouse_attr_group,
+    &vmouse_accel_group,
+    NULL,
+};
+
+static const struct vinput_ops vmouse_ops = {
+    .process      = vmouse_process,
+    .flush        = vmouse_flush,
+    .record_start = vmouse_record_start,
+    .gen_record   = vmouse_gen_record,
+};
+
+/* record_size follows the protocol parameter, see vmouse_init() */
+static struct vinput_class vmouse_class = {
+    .name        = DRIVER_NAME,
+    .short_name  = "vmouse",
+    .unit        = "packets",
+    .stat_unit   = "packets",
+    .ops         = &vmouse_ops,
+    .groups      = vmouse_groups,
+};
+
+/* The bottom half and sysfs are gone, nobody else can see the profile */
+static void vmouse_free(struct vmouse_device *dev)
+{
+    kfree(rcu_dereference_protected(dev->accel, true));
+    mutex_destroy(&dev->accel_lock);
+    kfree(dev);
+}
+
+/*
+ * Instance Creation
+ * vinput_core sets up the ring, bottom half and input device; the driver
+ * adds the buttons and axes of the active protocol before registration.
+ * The KUnit suites use the unregistered instance of vmouse_alloc().
+ */
+static struct vmouse_device *vmouse_alloc(unsigned int id)
+{
+    struct vmouse_device *dev;
+    struct input_dev *input;
+    int ret;
+    
+    /* Allocate driver data structure and the pass-through filter profile */
+    dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    
+    RCU_INIT_POINTER(dev->accel, kmemdup(&accel_defaults,
+                                         sizeof(accel_defaults), GFP_KERNEL));
+    if (!rcu_access_pointer(dev->accel)) {
+        kfree(dev);
+        return ERR_PTR(-ENOMEM);
+    }
+    mutex_init(&dev->accel_lock);
+    
+    ret = vinput_init(&dev->core, &vmouse_class, id);
+    if (ret)
+        goto err_free;
+    input = dev->core.input;
     
     /* Setup input device properties */
-    vmouse_dev->input->name = "Virtual PS/2 Mouse";
-    vmouse_dev->input->phys = "virtual/input1";
-    vmouse_dev->input->id.bustype = BUS_HOST;
-    vmouse_dev->input->id.vendor = 0x0001;
-    vmouse_dev->input->id.product = 0x0002;
-    vmouse_dev->input->id.version = 0x0100;
+    input->name = "Virtual PS/2 Mouse";
+    input->id.vendor = 0x0001;
+    input->id.product = 0x0002;
+    input->id.version = 0x0100;
     
     /* Set event types: relative positioning and buttons */
-    vmouse_dev->input->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REL);
+    input->evbit[0] = BIT_MASK(EV_KEY) | BIT_MASK(EV_REL);
     
     /* Set which buttons we support */
-    set_bit(BTN_LEFT, vmouse_dev->input->keybit);
-    set_bit(BTN_RIGHT, vmouse_dev->input->keybit);
-    set_bit(BTN_MIDDLE, vmouse_dev->input->keybit);
+    set_bit(BTN_LEFT, input->keybit);
+    set_bit(BTN_RIGHT, input->keybit);
+    set_bit(BTN_MIDDLE, input->keybit);
+    if (vmouse_protocol >= PROTO_EXPS) {
+        set_bit(BTN_SIDE, input->keybit);
+        set_bit(BTN_EXTRA, input->keybit);
+    }
     
     /* Set relative axes */
-    set_bit(REL_X, vmouse_dev->input->relbit);
-    set_bit(REL_Y, vmouse_dev->input->relbit);
+    set_bit(REL_X, input->relbit);
+    set_bit(REL_Y, input->relbit);
+    if (vmouse_protocol != PROTO_PS2) {
+        set_bit(REL_WHEEL, input->relbit);
+        set_bit(REL_WHEEL_HI_RES, input->relbit);
+    }
+    
+    return dev;
+
+err_free:
+    vmouse_free(dev);
+    return ERR_PTR(ret);
+}
+
+static void vmouse_destroy(struct vmouse_device *dev)
+{
+    vinput_destroy(&dev->core);
+    vmouse_free(dev);
+}
+
+static struct vmouse_device *vmouse_create(unsigned int id)
+{
+    struct vmouse_device *dev;
+    int ret;
     
-    /* Register input device with the input subsystem */
-    ret = input_register_device(vmouse_dev->input);
+    dev = vmouse_alloc(id);
+    if (IS_ERR(dev))
+        return dev;
+    
+    /* Register input device, sysfs, injection device and statistics */
+    ret = vinput_register(&dev->core, THIS_MODULE);
     if (ret) {
-        pr_err("%s: Failed to register input device\n", DRIVER_NAME);
-        goto err_free_input;
+        vmouse_destroy(dev);
+        return ERR_PTR(ret);
     }
     
-    /* Create sysfs interface for packet injection */
-    ret = sysfs_create_group(&vmouse_dev->input->dev.kobj, &vmouse_attr_group);
-    if (ret) {
-        pr_err("%s: Failed to create sysfs group\n", DRIVER_NAME);
-        goto err_unregister_input;
+    return dev;
+}
+
+static void vmouse_destroy_all(void)
+{
+    while (vmouse_count)
+        vmouse_destroy(vmouse_devs[--vmouse_count]);
+}
+
+/*
+ * Module Initialization
+ */
+static int __init vmouse_init(void)
+{
+    const struct vinput_params params = {
+        .ring_size = ring_size,
+        .overflow  = overflow,
+        .bh_mode   = bh_mode,
+        .bh_budget = &bh_budget,
+        .bh_cpu    = bh_cpu,
+        .bh_spread = bh_spread,
+    };
+    struct vmouse_device *dev;
+    int ret, proto;
+    
+    pr_info("%s: Initializing virtual mouse driver\n", DRIVER_NAME);
+    
+    if (!num_devices || num_devices > VINPUT_MAX_DEVICES) {
+        pr_err("%s: num_devices must be 1-%d\n", DRIVER_NAME,
+               VINPUT_MAX_DEVICES);
+        return -EINVAL;
     }
     
-    pr_info("%s: Successfully registered as %s\n", DRIVER_NAME,
-            dev_name(&vmouse_dev->input->dev));
-    pr_info("%s: Inject packets via: /sys/devices/virtual/input/%s/inject_packet\n",
-            DRIVER_NAME, dev_name(&vmouse_dev->input->dev));
-    pr_info("%s: Packet format: 'status_byte dx dy' (3 bytes, space-separated hex)\n",
-            DRIVER_NAME);
+    proto = sysfs_match_string(protocol_names, protocol);
+    if (proto < 0) {
+        pr_err("%s: Unknown protocol '%s'\n", DRIVER_NAME, protocol);
+        return -EINVAL;
+    }
+    vmouse_protocol = proto;
+    vmouse_packet_size = protocol_sizes[proto];
+    vmouse_class.record_size = vmouse_packet_size;
+    
+    pr_info("%s: Protocol %s (%u-byte packets)\n", DRIVER_NAME,
+            protocol_names[proto], vmouse_packet_size);
+    
+    ret = vinput_setup(&vmouse_class, &params);
+    if (ret)
+        return ret;
+    
+    while (vmouse_count < num_devices) {
+        dev = vmouse_create(vmouse_count);
+        if (IS_ERR(dev)) {
+            vmouse_destroy_all();
+            return PTR_ERR(dev);
+        }
+        vmouse_devs[vmouse_count++] = dev;
+    }
+    
+    pr_info("%s: Packet format: %u space-separated hex bytes, status byte first\n",
+            DRIVER_NAME, vmouse_packet_size);
+    if (num_devices > 1)
+        pr_info("%s: Created %u instances\n", DRIVER_NAME, num_devices);
     
     return 0;
-
-err_unregister_input:
-    input_unregister_device(vmouse_dev->input);
-    vmouse_dev->input = NULL;  /* input_unregister_device frees it */
-err_free_input:
-    if (vmouse_dev->input)
-        input_free_device(vmouse_dev->input);
-err_free_dev:
-    tasklet_kill(&vmouse_dev->tasklet);
-    kfree(vmouse_dev);
-    return ret;
 }
 
+
 /*
  * Module Cleanup
  */
@@ -359,17 +1086,7 @@ static void __exit vmouse_exit(void)
 {
     pr_info("%s: Cleaning up virtual mouse driver\n", DRIVER_NAME);
     
-    /* Remove sysfs interface */
-    sysfs_remove_group(&vmouse_dev->input->dev.kobj, &vmouse_attr_group);
-    
-    /* Kill tasklet */
-    tasklet_kill(&vmouse_dev->tasklet);
-    
-    /* Unregister input device */
-    input_unregister_device(vmouse_dev->input);
-    
-    /* Free driver data */
-    kfree(vmouse_dev);
+    vmouse_destroy_all();
     
     pr_info("%s: Driver unloaded\n", DRIVER_NAME);
 }
@@ -377,6 +1094,10 @@ static void __exit vmouse_exit(void)
 module_init(vmouse_init);
 module_exit(vmouse_exit);
 
+#if IS_ENABLED(CONFIG_VINPUT_KUNIT_TEST)
+#include "mouse_test.c"
+#endif
+
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("OS Course Project");
 MODULE_DESCRIPTION("Virtual PS/2 Mouse Driver for Educational Purposes");
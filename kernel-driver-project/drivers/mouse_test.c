@@ -0,0 +1,431 @@
+/*
+ * mouse_test.c - KUnit suites for packet decoding and validation
+ *
+ * Included at the end of mouse_driver.c when CONFIG_VINPUT_KUNIT_TEST is
+ * set. The decoder follows the global protocol, so cases switch
+ * vmouse_protocol and the suite exit puts it back along with the
+ * coalescing parameters. Cases get an instance from vmouse_alloc() whose
+ * input device is registered with the input core only, and hand packets
+ * straight to the decoder callbacks.
+ *
+ * vmouse_bench times vmouse_decode() for every protocol and the whole
+ * process_packet() path, and reports ns/packet with kunit_info().
+ *
+ * License: MIT
+ */
+
+#include <kunit/test.h>
+
+#define BENCH_PACKETS (4U << 20)
+
+/* Parameters the cases change, restored by vmouse_test_exit() */
+static int vmouse_test_protocol;
+static bool vmouse_test_coalesce_motion;
+static unsigned int vmouse_test_coalesce_max;
+
+static int vmouse_test_init(struct kunit *test)
+{
+    const struct vinput_params params = {
+        .ring_size = ring_size,
+        .overflow  = overflow,
+        .bh_mode   = bh_mode,
+        .bh_budget = &bh_budget,
+        .bh_cpu    = -1,
+    };
+    struct vmouse_device *dev;
+    int ret;
+    
+    /* Resolved by vmouse_init(), unless the suite runs first */
+    if (!vmouse_class.ring_size) {
+        vmouse_class.record_size = vmouse_packet_size;
+        ret = vinput_setup(&vmouse_class, &params);
+        if (ret)
+            return ret;
+    }
+    
+    dev = vmouse_alloc(0);
+    if (IS_ERR(dev))
+        return PTR_ERR(dev);
+    
+    /* Input events need a registered device */
+    ret = input_register_device(dev->core.input);
+    if (ret) {
+        vmouse_destroy(dev);
+        return ret;
+    }
+    
+    vmouse_test_protocol = vmouse_protocol;
+    vmouse_test_coalesce_motion = coalesce_motion;
+    vmouse_test_coalesce_max = coalesce_max;
+    test->priv = dev;
+    return 0;
+}
+
+static void vmouse_test_exit(struct kunit *test)
+{
+    struct vmouse_device *dev = test->priv;
+    
+    vmouse_protocol = vmouse_test_protocol;
+    coalesce_motion = vmouse_test_coalesce_motion;
+    coalesce_max = vmouse_test_coalesce_max;
+    input_unregister_device(dev->core.input);
+    dev->core.input = NULL;  /* input_unregister_device frees it */
+    vmouse_destroy(dev);
+}
+
+/* Decode packets (VINPUT_RECORD_MAX bytes each) as one bottom-half run */
+static void vmouse_test_feed(struct vmouse_device *dev,
+                             const unsigned char (*packets)[VINPUT_RECORD_MAX],
+                             unsigned int count)
+{
+    struct vinput_entry entries[8];
+    unsigned int i;
+    
+    for (i = 0; i < count && i < ARRAY_SIZE(entries); i++) {
+        entries[i].enqueue_ns = ktime_get_ns();
+        memcpy(entries[i].data, packets[i], VINPUT_RECORD_MAX);
+    }
+    vmouse_process(&dev->core, entries, i);
+    vmouse_flush(&dev->core);
+}
+
+static void vmouse_test_expect_sample(struct kunit *test,
+                                      const unsigned char *packet,
+                                      unsigned int buttons, int dx, int dy,
+                                      int wheel)
+{
+    struct vmouse_sample s;
+    
+    vmouse_decode(packet, &s);
+    KUNIT_EXPECT_EQ(test, s.buttons, buttons);
+    KUNIT_EXPECT_EQ(test, s.dx, dx);
+    KUNIT_EXPECT_EQ(test, s.dy, dy);
+    KUNIT_EXPECT_EQ(test, s.wheel, wheel);
+}
+
+/*
+ * Decoding
+ * PS/2 Y and wheel are inverted: Y up and wheel down are positive.
+ */
+static void vmouse_test_decode_ps2(struct kunit *test)
+{
+    static const unsigned char left[] = { 0x09, 0x05, 0xFB };
+    static const unsigned char neg[] = { 0x3E, 0x80, 0x7F };
+    
+    vmouse_protocol = PROTO_PS2;
+    vmouse_test_expect_sample(test, left, VMOUSE_BTN_LEFT, 5, 5, 0);
+    vmouse_test_expect_sample(test, neg, VMOUSE_BTN_RIGHT | VMOUSE_BTN_MIDDLE,
+                              -128, -127, 0);
+}
+
+static void vmouse_test_decode_imps(struct kunit *test)
+{
+    static const unsigned char down[] = { 0x08, 0x00, 0x00, 0x01 };
+    static const unsigned char up[] = { 0x08, 0x00, 0x00, 0xFF };
+    
+    vmouse_protocol = PROTO_IMPS;
+    vmouse_test_expect_sample(test, down, 0, 0, 0, -WHEEL_DETENT);
+    vmouse_test_expect_sample(test, up, 0, 0, 0, WHEEL_DETENT);
+}
+
+static void vmouse_test_decode_exps(struct kunit *test)
+{
+    static const unsigned char side[] = { 0x08, 0x01, 0x00, 0x1F };
+    static const unsigned char extra[] = { 0x08, 0x00, 0x01, 0x21 };
+    static const unsigned char far[] = { 0x08, 0x00, 0x00, 0x08 };
+    
+    /* Byte 3: buttons 4 and 5 above a 4-bit signed wheel */
+    vmouse_protocol = PROTO_EXPS;
+    vmouse_test_expect_sample(test, side, VMOUSE_BTN_SIDE, 1, 0, WHEEL_DETENT);
+    vmouse_test_expect_sample(test, extra, VMOUSE_BTN_EXTRA, 0, -1,
+                              -WHEEL_DETENT);
+    vmouse_test_expect_sample(test, far, 0, 0, 0, 8 * WHEEL_DETENT);
+}
+
+static void vmouse_test_decode_hires(struct kunit *test)
+{
+    static const unsigned char big[] = { 0x19, 0x00, 0x01, 0x00, 0xFF, 0x3C, 0x00 };
+    static const unsigned char min[] = { 0x28, 0x00, 0x80, 0xFF, 0x7F, 0x88, 0xFF };
+    
+    /* 16-bit little-endian deltas, buttons 4 and 5 in the status byte */
+    vmouse_protocol = PROTO_HIRES;
+    vmouse_test_expect_sample(test, big, VMOUSE_BTN_LEFT | VMOUSE_BTN_SIDE,
+                              256, 256, -60);
+    vmouse_test_expect_sample(test, min, VMOUSE_BTN_EXTRA, -32768, -32767, 120);
+}
+
+/*
+ * Validation
+ * Bit 3 of the status byte is the only framing information PS/2 has.
+ */
+static void vmouse_test_record_start(struct kunit *test)
+{
+    KUNIT_EXPECT_TRUE(test, vmouse_record_start(0x08));
+    KUNIT_EXPECT_TRUE(test, vmouse_record_start(0xFF));
+    KUNIT_EXPECT_FALSE(test, vmouse_record_start(0x00));
+    KUNIT_EXPECT_FALSE(test, vmouse_record_start(0xF7));
+}
+
+/*
+ * Packet Processing
+ */
+static void vmouse_test_process(struct kunit *test)
+{
+    static const unsigned char packets[][VINPUT_RECORD_MAX] = {
+        { 0x09, 0x0A, 0x00 },         /* Left down, 10 right */
+        { 0x08, 0x00, 0x00 },         /* Left up */
+        { 0x08, 0x00, 0x00 },         /* Nothing changed */
+        { 0x28, 0x00, 0xFB },         /* 5 down: PS/2 -5 */
+    };
+    struct vmouse_device *dev = test->priv;
+    
+    vmouse_protocol = PROTO_PS2;
+    coalesce_motion = false;
+    vmouse_test_feed(dev, packets, ARRAY_SIZE(packets));
+    
+    KUNIT_EXPECT_EQ(test, dev->pos_x, 10);
+    KUNIT_EXPECT_EQ(test, dev->pos_y, 5);
+    KUNIT_EXPECT_EQ(test, dev->buttons, 0);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 3);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.redundant, 1);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 3);
+}
+
+static void vmouse_test_wheel_detents(struct kunit *test)
+{
+    static const unsigned char packets[][VINPUT_RECORD_MAX] = {
+        { 0x08, 0x00, 0x00, 0x00, 0x00, 0xC4, 0xFF },  /* Half a detent up */
+        { 0x08, 0x00, 0x00, 0x00, 0x00, 0xC4, 0xFF },
+        { 0x08, 0x00, 0x00, 0x00, 0x00, 0x1E, 0x00 },  /* A quarter down */
+    };
+    struct vmouse_device *dev = test->priv;
+    
+    /* Hi-res remainders add up to whole REL_WHEEL detents */
+    vmouse_protocol = PROTO_HIRES;
+    vmouse_test_feed(dev, packets, 2);
+    KUNIT_EXPECT_EQ(test, dev->wheel_rem, 0);
+    vmouse_test_feed(dev, &packets[2], 1);
+    KUNIT_EXPECT_EQ(test, dev->wheel_rem, -30);
+}
+
+static void vmouse_test_coalesce(struct kunit *test)
+{
+    static const unsigned char packets[][VINPUT_RECORD_MAX] = {
+        { 0x08, 0x01, 0x00 },
+        { 0x08, 0x02, 0x00 },
+        { 0x08, 0x03, 0x00 },
+        { 0x09, 0x00, 0x01 },         /* Button change closes the frame */
+        { 0x09, 0x00, 0x02 },
+    };
+    struct vmouse_device *dev = test->priv;
+    
+    vmouse_protocol = PROTO_PS2;
+    coalesce_motion = true;
+    coalesce_max = 0;
+    vmouse_test_feed(dev, packets, ARRAY_SIZE(packets));
+    
+    KUNIT_EXPECT_EQ(test, dev->pos_x, 6);
+    KUNIT_EXPECT_EQ(test, dev->pos_y, -3);
+    KUNIT_EXPECT_EQ(test, dev->buttons, VMOUSE_BTN_LEFT);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 2);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 5);
+    KUNIT_EXPECT_EQ(test, dev->acc_packets, 0);
+    
+    /* coalesce_max splits a run into frames of at most that many packets */
+    coalesce_max = 2;
+    vmouse_test_feed(dev, packets, 3);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 4);
+    KUNIT_EXPECT_EQ(test, dev->pos_x, 12);
+}
+
+static void vmouse_test_coalesce_overflow(struct kunit *test)
+{
+    static const unsigned char packets[][VINPUT_RECORD_MAX] = {
+        { 0x08, 0x00, 0x00, 0x00, 0x00, 0xEC, 0xFF },  /* Wheel 20 up */
+    };
+    struct vmouse_device *dev = test->priv;
+    
+    vmouse_protocol = PROTO_HIRES;
+    coalesce_motion = true;
+    coalesce_max = 0;
+    
+    /* An open frame whose wheel sum cannot take the next packet */
+    dev->acc.wheel = INT_MAX - 10;
+    dev->acc_ns = ktime_get_ns();
+    dev->acc_last_ns = dev->acc_ns;
+    dev->acc_packets = 1;
+    vmouse_test_feed(dev, packets, ARRAY_SIZE(packets));
+    
+    KUNIT_EXPECT_EQ(test, dev->core.stats.frames, 2);
+    KUNIT_EXPECT_EQ(test, dev->core.stats.events_reported, 2);
+    KUNIT_EXPECT_EQ(test, dev->wheel_rem,
+                    ((INT_MAX - 10) % WHEEL_DETENT + 20) % WHEEL_DETENT);
+}
+
+/*
+ * Acceleration
+ */
+static void vmouse_test_accel_passthrough(struct kunit *test)
+{
+    struct vmouse_device *dev = test->priv;
+    struct vmouse_sample s = { .dx = 100, .dy = -3 };
+    
+    /* The default profile leaves every delta as decoded */
+    vmouse_accel_apply(dev, &s);
+    KUNIT_EXPECT_EQ(test, s.dx, 100);
+    KUNIT_EXPECT_EQ(test, s.dy, -3);
+}
+
+static void vmouse_test_accel_gain(struct kunit *test)
+{
+    struct vmouse_accel a = accel_defaults;
+    
+    KUNIT_EXPECT_EQ(test, vmouse_speed(3, -4), 5 * ACCEL_ONE);
+    KUNIT_EXPECT_EQ(test, vmouse_speed(10000, 0), ACCEL_SPEED_MAX * ACCEL_ONE);
+    
+    /* linear: 1.0 up to 4 counts, then 1/8 more per count, capped at 4.0 */
+    a.profile = ACCEL_LINEAR;
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, 4 * ACCEL_ONE), ACCEL_ONE);
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, 12 * ACCEL_ONE), 2 * ACCEL_ONE);
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, 1000 * ACCEL_ONE), 4 * ACCEL_ONE);
+    
+    /* curve: interpolated between points ACCEL_CURVE_STEP counts apart */
+    a.profile = ACCEL_CURVE;
+    a.curve_len = 2;
+    a.curve[0] = ACCEL_ONE;
+    a.curve[1] = 2 * ACCEL_ONE;
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, ACCEL_CURVE_STEP / 2 * ACCEL_ONE),
+                    ACCEL_ONE + ACCEL_ONE / 2);
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, 100 * ACCEL_ONE), 2 * ACCEL_ONE);
+    
+    /* sensitivity applies on top of every profile */
+    a.sensitivity = ACCEL_ONE / 2;
+    KUNIT_EXPECT_EQ(test, vmouse_accel_gain(&a, 100 * ACCEL_ONE), ACCEL_ONE);
+}
+
+static void vmouse_test_accel_remainder(struct kunit *test)
+{
+    int rem = 0, sum = 0, i;
+    
+    /* 1.5 * 1 count: alternately 1 and 2, nothing lost */
+    for (i = 0; i < 4; i++)
+        sum += vmouse_accel_scale(1, ACCEL_ONE + ACCEL_ONE / 2, &rem);
+    KUNIT_EXPECT_EQ(test, sum, 6);
+    KUNIT_EXPECT_EQ(test, rem, 0);
+    
+    /* 0.5 * -1 count: rounds toward zero, the remainder carries the rest */
+    KUNIT_EXPECT_EQ(test, vmouse_accel_scale(-1, ACCEL_ONE / 2, &rem), 0);
+    KUNIT_EXPECT_EQ(test, rem, -ACCEL_ONE / 2);
+    KUNIT_EXPECT_EQ(test, vmouse_accel_scale(-1, ACCEL_ONE / 2, &rem), -1);
+    KUNIT_EXPECT_EQ(test, rem, 0);
+}
+
+static struct kunit_case vmouse_test_cases[] = {
+    KUNIT_CASE(vmouse_test_decode_ps2),
+    KUNIT_CASE(vmouse_test_decode_imps),
+    KUNIT_CASE(vmouse_test_decode_exps),
+    KUNIT_CASE(vmouse_test_decode_hires),
+    KUNIT_CASE(vmouse_test_record_start),
+    KUNIT_CASE(vmouse_test_process),
+    KUNIT_CASE(vmouse_test_wheel_detents),
+    KUNIT_CASE(vmouse_test_coalesce),
+    KUNIT_CASE(vmouse_test_coalesce_overflow),
+    KUNIT_CASE(vmouse_test_accel_passthrough),
+    KUNIT_CASE(vmouse_test_accel_gain),
+    KUNIT_CASE(vmouse_test_accel_remainder),
+    {}
+};
+
+static struct kunit_suite vmouse_test_suite = {
+    .name       = "vmouse",
+    .init       = vmouse_test_init,
+    .exit       = vmouse_test_exit,
+    .test_cases = vmouse_test_cases,
+};
+
+/*
+ * Microbenchmarks
+ * Packets come from the generator: pseudo-random moves of either sign
+ * in the layout of the protocol being timed.
+ */
+#define BENCH_SPAN 32  /* DRAIN_CHUNK of vinput_core.c */
+
+static void vmouse_bench_fill(struct vmouse_device *dev,
+                              struct vinput_entry *entries, unsigned int count)
+{
+    unsigned int i;
+    
+    for (i = 0; i < count; i++) {
+        entries[i].enqueue_ns = ktime_get_ns();
+        memset(entries[i].data, 0, VINPUT_RECORD_MAX);
+        vmouse_gen_record(&dev->core, i, entries[i].data);
+    }
+}
+
+static void vmouse_bench_decode(struct kunit *test)
+{
+    struct vmouse_device *dev = test->priv;
+    struct vinput_entry entries[BENCH_SPAN];
+    struct vmouse_sample s;
+    unsigned int done, i;
+    u64 start, ns;
+    long sum;
+    int proto;
+    
+    for (proto = PROTO_PS2; proto <= PROTO_HIRES; proto++) {
+        vmouse_protocol = proto;
+        vmouse_bench_fill(dev, entries, BENCH_SPAN);
+        sum = 0;
+    
+        start = ktime_get_ns();
+        for (done = 0; done < BENCH_PACKETS; done += BENCH_SPAN) {
+            for (i = 0; i < BENCH_SPAN; i++) {
+                vmouse_decode(entries[i].data, &s);
+                sum += s.dx + s.dy + s.wheel + s.buttons;
+            }
+        }
+        ns = ktime_get_ns() - start;
+        cond_resched();
+    
+        kunit_info(test, "%s: %u packets: %llu ns/packet (checksum %ld)\n",
+                   protocol_names[proto], done, div_u64(ns, done), sum);
+    }
+}
+
+static void vmouse_bench_process(struct kunit *test)
+{
+    struct vmouse_device *dev = test->priv;
+    struct vinput_entry entries[BENCH_SPAN];
+    unsigned int done;
+    u64 start, ns;
+    
+    vmouse_protocol = vmouse_test_protocol;
+    vmouse_bench_fill(dev, entries, BENCH_SPAN);
+    
+    start = ktime_get_ns();
+    for (done = 0; done < BENCH_PACKETS / 4; done += BENCH_SPAN) {
+        vmouse_process(&dev->core, entries, BENCH_SPAN);
+        vmouse_flush(&dev->core);
+        cond_resched();
+    }
+    ns = ktime_get_ns() - start;
+    
+    kunit_info(test, "%s, coalesce_motion %d: %u packets, %llu frames: %llu ns/packet\n",
+               protocol_names[vmouse_protocol], coalesce_motion, done,
+               dev->core.stats.frames, div_u64(ns, done));
+}
+
+static struct kunit_case vmouse_bench_cases[] = {
+    KUNIT_CASE(vmouse_bench_decode),
+    KUNIT_CASE(vmouse_bench_process),
+    {}
+};
+
+static struct kunit_suite vmouse_bench_suite = {
+    .name       = "vmouse_bench",
+    .init       = vmouse_test_init,
+    .exit       = vmouse_test_exit,
+    .test_cases = vmouse_bench_cases,
+};
+
+kunit_test_suites(&vmouse_test_suite, &vmouse_bench_suite);
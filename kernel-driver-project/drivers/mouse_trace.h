@@ -0,0 +1,77 @@
+/*
+ * mouse_trace.h - Tracepoints for the virtual mouse driver
+ *
+ * Decode and frame report events, tagged with the instance name, cost
+ * nothing when tracing is off; injection, ring and validation are
+ * handled by vinput_core (vinput:*).
+ * Capture them with ftrace or perf:
+ *
+ *   echo 1 > /sys/kernel/tracing/events/vmouse/enable
+ *   perf record -e 'vmouse:*' -a
+ *
+ * License: MIT
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vmouse
+
+#if !defined(_MOUSE_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _MOUSE_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "vinput_core.h"
+
+/* Longest packet of any protocol (hires) */
+#define VMOUSE_TRACE_PACKET_MAX 7
+
+TRACE_EVENT(vmouse_decode,
+    TP_PROTO(const struct vinput_device *vdev, const unsigned char *packet,
+             unsigned int len),
+    TP_ARGS(vdev, packet, len),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __array(unsigned char, packet, VMOUSE_TRACE_PACKET_MAX)
+        __field(unsigned int, len)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->len = min_t(unsigned int, len, VMOUSE_TRACE_PACKET_MAX);
+        memcpy(__entry->packet, packet, __entry->len);
+    ),
+    TP_printk("%s packet=%s", __entry->dev,
+              __print_hex(__entry->packet, __entry->len))
+);
+
+TRACE_EVENT(vmouse_report,
+    TP_PROTO(const struct vinput_device *vdev, unsigned int buttons, int dx,
+             int dy, int wheel_hi_res, u64 latency_ns),
+    TP_ARGS(vdev, buttons, dx, dy, wheel_hi_res, latency_ns),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(unsigned int, buttons)
+        __field(int, dx)
+        __field(int, dy)
+        __field(int, wheel_hi_res)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->buttons = buttons;
+        __entry->dx = dx;
+        __entry->dy = dy;
+        __entry->wheel_hi_res = wheel_hi_res;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("%s buttons=0x%x dx=%d dy=%d wheel_hi_res=%d latency_ns=%llu",
+              __entry->dev, __entry->buttons, __entry->dx, __entry->dy,
+              __entry->wheel_hi_res, __entry->latency_ns)
+);
+
+#endif /* _MOUSE_TRACE_H */
+
+/* Out-of-tree module: the header lives next to the source */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE mouse_trace
+#include <trace/define_trace.h>
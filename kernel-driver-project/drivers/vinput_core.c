@@ -0,0 +1,1920 @@
+/*
+ * vinput_core.c - Shared core of the virtual input drivers
+ *
+ * Educational Linux kernel module demonstrating:
+ * - A library module with an exported API and decoder callbacks
+ * - Lockless single-producer/single-consumer kfifo rings
+ * - Budgeted bottom halves (tasklet, workqueue or kthread)
+ * - Sysfs, character device and mmap'd shared-ring injection
+ * - hrtimer-driven synthetic load generation
+ * - Capture and timed replay of injected streams
+ * - Performance counters, latency histogram and tracepoints
+ *
+ * The keyboard and mouse drivers only decode records; see vinput_core.h
+ * for the interface.
+ *
+ * License: MIT
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/input.h>
+#include <linux/interrupt.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/device.h>
+#include <linux/sysfs.h>
+#include <linux/kfifo.h>
+#include <linux/miscdevice.h>
+#include <linux/fs.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/cpumask.h>
+#include <linux/version.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/ratelimit.h>
+#include <linux/wait.h>
+#include <linux/log2.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+#include "vinput_inject.h"
+#include "vinput_core.h"
+
+#define CREATE_TRACE_POINTS
+#include "vinput_trace.h"
+
+#define DRAIN_CHUNK 32   /* Entries copied out of the ring per kfifo_out */
+#define WRITE_CHUNK 256  /* Bytes copied from user space per step */
+#define FRAME_BATCH 32   /* Records framed per push from the raw byte path */
+#define SHM_DATA_OFFSET PAGE_SIZE
+#define SHM_MMAP_SIZE   (SHM_DATA_OFFSET + VINPUT_RING_DATA_SIZE)
+
+#define BH_PENDING 0     /* bh_flags bit: kthread has work queued */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 9, 0)
+#define BH_WQ system_bh_wq       /* Softirq context, the tasklet successor */
+#else
+#define BH_WQ system_highpri_wq
+#endif
+
+#define GEN_BATCH_BYTES 256                    /* Max bytes queued per timer tick */
+#define GEN_TICK_NS     (100 * NSEC_PER_USEC)  /* Shortest timer period */
+#define GEN_RATE_MAX    1000000                /* Records per second */
+
+#define REC_CAPACITY_DEFAULT 65536      /* Trace records, 1 MiB */
+#define REC_CAPACITY_MAX     (1 << 20)
+#define REC_SPEED_MAX        10000      /* Percent */
+
+/*
+ * Raw byte framer, one per injection stream
+ * idx counts the bytes of the record being assembled; 0 means hunting
+ * for a record start.
+ */
+struct vinput_framer {
+    unsigned char buf[VINPUT_RECORD_MAX];
+    unsigned int idx;
+};
+
+/* Per-open state of the injection device */
+struct vinput_inject_ctx {
+    struct vinput_device *vdev;
+    struct vinput_ring_header *ring;  /* vmalloc_user'd, shared via mmap */
+    u32 tail;                         /* Trusted copy of ring->tail */
+    struct vinput_framer framer;      /* Shared by write() and kicks */
+    struct mutex lock;                /* Serializes writes and kicks on this file */
+};
+
+static const char * const overflow_names[] = {
+    [VINPUT_DROP_NEWEST] = "drop-newest",
+    [VINPUT_DROP_OLDEST] = "drop-oldest",
+    [VINPUT_BLOCK]       = "block",
+};
+
+static const char * const bh_mode_names[] = {
+    [VINPUT_BH_TASKLET]   = "tasklet",
+    [VINPUT_BH_WORKQUEUE] = "workqueue",
+    [VINPUT_BH_KTHREAD]   = "kthread",
+};
+
+/*
+ * Parameter Validation
+ * Called once per driver at load time. ring_size is rounded up to a
+ * power of two so kfifo indices are masked rather than taken modulo.
+ */
+int vinput_setup(struct vinput_class *cls, const struct vinput_params *params)
+{
+    int policy, mode;
+    
+    if (WARN_ON(!cls->ops || !cls->ops->process || !params->bh_budget ||
+                !cls->record_size || cls->record_size > VINPUT_RECORD_MAX))
+        return -EINVAL;
+    
+    policy = sysfs_match_string(overflow_names, params->overflow);
+    if (policy < 0) {
+        pr_err("%s: Unknown overflow policy '%s'\n", cls->name,
+               params->overflow);
+        return -EINVAL;
+    }
+    
+    if (params->ring_size < VINPUT_RING_SIZE_MIN ||
+        params->ring_size > VINPUT_RING_SIZE_MAX) {
+        pr_err("%s: ring_size must be %d-%d\n", cls->name,
+               VINPUT_RING_SIZE_MIN, VINPUT_RING_SIZE_MAX);
+        return -EINVAL;
+    }
+    
+    mode = sysfs_match_string(bh_mode_names, params->bh_mode);
+    if (mode < 0) {
+        pr_err("%s: Unknown bh_mode '%s'\n", cls->name, params->bh_mode);
+        return -EINVAL;
+    }
+    
+    if (params->bh_cpu >= 0 &&
+        (params->bh_cpu >= nr_cpu_ids || !cpu_online(params->bh_cpu))) {
+        pr_err("%s: bh_cpu %d is not online\n", cls->name, params->bh_cpu);
+        return -EINVAL;
+    }
+    
+    cls->ring_size = roundup_pow_of_two(params->ring_size);
+    cls->overflow = policy;
+    cls->bh_mode = mode;
+    cls->bh_cpu = params->bh_cpu;
+    cls->bh_spread = params->bh_spread;
+    cls->bh_budget = params->bh_budget;
+    
+    pr_info("%s: Ring: %u %s, overflow policy %s\n", cls->name,
+            cls->ring_size, cls->unit, overflow_names[policy]);
+    pr_info("%s: Bottom half: %s, budget %u %s/run%s\n", cls->name,
+            bh_mode_names[mode], *params->bh_budget, cls->unit,
+            params->bh_spread ? ", spread across CPUs" : "");
+    
+    return 0;
+}
+EXPORT_SYMBOL_GPL(vinput_setup);
+
+/*
+ * Buffer Management Functions
+ * Single-producer/single-consumer kfifo ring of whole records, so the
+ * bottom half never reassembles bytes. Writers serialize among
+ * themselves on producer_lock; the bottom half drains without a lock,
+ * except under drop-oldest where producers also move the out index.
+ */
+
+/*
+ * Append pushed records to the capture buffer
+ * Runs under producer_lock, which serializes it with the other
+ * producers and with vinput_rec_stop(). Records that no longer fit are
+ * only counted, so the capture keeps its constant cost per record.
+ */
+static void vinput_capture(struct vinput_device *vdev,
+                           const unsigned char *records, unsigned int count,
+                           u64 now_ns)
+{
+    struct vinput_recorder *rec = &vdev->rec;
+    unsigned int size = vdev->cls->record_size;
+    struct vinput_trace_record *tr;
+    unsigned int i, n;
+    
+    n = min(count, rec->capacity - rec->count);
+    for (i = 0; i < n; i++) {
+        tr = &rec->buf[rec->count + i];
+        tr->time_ns = now_ns - rec->start_ns;
+        memset(tr->data, 0, sizeof(tr->data));
+        memcpy(tr->data, records + i * size, size);
+    }
+    rec->count += n;
+    rec->overrun += count - n;
+}
+
+/*
+ * Push records under a single lock hold
+ * records holds count records back to back. All entries share one
+ * enqueue timestamp. Under drop-oldest every record is queued and the
+ * overwritten ones are counted here. Returns the number buffered;
+ * callers decide whether a short push is a drop or backpressure.
+ */
+unsigned int vinput_push(struct vinput_device *vdev,
+                         const unsigned char *records, unsigned int count)
+{
+    unsigned int size = vdev->cls->record_size;
+    struct vinput_entry entry;
+    unsigned long flags;
+    unsigned int n, len, overwritten = 0;
+    
+    entry.enqueue_ns = ktime_get_ns();
+    
+    spin_lock_irqsave(&vdev->producer_lock, flags);
+    
+    for (n = 0; n < count; n++) {
+        memcpy(entry.data, records + n * size, size);
+        if (kfifo_put(&vdev->fifo, entry))
+            continue;
+        if (vdev->cls->overflow != VINPUT_DROP_OLDEST)
+            break;
+        kfifo_skip(&vdev->fifo);  /* Make room by discarding the oldest */
+        kfifo_put(&vdev->fifo, entry);
+        overwritten++;
+    }
+    
+    vdev->stats.injected += n;
+    if (unlikely(vdev->rec.state == VINPUT_REC_CAPTURE))
+        vinput_capture(vdev, records, n, entry.enqueue_ns);
+    len = kfifo_len(&vdev->fifo);
+    if (len > vdev->stats.max_occupancy)
+        vdev->stats.max_occupancy = len;
+    
+    spin_unlock_irqrestore(&vdev->producer_lock, flags);
+    
+    trace_vinput_ring_push(vdev, n, len);
+    if (overwritten) {
+        atomic64_add(overwritten, &vdev->stats.drops);
+        trace_vinput_ring_drop(vdev, overwritten);
+    }
+    return n;
+}
+EXPORT_SYMBOL_GPL(vinput_push);
+
+static bool vinput_record_start(const struct vinput_class *cls,
+                                unsigned char byte)
+{
+    return !cls->ops->record_start || cls->ops->record_start(byte);
+}
+
+/*
+ * Resynchronizing framer for the raw byte path (write() and shared ring)
+ * While hunting, bytes that cannot start a record are skipped, so a lost
+ * or corrupt byte costs at most one record instead of misaligning the
+ * rest of the stream. Complete records are queued in batches; when the
+ * ring fills, the framer is rewound to just after the last queued
+ * record. Returns the number of bytes consumed.
+ */
+static unsigned int vinput_frame_bytes(struct vinput_device *vdev,
+                                       struct vinput_framer *fr,
+                                       const unsigned char *bytes,
+                                       unsigned int count)
+{
+    const struct vinput_class *cls = vdev->cls;
+    unsigned int size = cls->record_size;
+    unsigned char records[FRAME_BATCH * VINPUT_RECORD_MAX];
+    unsigned int ends[FRAME_BATCH], skips[FRAME_BATCH];
+    struct vinput_framer saved;
+    unsigned int done = 0, i, n, pushed, skipped;
+    unsigned char b;
+    
+    /* Single-byte records that are all valid need no framing */
+    if (size == 1 && !cls->ops->record_start)
+        return vinput_push(vdev, bytes, count);
+    
+    while (done < count) {
+        saved = *fr;
+        n = 0;
+        skipped = 0;
+    
+        for (i = done; i < count && n < FRAME_BATCH; i++) {
+            /*
+             * bytes may be the user-mapped shared ring: read each byte
+             * once, so the one checked is the one queued
+             */
+            b = READ_ONCE(bytes[i]);
+            if (!fr->idx && !vinput_record_start(cls, b)) {
+                skipped++;
+                continue;
+            }
+            fr->buf[fr->idx++] = b;
+            if (fr->idx == size) {
+                memcpy(records + n * size, fr->buf, size);
+                ends[n] = i + 1;
+                skips[n++] = skipped;
+                fr->idx = 0;
+            }
+        }
+    
+        pushed = n ? vinput_push(vdev, records, n) : 0;
+        if (pushed < n) {
+            /* Ring full: keep only what made it in */
+            if (!pushed) {
+                *fr = saved;
+                return done;
+            }
+            fr->idx = 0;
+            done = ends[pushed - 1];
+            skipped = skips[pushed - 1];
+            if (skipped)
+                atomic64_add(skipped, &vdev->stats.resync_bytes);
+            return done;
+        }
+    
+        if (skipped)
+            atomic64_add(skipped, &vdev->stats.resync_bytes);
+        done = i;
+    }
+    
+    return done;
+}
+
+/*
+ * Map a latency to its log2 histogram bucket
+ */
+static unsigned int latency_bucket(u64 ns)
+{
+    return min_t(unsigned int, fls64(ns), VINPUT_LAT_BUCKETS - 1);
+}
+
+/*
+ * Close one frame with SYN_REPORT and account it
+ * start_ns and last_ns are the enqueue times of the oldest and newest
+ * record in the frame. The frame is stamped with last_ns, so clients see
+ * when its records were injected rather than when the bottom half got
+ * to them, and a burst drained in one run keeps its original spacing.
+ * Returns the enqueue-to-sync latency for the decoder's own tracepoint.
+ */
+u64 vinput_sync_frame(struct vinput_device *vdev, u64 start_ns, u64 last_ns)
+{
+    u64 latency;
+    
+    input_set_timestamp(vdev->input, ns_to_ktime(last_ns));
+    input_sync(vdev->input);
+    
+    latency = ktime_get_ns() - start_ns;
+    vdev->stats.frames++;
+    vdev->stats.latency_hist[latency_bucket(latency)]++;
+    return latency;
+}
+EXPORT_SYMBOL_GPL(vinput_sync_frame);
+
+/*
+ * Bottom-Half Run
+ * Hands at most bh_budget records to the decoder, then lets it close the
+ * open frame. Returns true if the ring still holds data.
+ */
+static bool vinput_bh_run(struct vinput_device *vdev)
+{
+    const struct vinput_class *cls = vdev->cls;
+    struct vinput_entry entries[DRAIN_CHUNK];
+    unsigned int budget = READ_ONCE(*cls->bh_budget);
+    unsigned int done = 0, want, n;
+    
+    if (!budget)
+        budget = UINT_MAX;
+    
+    /* Copy out whole spans with a single index update per chunk */
+    while (done < budget) {
+        want = min_t(unsigned int, DRAIN_CHUNK, budget - done);
+        if (cls->overflow == VINPUT_DROP_OLDEST)
+            n = kfifo_out_spinlocked(&vdev->fifo, entries, want,
+                                     &vdev->producer_lock);
+        else
+            n = kfifo_out(&vdev->fifo, entries, want);
+        if (!n)
+            break;
+    
+        cls->ops->process(vdev, entries, n);
+        done += n;
+    }
+    
+    /* Nothing buffered by the decoder outlives the run that drained it */
+    if (cls->ops->flush)
+        cls->ops->flush(vdev);
+    
+    /* Let writers blocked on a full ring retry */
+    if (done && wq_has_sleeper(&vdev->space_wait))
+        wake_up_interruptible(&vdev->space_wait);
+    
+    vdev->stats.bh_runs++;
+    vdev->stats.bh_records += done;
+    if (done > vdev->stats.bh_max_records)
+        vdev->stats.bh_max_records = done;
+    
+    return !kfifo_is_empty(&vdev->fifo);
+}
+
+/*
+ * Bottom-Half Backends
+ * The same budgeted run is driven by a tasklet, a workqueue (BH
+ * workqueue on 6.9+, high-priority otherwise) or a dedicated kthread
+ * that can be pinned to a CPU. A run that exhausts its budget
+ * reschedules itself instead of holding the CPU until the ring is empty.
+ * Tasklets always run on the CPU that scheduled them, so separate
+ * instances already proceed in parallel when they are fed from
+ * different CPUs.
+ */
+void vinput_schedule_bh(struct vinput_device *vdev)
+{
+    switch (vdev->cls->bh_mode) {
+    case VINPUT_BH_TASKLET:
+        tasklet_schedule(&vdev->tasklet);
+        break;
+    case VINPUT_BH_WORKQUEUE:
+        if (vdev->bh_cpu >= 0)
+            queue_work_on(vdev->bh_cpu, BH_WQ, &vdev->work);
+        else
+            queue_work(BH_WQ, &vdev->work);
+        break;
+    case VINPUT_BH_KTHREAD:
+        set_bit(BH_PENDING, &vdev->bh_flags);
+        wake_up_process(vdev->bh_thread);
+        break;
+    }
+}
+EXPORT_SYMBOL_GPL(vinput_schedule_bh);
+
+static void vinput_tasklet_handler(unsigned long data)
+{
+    struct vinput_device *vdev = (struct vinput_device *)data;
+    
+    if (vinput_bh_run(vdev))
+        vinput_schedule_bh(vdev);  /* Budget exhausted, yield */
+}
+
+static void vinput_work_handler(struct work_struct *work)
+{
+    struct vinput_device *vdev = container_of(work, struct vinput_device, work);
+    
+    if (vinput_bh_run(vdev))
+        vinput_schedule_bh(vdev);  /* Budget exhausted, yield */
+}
+
+static int vinput_bh_thread(void *data)
+{
+    struct vinput_device *vdev = data;
+    
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (kthread_should_stop())
+            break;
+    
+        if (!test_and_clear_bit(BH_PENDING, &vdev->bh_flags)) {
+            schedule();
+            continue;
+        }
+        __set_current_state(TASK_RUNNING);
+    
+        if (vinput_bh_run(vdev))
+            set_bit(BH_PENDING, &vdev->bh_flags);  /* Budget exhausted */
+        cond_resched();
+    }
+    __set_current_state(TASK_RUNNING);
+    
+    return 0;
+}
+
+static int vinput_bh_init(struct vinput_device *vdev)
+{
+    const struct vinput_class *cls = vdev->cls;
+    
+    if (cls->bh_spread)
+        vdev->bh_cpu = cpumask_local_spread(vdev->id, NUMA_NO_NODE);
+    else
+        vdev->bh_cpu = cls->bh_cpu;
+    
+    switch (cls->bh_mode) {
+    case VINPUT_BH_TASKLET:
+        tasklet_init(&vdev->tasklet, vinput_tasklet_handler,
+                     (unsigned long)vdev);
+        break;
+    case VINPUT_BH_WORKQUEUE:
+        INIT_WORK(&vdev->work, vinput_work_handler);
+        break;
+    case VINPUT_BH_KTHREAD:
+        vdev->bh_thread = kthread_create(vinput_bh_thread, vdev, "%s_bh/%u",
+                                         cls->short_name, vdev->id);
+        if (IS_ERR(vdev->bh_thread))
+            return PTR_ERR(vdev->bh_thread);
+        if (vdev->bh_cpu >= 0)
+            kthread_bind(vdev->bh_thread, vdev->bh_cpu);
+        wake_up_process(vdev->bh_thread);
+        break;
+    }
+    
+    return 0;
+}
+
+static void vinput_bh_stop(struct vinput_device *vdev)
+{
+    switch (vdev->cls->bh_mode) {
+    case VINPUT_BH_TASKLET:
+        tasklet_kill(&vdev->tasklet);
+        break;
+    case VINPUT_BH_WORKQUEUE:
+        cancel_work_sync(&vdev->work);
+        break;
+    case VINPUT_BH_KTHREAD:
+        kthread_stop(vdev->bh_thread);
+        break;
+    }
+}
+
+/*
+ * Backpressure: kick the bottom half and sleep until the ring has room
+ */
+static int vinput_wait_space(struct vinput_device *vdev)
+{
+    vinput_schedule_bh(vdev);
+    return wait_event_interruptible(vdev->space_wait,
+                                    !kfifo_is_full(&vdev->fifo));
+}
+
+/*
+ * Simulated IRQ Handler (Top Half)
+ * In real driver, this would be called by hardware interrupt
+ * Here, triggered by sysfs injection with whole, validated records.
+ * Sysfs writes run in process context, which is what allows the block
+ * policy to sleep.
+ */
+static int vinput_simulate_irq(struct vinput_device *vdev,
+                               const unsigned char *records, unsigned int count)
+{
+    unsigned int size = vdev->cls->record_size;
+    unsigned int pushed;
+    int ret;
+    
+    /* Buffer the records */
+    pushed = vinput_push(vdev, records, count);
+    while (pushed < count && vdev->cls->overflow == VINPUT_BLOCK) {
+        ret = vinput_wait_space(vdev);
+        if (ret)
+            return ret;
+        pushed += vinput_push(vdev, records + pushed * size, count - pushed);
+    }
+    
+    if (pushed < count) {
+        atomic64_add(count - pushed, &vdev->stats.drops);
+        trace_vinput_ring_drop(vdev, count - pushed);
+        pr_warn_ratelimited("%s: Buffer overflow, dropping %u of %u %s\n",
+                            vdev->name, count - pushed, count, vdev->cls->unit);
+    }
+    
+    /* Schedule bottom-half processing */
+    vinput_schedule_bh(vdev);
+    
+    return 0;
+}
+
+/*
+ * Validate and queue count records as one batch
+ * Every record is checked before any is queued, so a bad one rejects
+ * the whole batch. The batch then takes one lock hold, one counter
+ * update and one bottom-half schedule.
+ */
+int vinput_inject(struct vinput_device *vdev, const unsigned char *records,
+                  unsigned int count)
+{
+    const struct vinput_class *cls = vdev->cls;
+    unsigned int i, invalid = 0;
+    unsigned char start;
+    
+    for (i = 0; i < count; i++) {
+        start = records[i * cls->record_size];
+        if (vinput_record_start(cls, start))
+            continue;
+    
+        invalid++;
+        pr_warn_ratelimited("%s: Invalid record start byte 0x%02x\n",
+                            vdev->name, start);
+    }
+    
+    if (invalid) {
+        atomic64_add(invalid, &vdev->stats.invalid);
+        return -EINVAL;
+    }
+    
+    trace_vinput_inject(vdev, VINPUT_SRC_SYSFS, count * cls->record_size);
+    return vinput_simulate_irq(vdev, records, count);
+}
+EXPORT_SYMBOL_GPL(vinput_inject);
+
+/*
+ * Parse whitespace-separated byte values ("0x2A 0x1E ...")
+ * bytes must hold count / 2 + 1 values. Returns the number parsed or a
+ * negative errno.
+ */
+static int vinput_parse_bytes(const char *name, const char *buf, size_t count,
+                              unsigned char *bytes)
+{
+    char *copy, *p, *tok;
+    int n = 0, ret;
+    u8 byte;
+    
+    copy = kstrndup(buf, count, GFP_KERNEL);
+    if (!copy)
+        return -ENOMEM;
+    
+    p = copy;
+    while ((tok = strsep(&p, " \t\n")) != NULL) {
+        if (!*tok)
+            continue;
+    
+        ret = kstrtou8(tok, 0, &byte);
+        if (ret) {
+            pr_warn("%s: Invalid byte value '%s' (must be 0-255)\n",
+                    name, tok);
+            n = ret;
+            break;
+        }
+    
+        bytes[n++] = byte;
+    }
+    
+    kfree(copy);
+    return n;
+}
+
+/*
+ * Sysfs text injection
+ * With single set, the write must hold exactly one record; otherwise any
+ * number of whole records. Returns count or a negative errno.
+ */
+ssize_t vinput_store_text(struct vinput_device *vdev, const char *buf,
+                          size_t count, bool single)
+{
+    unsigned int size = vdev->cls->record_size;
+    unsigned char *bytes;
+    int n, ret;
+    
+    /* Every value takes at least one character plus a separator */
+    bytes = kmalloc(count / 2 + 1, GFP_KERNEL);
+    if (!bytes)
+        return -ENOMEM;
+    
+    n = vinput_parse_bytes(vdev->name, buf, count, bytes);
+    if (n < 0) {
+        ret = n;
+        goto out_free;
+    }
+    
+    if (single ? n != size : (!n || n % size)) {
+        pr_warn("%s: Expected %s%u-byte record%s, got %d bytes\n", vdev->name,
+                single ? "one " : "whole ", size, single ? "" : "s", n);
+        ret = -EINVAL;
+        goto out_free;
+    }
+    
+    ret = vinput_inject(vdev, bytes, n / size);
+    if (!ret)
+        ret = count;
+
+out_free:
+    kfree(bytes);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(vinput_store_text);
+
+/*
+ * Sysfs binary injection: whole records back to back, up to a page
+ */
+ssize_t vinput_store_raw(struct vinput_device *vdev, const char *buf,
+                         size_t count)
+{
+    unsigned int size = vdev->cls->record_size;
+    int ret;
+    
+    if (count % size)
+        return -EINVAL;
+    
+    ret = vinput_inject(vdev, (const unsigned char *)buf, count / size);
+    
+    return ret ? ret : count;
+}
+EXPORT_SYMBOL_GPL(vinput_store_raw);
+
+/*
+ * Synthetic Load Generator
+ * An hrtimer acts as the interrupt source: every tick it queues the
+ * records due at the configured rate (or tops the ring up when rate is
+ * 0) and schedules the bottom half, with no user space in the loop.
+ * Records come from a pattern, or from the decoder's gen_record. Only
+ * delivered records advance the sequence, so a drop never splits e.g. a
+ * key press from its release. Under the block policy a full ring is
+ * backpressure: refused records are retried and show up as a lower rate.
+ *
+ *   echo 8000 > generator/rate; echo 1 > generator/enable
+ */
+static void vinput_gen_record(struct vinput_device *vdev, u64 seq,
+                              unsigned char *record)
+{
+    struct vinput_gen *gen = &vdev->gen;
+    unsigned int size = vdev->cls->record_size;
+    u32 pos;
+    
+    if (gen->pattern_len) {
+        div_u64_rem(seq, gen->pattern_len, &pos);
+        memcpy(record, gen->pattern + pos * size, size);
+        return;
+    }
+    
+    vdev->cls->ops->gen_record(vdev, seq, record);
+}
+
+static enum hrtimer_restart vinput_gen_timer(struct hrtimer *timer)
+{
+    struct vinput_device *vdev = container_of(timer, struct vinput_device,
+                                              gen.timer);
+    struct vinput_gen *gen = &vdev->gen;
+    unsigned int size = vdev->cls->record_size;
+    unsigned char records[GEN_BATCH_BYTES];
+    unsigned int i, n, pushed;
+    u64 due;
+    
+    if (gen->rate)
+        due = mul_u64_u32_div(ktime_get_ns() - gen->start_ns, gen->rate,
+                              NSEC_PER_SEC) - gen->seq - gen->dropped;
+    else
+        due = kfifo_avail(&vdev->fifo);  /* Flat-out: top the ring up */
+    
+    n = min_t(u64, due, GEN_BATCH_BYTES / size);
+    if (n) {
+        for (i = 0; i < n; i++)
+            vinput_gen_record(vdev, gen->seq + i, records + i * size);
+    
+        trace_vinput_inject(vdev, VINPUT_SRC_GEN, n * size);
+        pushed = vinput_push(vdev, records, n);
+        WRITE_ONCE(gen->seq, gen->seq + pushed);
+        if (pushed < n && vdev->cls->overflow != VINPUT_BLOCK) {
+            WRITE_ONCE(gen->dropped, gen->dropped + n - pushed);
+            atomic64_add(n - pushed, &vdev->stats.drops);
+            trace_vinput_ring_drop(vdev, n - pushed);
+        }
+        vinput_schedule_bh(vdev);
+    }
+    
+    hrtimer_forward_now(timer, ns_to_ktime(gen->period_ns));
+    return HRTIMER_RESTART;
+}
+
+/* CLOCK_MONOTONIC hrtimer, also used by the drivers' own timers */
+void vinput_hrtimer_init(struct hrtimer *timer,
+                         enum hrtimer_restart (*fn)(struct hrtimer *),
+                         enum hrtimer_mode mode)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(timer, fn, CLOCK_MONOTONIC, mode);
+#else
+    hrtimer_init(timer, CLOCK_MONOTONIC, mode);
+    timer->function = fn;
+#endif
+}
+EXPORT_SYMBOL_GPL(vinput_hrtimer_init);
+
+static void vinput_gen_init(struct vinput_device *vdev)
+{
+    mutex_init(&vdev->gen.lock);
+    vinput_hrtimer_init(&vdev->gen.timer, vinput_gen_timer, HRTIMER_MODE_REL);
+}
+
+/* Called with gen->lock held */
+static int vinput_gen_start(struct vinput_device *vdev)
+{
+    struct vinput_gen *gen = &vdev->gen;
+    
+    if (!gen->pattern_len && !vdev->cls->ops->gen_record)
+        return -EINVAL;  /* Nothing to generate */
+    
+    gen->period_ns = GEN_TICK_NS;
+    if (gen->rate)
+        gen->period_ns = max_t(u64, NSEC_PER_SEC / gen->rate, GEN_TICK_NS);
+    
+    gen->seq = 0;
+    gen->dropped = 0;
+    gen->start_ns = ktime_get_ns();
+    gen->running = true;
+    hrtimer_start(&gen->timer, ns_to_ktime(gen->period_ns), HRTIMER_MODE_REL);
+    
+    return 0;
+}
+
+/* Called with gen->lock held */
+static void vinput_gen_stop(struct vinput_device *vdev)
+{
+    struct vinput_gen *gen = &vdev->gen;
+    
+    hrtimer_cancel(&gen->timer);
+    gen->stop_ns = ktime_get_ns();
+    gen->running = false;
+    
+    if (vdev->cls->ops->gen_stop)
+        vdev->cls->ops->gen_stop(vdev);
+}
+
+static ssize_t gen_enable_show(struct device *dev,
+                               struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%d\n", READ_ONCE(vdev->gen.running));
+}
+
+static ssize_t gen_enable_store(struct device *dev,
+                                struct device_attribute *attr,
+                                const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    bool enable;
+    int ret;
+    
+    ret = kstrtobool(buf, &enable);
+    if (ret)
+        return ret;
+    
+    mutex_lock(&vdev->gen.lock);
+    if (enable && !vdev->gen.running)
+        ret = vinput_gen_start(vdev);
+    else if (!enable && vdev->gen.running)
+        vinput_gen_stop(vdev);
+    mutex_unlock(&vdev->gen.lock);
+    
+    return ret ? ret : count;
+}
+
+static ssize_t gen_rate_show(struct device *dev,
+                             struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(vdev->gen.rate));
+}
+
+static ssize_t gen_rate_store(struct device *dev,
+                              struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    unsigned int rate;
+    int ret;
+    
+    ret = kstrtouint(buf, 0, &rate);
+    if (ret)
+        return ret;
+    if (rate > GEN_RATE_MAX)
+        return -EINVAL;
+    
+    mutex_lock(&vdev->gen.lock);
+    if (vdev->gen.running) {
+        ret = -EBUSY;
+    } else {
+        vdev->gen.rate = rate;
+        ret = count;
+    }
+    mutex_unlock(&vdev->gen.lock);
+    
+    return ret;
+}
+
+static ssize_t gen_pattern_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    unsigned int i, len_bytes;
+    int len = 0;
+    
+    mutex_lock(&vdev->gen.lock);
+    len_bytes = vdev->gen.pattern_len * vdev->cls->record_size;
+    for (i = 0; i < len_bytes; i++)
+        len += sysfs_emit_at(buf, len, "%s0x%02x", i ? " " : "",
+                             vdev->gen.pattern[i]);
+    mutex_unlock(&vdev->gen.lock);
+    
+    len += sysfs_emit_at(buf, len, "\n");
+    return len;
+}
+
+/* Whole, valid records; an empty write selects ops->gen_record */
+static ssize_t gen_pattern_store(struct device *dev,
+                                 struct device_attribute *attr,
+                                 const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    unsigned int size = vdev->cls->record_size;
+    unsigned char *bytes;
+    unsigned int i;
+    int n, ret;
+    
+    bytes = kmalloc(count / 2 + 1, GFP_KERNEL);
+    if (!bytes)
+        return -ENOMEM;
+    
+    n = vinput_parse_bytes(vdev->name, buf, count, bytes);
+    if (n < 0) {
+        ret = n;
+        goto out_free;
+    }
+    if (n > VINPUT_GEN_PATTERN_MAX) {
+        ret = -E2BIG;
+        goto out_free;
+    }
+    if (n % size) {
+        ret = -EINVAL;
+        goto out_free;
+    }
+    for (i = 0; i < n; i += size) {
+        if (!vinput_record_start(vdev->cls, bytes[i])) {
+            ret = -EINVAL;
+            goto out_free;
+        }
+    }
+    
+    mutex_lock(&vdev->gen.lock);
+    if (vdev->gen.running) {
+        ret = -EBUSY;
+    } else {
+        memcpy(vdev->gen.pattern, bytes, n);
+        vdev->gen.pattern_len = n / size;
+        ret = count;
+    }
+    mutex_unlock(&vdev->gen.lock);
+
+out_free:
+    kfree(bytes);
+    return ret;
+}
+
+static ssize_t gen_generated_show(struct device *dev,
+                                  struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(vdev->gen.seq));
+}
+
+static ssize_t gen_dropped_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(vdev->gen.dropped));
+}
+
+/* Delivered records per second over the current or last run */
+static ssize_t gen_achieved_rate_show(struct device *dev,
+                                      struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    struct vinput_gen *gen = &vdev->gen;
+    u64 end, elapsed, rate = 0;
+    
+    mutex_lock(&gen->lock);
+    end = gen->running ? ktime_get_ns() : gen->stop_ns;
+    elapsed = end - gen->start_ns;
+    if (gen->start_ns && elapsed)
+        rate = mul_u64_u64_div_u64(READ_ONCE(gen->seq), NSEC_PER_SEC, elapsed);
+    mutex_unlock(&gen->lock);
+    
+    return sysfs_emit(buf, "%llu\n", rate);
+}
+
+static struct device_attribute dev_attr_gen_enable =
+    __ATTR(enable, 0644, gen_enable_show, gen_enable_store);
+static struct device_attribute dev_attr_gen_rate =
+    __ATTR(rate, 0644, gen_rate_show, gen_rate_store);
+static struct device_attribute dev_attr_gen_pattern =
+    __ATTR(pattern, 0644, gen_pattern_show, gen_pattern_store);
+static struct device_attribute dev_attr_gen_generated =
+    __ATTR(generated, 0444, gen_generated_show, NULL);
+static struct device_attribute dev_attr_gen_dropped =
+    __ATTR(dropped, 0444, gen_dropped_show, NULL);
+static struct device_attribute dev_attr_gen_achieved_rate =
+    __ATTR(achieved_rate, 0444, gen_achieved_rate_show, NULL);
+
+static struct attribute *vinput_gen_attrs[] = {
+    &dev_attr_gen_enable.attr,
+    &dev_attr_gen_rate.attr,
+    &dev_attr_gen_pattern.attr,
+    &dev_attr_gen_generated.attr,
+    &dev_attr_gen_dropped.attr,
+    &dev_attr_gen_achieved_rate.attr,
+    NULL,
+};
+
+static const struct attribute_group vinput_gen_group = {
+    .name  = "generator",
+    .attrs = vinput_gen_attrs,
+};
+
+/*
+ * Record and Replay
+ * A capture logs every record that enters the ring, from any injection
+ * path, with its time relative to the start of the capture. The trace
+ * can be read from debugfs (<name>/trace) and written back later, on the
+ * same or a changed driver. A replay feeds it through the ring with an
+ * hrtimer armed for the due time of each record, scaled by speed, so
+ * the same trace always produces the same record sequence and spacing.
+ * Under the block policy a full ring delays the replay; otherwise refused
+ * records are counted in dropped, like generator drops.
+ *
+ *   echo capture > recorder/mode; ...; echo idle > recorder/mode
+ *   cat /sys/kernel/debug/<name>/trace > storm.trace
+ *   cat storm.trace > /sys/kernel/debug/<name>/trace
+ *   echo 200 > recorder/speed; echo replay > recorder/mode
+ */
+static const char * const rec_state_names[] = {
+    [VINPUT_REC_IDLE]    = "idle",
+    [VINPUT_REC_CAPTURE] = "capture",
+    [VINPUT_REC_REPLAY]  = "replay",
+};
+
+/* Due time of replay record i, relative to the start of the replay */
+static u64 vinput_rec_due(const struct vinput_recorder *rec, unsigned int i)
+{
+    return div_u64(rec->buf[i].time_ns * 100, rec->speed);
+}
+
+static enum hrtimer_restart vinput_rec_timer(struct hrtimer *timer)
+{
+    struct vinput_device *vdev = container_of(timer, struct vinput_device,
+                                              rec.timer);
+    struct vinput_recorder *rec = &vdev->rec;
+    unsigned int size = vdev->cls->record_size;
+    unsigned char records[GEN_BATCH_BYTES];
+    unsigned int n = 0, max, pushed;
+    u64 now = ktime_get_ns() - rec->start_ns;
+    u64 next;
+    
+    max = min(GEN_BATCH_BYTES / size, rec->count - rec->pos);
+    if (!rec->speed)
+        max = min(max, kfifo_avail(&vdev->fifo));  /* Flat-out */
+    while (n < max && (!rec->speed || vinput_rec_due(rec, rec->pos + n) <= now)) {
+        memcpy(records + n * size, rec->buf[rec->pos + n].data, size);
+        n++;
+    }
+    
+    pushed = n;
+    if (n) {
+        trace_vinput_inject(vdev, VINPUT_SRC_REPLAY, n * size);
+        pushed = vinput_push(vdev, records, n);
+        if (pushed < n && vdev->cls->overflow != VINPUT_BLOCK) {
+            WRITE_ONCE(rec->dropped, rec->dropped + n - pushed);
+            atomic64_add(n - pushed, &vdev->stats.drops);
+            trace_vinput_ring_drop(vdev, n - pushed);
+            pushed = n;  /* Lost, not retried */
+        }
+        WRITE_ONCE(rec->pos, rec->pos + pushed);
+        vinput_schedule_bh(vdev);
+    }
+    
+    if (rec->pos == rec->count) {
+        WRITE_ONCE(rec->state, VINPUT_REC_IDLE);
+        return HRTIMER_NORESTART;
+    }
+    
+    /* Back off while the ring is full, otherwise wake at the next due time */
+    if (!rec->speed || pushed < n)
+        next = now + GEN_TICK_NS;
+    else
+        next = max(vinput_rec_due(rec, rec->pos), now);
+    hrtimer_set_expires(timer, ns_to_ktime(rec->start_ns + next));
+    return HRTIMER_RESTART;
+}
+
+static void vinput_rec_init(struct vinput_device *vdev)
+{
+    mutex_init(&vdev->rec.lock);
+    vdev->rec.capacity = REC_CAPACITY_DEFAULT;
+    vdev->rec.speed = 100;
+    vinput_hrtimer_init(&vdev->rec.timer, vinput_rec_timer, HRTIMER_MODE_ABS);
+}
+
+/* Called with rec->lock held; allocates the buffer outside any hot path */
+static int vinput_rec_alloc(struct vinput_recorder *rec)
+{
+    if (rec->buf)
+        return 0;
+    
+    rec->buf = vmalloc(array_size(rec->capacity, sizeof(*rec->buf)));
+    return rec->buf ? 0 : -ENOMEM;
+}
+
+/* Called with rec->lock held */
+static int vinput_rec_start_capture(struct vinput_device *vdev)
+{
+    struct vinput_recorder *rec = &vdev->rec;
+    int ret;
+    
+    ret = vinput_rec_alloc(rec);
+    if (ret)
+        return ret;
+    
+    rec->count = 0;
+    rec->loaded = 0;
+    rec->overrun = 0;
+    
+    spin_lock_irq(&vdev->producer_lock);
+    rec->start_ns = ktime_get_ns();
+    WRITE_ONCE(rec->state, VINPUT_REC_CAPTURE);
+    spin_unlock_irq(&vdev->producer_lock);
+    
+    return 0;
+}
+
+/* Called with rec->lock held */
+static int vinput_rec_start_replay(struct vinput_device *vdev)
+{
+    struct vinput_recorder *rec = &vdev->rec;
+    unsigned int i;
+    
+    /* A loaded trace must be complete; a fresh capture always is */
+    if (!rec->count || (rec->loaded && rec->count != rec->loaded))
+        return -ENODATA;
+    
+    for (i = 0; i < rec->count; i++) {
+        if (i && rec->buf[i].time_ns < rec->buf[i - 1].time_ns)
+            return -EINVAL;
+        if (!vinput_record_start(vdev->cls, rec->buf[i].data[0]))
+            return -EINVAL;
+    }
+    
+    hrtimer_cancel(&rec->timer);  /* A finished replay may still be returning */
+    rec->pos = 0;
+    rec->dropped = 0;
+    rec->start_ns = ktime_get_ns();
+    WRITE_ONCE(rec->state, VINPUT_REC_REPLAY);
+    hrtimer_start(&rec->timer, ns_to_ktime(rec->start_ns), HRTIMER_MODE_ABS);
+    
+    return 0;
+}
+
+/* Called with rec->lock held */
+static void vinput_rec_stop(struct vinput_device *vdev)
+{
+    struct vinput_recorder *rec = &vdev->rec;
+    
+    if (rec->state == VINPUT_REC_CAPTURE) {
+        /* No producer is inside vinput_capture() once we hold the lock */
+        spin_lock_irq(&vdev->producer_lock);
+        WRITE_ONCE(rec->state, VINPUT_REC_IDLE);
+        spin_unlock_irq(&vdev->producer_lock);
+        return;
+    }
+    
+    hrtimer_cancel(&rec->timer);
+    WRITE_ONCE(rec->state, VINPUT_REC_IDLE);
+}
+
+static ssize_t rec_mode_show(struct device *dev,
+                             struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%s\n", rec_state_names[READ_ONCE(vdev->rec.state)]);
+}
+
+/* The recorder is idle between modes; "idle" stops a capture or replay */
+static ssize_t rec_mode_store(struct device *dev,
+                              struct device_attribute *attr,
+                              const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    struct vinput_recorder *rec = &vdev->rec;
+    int state, ret = 0;
+    
+    state = sysfs_match_string(rec_state_names, buf);
+    if (state < 0)
+        return state;
+    
+    mutex_lock(&rec->lock);
+    if (state == VINPUT_REC_IDLE)
+        vinput_rec_stop(vdev);
+    else if (READ_ONCE(rec->state) != VINPUT_REC_IDLE)
+        ret = -EBUSY;
+    else if (state == VINPUT_REC_CAPTURE)
+        ret = vinput_rec_start_capture(vdev);
+    else
+        ret = vinput_rec_start_replay(vdev);
+    mutex_unlock(&rec->lock);
+    
+    return ret ? ret : count;
+}
+
+static ssize_t rec_capacity_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(vdev->rec.capacity));
+}
+
+/* Resizing discards the trace buffer; the new one is allocated on use */
+static ssize_t rec_capacity_store(struct device *dev,
+                                  struct device_attribute *attr,
+                                  const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    struct vinput_recorder *rec = &vdev->rec;
+    unsigned int capacity;
+    int ret;
+    
+    ret = kstrtouint(buf, 0, &capacity);
+    if (ret)
+        return ret;
+    if (!capacity || capacity > REC_CAPACITY_MAX)
+        return -EINVAL;
+    
+    mutex_lock(&rec->lock);
+    if (READ_ONCE(rec->state) != VINPUT_REC_IDLE) {
+        ret = -EBUSY;
+    } else {
+        vfree(rec->buf);
+        rec->buf = NULL;
+        rec->count = 0;
+        rec->loaded = 0;
+        rec->capacity = capacity;
+        ret = count;
+    }
+    mutex_unlock(&rec->lock);
+    
+    return ret;
+}
+
+static ssize_t rec_speed_show(struct device *dev,
+                              struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(vdev->rec.speed));
+}
+
+static ssize_t rec_speed_store(struct device *dev,
+                               struct device_attribute *attr,
+                               const char *buf, size_t count)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    struct vinput_recorder *rec = &vdev->rec;
+    unsigned int speed;
+    int ret;
+    
+    ret = kstrtouint(buf, 0, &speed);
+    if (ret)
+        return ret;
+    if (speed > REC_SPEED_MAX)
+        return -EINVAL;
+    
+    mutex_lock(&rec->lock);
+    if (READ_ONCE(rec->state) == VINPUT_REC_REPLAY) {
+        ret = -EBUSY;
+    } else {
+        rec->speed = speed;
+        ret = count;
+    }
+    mutex_unlock(&rec->lock);
+    
+    return ret;
+}
+
+static ssize_t rec_records_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(vdev->rec.count));
+}
+
+static ssize_t rec_position_show(struct device *dev,
+                                 struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%u\n", READ_ONCE(vdev->rec.pos));
+}
+
+static ssize_t rec_overrun_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(vdev->rec.overrun));
+}
+
+static ssize_t rec_dropped_show(struct device *dev,
+                                struct device_attribute *attr, char *buf)
+{
+    struct vinput_device *vdev = dev_get_drvdata(dev);
+    
+    return sysfs_emit(buf, "%llu\n", READ_ONCE(vdev->rec.dropped));
+}
+
+static struct device_attribute dev_attr_rec_mode =
+    __ATTR(mode, 0644, rec_mode_show, rec_mode_store);
+static struct device_attribute dev_attr_rec_capacity =
+    __ATTR(capacity, 0644, rec_capacity_show, rec_capacity_store);
+static struct device_attribute dev_attr_rec_speed =
+    __ATTR(speed, 0644, rec_speed_show, rec_speed_store);
+static struct device_attribute dev_attr_rec_records =
+    __ATTR(records, 0444, rec_records_show, NULL);
+static struct device_attribute dev_attr_rec_position =
+    __ATTR(position, 0444, rec_position_show, NULL);
+static struct device_attribute dev_attr_rec_overrun =
+    __ATTR(overrun, 0444, rec_overrun_show, NULL);
+static struct device_attribute dev_attr_rec_dropped =
+    __ATTR(dropped, 0444, rec_dropped_show, NULL);
+
+static struct attribute *vinput_rec_attrs[] = {
+    &dev_attr_rec_mode.attr,
+    &dev_attr_rec_capacity.attr,
+    &dev_attr_rec_speed.attr,
+    &dev_attr_rec_records.attr,
+    &dev_attr_rec_position.attr,
+    &dev_attr_rec_overrun.attr,
+    &dev_attr_rec_dropped.attr,
+    NULL,
+};
+
+static const struct attribute_group vinput_rec_group = {
+    .name  = "recorder",
+    .attrs = vinput_rec_attrs,
+};
+
+/*
+ * Trace file: struct vinput_trace_header, then the records
+ * Reading returns the captured or loaded trace. Writing from offset 0
+ * loads a new one; the header must come in the first write and the
+ * records may follow in any number of writes.
+ */
+static ssize_t vinput_trace_read(struct file *file, char __user *ubuf,
+                                 size_t count, loff_t *ppos)
+{
+    struct vinput_device *vdev = file->private_data;
+    struct vinput_recorder *rec = &vdev->rec;
+    struct vinput_trace_header hdr = {
+        .magic   = VINPUT_TRACE_MAGIC,
+        .version = VINPUT_TRACE_VERSION,
+    };
+    size_t total, done = 0, len;
+    loff_t pos = *ppos;
+    ssize_t ret;
+    
+    mutex_lock(&rec->lock);
+    if (READ_ONCE(rec->state) == VINPUT_REC_CAPTURE) {
+        ret = -EBUSY;  /* Stop the capture first */
+        goto out_unlock;
+    }
+    
+    hdr.record_size = vdev->cls->record_size;
+    hdr.count = rec->count;
+    total = sizeof(hdr) + (size_t)rec->count * sizeof(*rec->buf);
+    
+    if (pos < sizeof(hdr)) {
+        len = min_t(size_t, count, sizeof(hdr) - pos);
+        if (copy_to_user(ubuf, (char *)&hdr + pos, len)) {
+            ret = -EFAULT;
+            goto out_unlock;
+        }
+        done = len;
+        pos += len;
+    }
+    if (done < count && pos < total) {
+        len = min_t(size_t, count - done, total - pos);
+        if (copy_to_user(ubuf + done, (char *)rec->buf + pos - sizeof(hdr),
+                         len)) {
+            ret = -EFAULT;
+            goto out_unlock;
+        }
+        done += len;
+        pos += len;
+    }
+    
+    *ppos = pos;
+    ret = done;
+
+out_unlock:
+    mutex_unlock(&rec->lock);
+    return ret;
+}
+
+static ssize_t vinput_trace_write(struct file *file, const char __user *ubuf,
+                                  size_t count, loff_t *ppos)
+{
+    struct vinput_device *vdev = file->private_data;
+    struct vinput_recorder *rec = &vdev->rec;
+    struct vinput_trace_header hdr;
+    size_t done = 0, size, off, len;
+    ssize_t ret;
+    
+    mutex_lock(&rec->lock);
+    if (READ_ONCE(rec->state) != VINPUT_REC_IDLE) {
+        ret = -EBUSY;
+        goto out_unlock;
+    }
+    
+    if (*ppos == 0) {
+        if (count < sizeof(hdr)) {
+            ret = -EINVAL;
+            goto out_unlock;
+        }
+        if (copy_from_user(&hdr, ubuf, sizeof(hdr))) {
+            ret = -EFAULT;
+            goto out_unlock;
+        }
+        if (hdr.magic != VINPUT_TRACE_MAGIC ||
+            hdr.version != VINPUT_TRACE_VERSION ||
+            hdr.record_size != vdev->cls->record_size || !hdr.count) {
+            ret = -EINVAL;
+            goto out_unlock;
+        }
+        if (hdr.count > rec->capacity) {
+            ret = -EFBIG;  /* Raise recorder/capacity first */
+            goto out_unlock;
+        }
+        ret = vinput_rec_alloc(rec);
+        if (ret)
+            goto out_unlock;
+    
+        rec->count = 0;
+        rec->loaded = hdr.count;
+        done = sizeof(hdr);
+    } else if (!rec->loaded || *ppos < sizeof(hdr)) {
+        ret = -EINVAL;  /* Not continuing a load */
+        goto out_unlock;
+    }
+    
+    /* Bytes past the announced records are ignored */
+    size = (size_t)rec->loaded * sizeof(*rec->buf);
+    off = *ppos + done - sizeof(hdr);
+    len = off < size ? min(count - done, size - off) : 0;
+    if (len && copy_from_user((char *)rec->buf + off, ubuf + done, len)) {
+        ret = -EFAULT;
+        goto out_unlock;
+    }
+    rec->count = (off + len) / sizeof(*rec->buf);
+    
+    *ppos += count;
+    ret = count;
+
+out_unlock:
+    mutex_unlock(&rec->lock);
+    return ret;
+}
+
+static const struct file_operations vinput_trace_fops = {
+    .owner  = THIS_MODULE,
+    .open   = simple_open,
+    .read   = vinput_trace_read,
+    .write  = vinput_trace_write,
+    .llseek = default_llseek,
+};
+
+/*
+ * Character Device Injection: /dev/<short_name>_inject[N]
+ * write() takes a raw binary stream of records, framed and
+ * resynchronized per open file. Each open file also owns a shared ring
+ * that user space fills through mmap() and flushes with VINPUT_IOC_KICK,
+ * so no per-record syscall or text parsing is needed.
+ */
+static int vinput_inject_open(struct inode *inode, struct file *file)
+{
+    /* misc core points private_data at our miscdevice */
+    struct vinput_device *vdev = container_of(file->private_data,
+                                              struct vinput_device, misc);
+    struct vinput_inject_ctx *ctx;
+    
+    ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+    if (!ctx)
+        return -ENOMEM;
+    
+    ctx->ring = vmalloc_user(SHM_MMAP_SIZE);
+    if (!ctx->ring) {
+        kfree(ctx);
+        return -ENOMEM;
+    }
+    
+    ctx->vdev = vdev;
+    ctx->ring->size = VINPUT_RING_DATA_SIZE;
+    ctx->ring->data_offset = SHM_DATA_OFFSET;
+    mutex_init(&ctx->lock);
+    file->private_data = ctx;
+    
+    return nonseekable_open(inode, file);
+}
+
+static int vinput_inject_release(struct inode *inode, struct file *file)
+{
+    struct vinput_inject_ctx *ctx = file->private_data;
+    
+    vfree(ctx->ring);
+    mutex_destroy(&ctx->lock);
+    kfree(ctx);
+    
+    return 0;
+}
+
+/*
+ * A full ring produces a short write under drop-newest (backpressure,
+ * not a drop) and sleeps under block unless O_NONBLOCK is set.
+ */
+static ssize_t vinput_inject_write(struct file *file, const char __user *ubuf,
+                                   size_t count, loff_t *ppos)
+{
+    struct vinput_inject_ctx *ctx = file->private_data;
+    struct vinput_device *vdev = ctx->vdev;
+    bool wait = vdev->cls->overflow == VINPUT_BLOCK &&
+                !(file->f_flags & O_NONBLOCK);
+    unsigned char chunk[WRITE_CHUNK];
+    unsigned int len, used;
+    size_t done = 0;
+    int ret = -EAGAIN;
+    
+    mutex_lock(&ctx->lock);
+    
+    while (done < count) {
+        len = min_t(size_t, count - done, sizeof(chunk));
+        if (copy_from_user(chunk, ubuf + done, len)) {
+            ret = -EFAULT;
+            break;
+        }
+    
+        used = vinput_frame_bytes(vdev, &ctx->framer, chunk, len);
+        while (used < len && wait) {
+            ret = vinput_wait_space(vdev);
+            if (ret)
+                break;
+            used += vinput_frame_bytes(vdev, &ctx->framer, chunk + used,
+                                       len - used);
+        }
+        done += used;
+        if (used < len)
+            break;  /* Ring full: report a short write */
+    }
+    
+    mutex_unlock(&ctx->lock);
+    
+    if (!done)
+        return ret;
+    
+    trace_vinput_inject(vdev, VINPUT_SRC_WRITE, done);
+    vinput_schedule_bh(vdev);
+    return done;
+}
+
+/*
+ * Doorbell: frame everything published in the shared ring into the
+ * driver ring, straight from the mapped pages. Returns bytes consumed.
+ */
+static long vinput_inject_kick(struct vinput_inject_ctx *ctx)
+{
+    struct vinput_ring_header *ring = ctx->ring;
+    unsigned char *data = (unsigned char *)ring + SHM_DATA_OFFSET;
+    u32 mask = VINPUT_RING_DATA_SIZE - 1;
+    u32 head, avail, off, len, used, total = 0;
+    
+    mutex_lock(&ctx->lock);
+    
+    head = smp_load_acquire(&ring->head);
+    avail = head - ctx->tail;
+    if (avail > VINPUT_RING_DATA_SIZE) {
+        mutex_unlock(&ctx->lock);
+        return -EINVAL;  /* User space published a bogus head */
+    }
+    
+    /* The framer carries partial records across the wrap point */
+    while (avail) {
+        off = ctx->tail & mask;
+        len = min(avail, VINPUT_RING_DATA_SIZE - off);
+        used = vinput_frame_bytes(ctx->vdev, &ctx->framer, data + off, len);
+        ctx->tail += used;
+        avail -= used;
+        total += used;
+        if (used < len)
+            break;  /* Driver ring full, rest stays queued */
+    }
+    
+    smp_store_release(&ring->tail, ctx->tail);
+    mutex_unlock(&ctx->lock);
+    
+    if (total) {
+        trace_vinput_inject(ctx->vdev, VINPUT_SRC_SHM, total);
+        vinput_schedule_bh(ctx->vdev);
+    }
+    
+    return total;
+}
+
+static long vinput_inject_ioctl(struct file *file, unsigned int cmd,
+                                unsigned long arg)
+{
+    struct vinput_inject_ctx *ctx = file->private_data;
+    struct vinput_ring_info info;
+    
+    switch (cmd) {
+    case VINPUT_IOC_RING_INFO:
+        info.mmap_size = SHM_MMAP_SIZE;
+        info.data_size = VINPUT_RING_DATA_SIZE;
+        info.data_offset = SHM_DATA_OFFSET;
+        info.record_size = ctx->vdev->cls->record_size;
+        if (copy_to_user((void __user *)arg, &info, sizeof(info)))
+            return -EFAULT;
+        return 0;
+    case VINPUT_IOC_KICK:
+        return vinput_inject_kick(ctx);
+    default:
+        return -ENOTTY;
+    }
+}
+
+static int vinput_inject_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    struct vinput_inject_ctx *ctx = file->private_data;
+    
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > SHM_MMAP_SIZE)
+        return -EINVAL;
+    
+    return remap_vmalloc_range(vma, ctx->ring, 0);
+}
+
+/*
+ * .owner is the driver module (see vinput_register), so an open
+ * injection file pins the driver that owns the device
+ */
+static const struct file_operations vinput_inject_fops = {
+    .open           = vinput_inject_open,
+    .release        = vinput_inject_release,
+    .write          = vinput_inject_write,
+    .unlocked_ioctl = vinput_inject_ioctl,
+    .compat_ioctl   = vinput_inject_ioctl,
+    .mmap           = vinput_inject_mmap,
+};
+
+/*
+ * Debugfs Statistics: /sys/kernel/debug/<name>[.N]/
+ * stats   - counters (read)
+ * latency - log2 histogram of enqueue-to-input_sync latency (read)
+ * reset   - write anything to clear all counters
+ * trace   - record/replay trace (read and write, see Record and Replay)
+ */
+static int vinput_stats_show(struct seq_file *m, void *v)
+{
+    struct vinput_device *vdev = m->private;
+    const struct vinput_class *cls = vdev->cls;
+    struct vinput_stats *st = &vdev->stats;
+    u64 runs = READ_ONCE(st->bh_runs);
+    char label[VINPUT_NAME_LEN];
+    
+    snprintf(label, sizeof(label), "%s_injected:", cls->stat_unit);
+    seq_printf(m, "%-17s%llu\n", label, READ_ONCE(st->injected));
+    seq_printf(m, "drops:           %lld\n", atomic64_read(&st->drops));
+    if (cls->ops->record_start) {
+        snprintf(label, sizeof(label), "invalid_%s:", cls->stat_unit);
+        seq_printf(m, "%-17s%lld\n", label, atomic64_read(&st->invalid));
+    }
+    if (cls->record_size > 1)
+        seq_printf(m, "resync_bytes:    %lld\n",
+                   atomic64_read(&st->resync_bytes));
+    seq_printf(m, "max_occupancy:   %u/%u\n", READ_ONCE(st->max_occupancy),
+               kfifo_size(&vdev->fifo));
+    seq_printf(m, "events_reported: %llu\n", READ_ONCE(st->events_reported));
+    snprintf(label, sizeof(label), "skipped_%s:", cls->stat_unit);
+    seq_printf(m, "%-17s%llu\n", label, READ_ONCE(st->redundant));
+    seq_printf(m, "frames:          %llu\n", READ_ONCE(st->frames));
+    seq_printf(m, "bh_runs:         %llu\n", runs);
+    snprintf(label, sizeof(label), "%s_per_run:", cls->stat_unit);
+    seq_printf(m, "%-17s%llu (max %u)\n", label,
+               runs ? div64_u64(READ_ONCE(st->bh_records), runs) : 0,
+               READ_ONCE(st->bh_max_records));
+    
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vinput_stats);
+
+static int vinput_latency_show(struct seq_file *m, void *v)
+{
+    struct vinput_device *vdev = m->private;
+    u64 count;
+    int i;
+    
+    for (i = 0; i < VINPUT_LAT_BUCKETS; i++) {
+        count = READ_ONCE(vdev->stats.latency_hist[i]);
+        if (!count)
+            continue;
+    
+        if (i == VINPUT_LAT_BUCKETS - 1)
+            seq_printf(m, ">= %llu ns: %llu\n", 1ULL << (i - 1), count);
+        else if (i == 0)
+            seq_printf(m, "0 ns: %llu\n", count);
+        else
+            seq_printf(m, "%llu - %llu ns: %llu\n",
+                       1ULL << (i - 1), (1ULL << i) - 1, count);
+    }
+    
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(vinput_latency);
+
+static ssize_t vinput_reset_write(struct file *file, const char __user *buf,
+                                  size_t count, loff_t *ppos)
+{
+    struct vinput_device *vdev = file->private_data;
+    
+    /* Racing updates may survive the reset; good enough for counters */
+    memset(&vdev->stats, 0, sizeof(vdev->stats));
+    
+    return count;
+}
+
+static const struct file_operations vinput_reset_fops = {
+    .owner = THIS_MODULE,
+    .open  = simple_open,
+    .write = vinput_reset_write,
+};
+
+static void vinput_debugfs_init(struct vinput_device *vdev)
+{
+    /* debugfs failures are not fatal, the driver works without it */
+    vdev->debugfs = debugfs_create_dir(vdev->name, NULL);
+    debugfs_create_file("stats", 0400, vdev->debugfs, vdev, &vinput_stats_fops);
+    debugfs_create_file("latency", 0400, vdev->debugfs, vdev, &vinput_latency_fops);
+    debugfs_create_file("reset", 0200, vdev->debugfs, vdev, &vinput_reset_fops);
+    debugfs_create_file("trace", 0600, vdev->debugfs, vdev, &vinput_trace_fops);
+}
+
+/*
+ * Instance Creation
+ * vinput_init() sets up the ring, bottom half, generator and an
+ * allocated input_dev whose drvdata is vdev; on failure nothing is left
+ * to clean up. The driver then fills in the input_dev capabilities and
+ * calls vinput_register(). Once vinput_init() succeeded, vinput_destroy()
+ * releases the instance whether or not it was registered.
+ */
+int vinput_init(struct vinput_device *vdev, const struct vinput_class *cls,
+                unsigned int id)
+{
+    int ret;
+    
+    vdev->cls = cls;
+    vdev->id = id;
+    if (id) {
+        snprintf(vdev->name, VINPUT_NAME_LEN, "%s.%u", cls->name, id);
+        snprintf(vdev->misc_name, VINPUT_NAME_LEN, "%s_inject%u",
+                 cls->short_name, id);
+    } else {
+        strscpy(vdev->name, cls->name, VINPUT_NAME_LEN);
+        snprintf(vdev->misc_name, VINPUT_NAME_LEN, "%s_inject",
+                 cls->short_name);
+    }
+    snprintf(vdev->phys, VINPUT_NAME_LEN, "%s%u/input0", cls->short_name, id);
+    
+    /* Initialize ring and producer lock */
+    spin_lock_init(&vdev->producer_lock);
+    init_waitqueue_head(&vdev->space_wait);
+    vdev->ring = kvmalloc_array(cls->ring_size, sizeof(*vdev->ring),
+                                GFP_KERNEL);
+    if (!vdev->ring)
+        return -ENOMEM;
+    
+    ret = kfifo_init(&vdev->fifo, vdev->ring,
+                     cls->ring_size * sizeof(*vdev->ring));
+    if (ret)
+        goto err_free_ring;
+    
+    /* Start the bottom-half backend */
+    ret = vinput_bh_init(vdev);
+    if (ret)
+        goto err_free_ring;
+    
+    vinput_gen_init(vdev);
+    vinput_rec_init(vdev);
+    
+    /* Allocate input device */
+    vdev->input = input_allocate_device();
+    if (!vdev->input) {
+        pr_err("%s: Failed to allocate input device\n", vdev->name);
+        ret = -ENOMEM;
+        goto err_stop_bh;
+    }
+    
+    vdev->input->phys = vdev->phys;
+    vdev->input->id.bustype = BUS_HOST;
+    
+    /* Sysfs handlers and input callbacks find their instance through drvdata */
+    input_set_drvdata(vdev->input, vdev);
+    
+    return 0;
+
+err_stop_bh:
+    vinput_bh_stop(vdev);
+    mutex_destroy(&vdev->rec.lock);
+    mutex_destroy(&vdev->gen.lock);
+err_free_ring:
+    kvfree(vdev->ring);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(vinput_init);
+
+/*
+ * Register the input device, sysfs groups, injection device and debugfs
+ * statistics. owner is the driver module, pinned by open injection files.
+ */
+int vinput_register(struct vinput_device *vdev, struct module *owner)
+{
+    struct kobject *kobj;
+    int ret;
+    
+    /* Register input device with the input subsystem */
+    ret = input_register_device(vdev->input);
+    if (ret) {
+        pr_err("%s: Failed to register input device\n", vdev->name);
+        return ret;
+    }
+    kobj = &vdev->input->dev.kobj;
+    
+    /* Create sysfs interface for injection and the generator */
+    ret = sysfs_create_groups(kobj, vdev->cls->groups);
+    if (ret) {
+        pr_err("%s: Failed to create sysfs group\n", vdev->name);
+        goto err_unregister_input;
+    }
+    
+    ret = sysfs_create_group(kobj, &vinput_gen_group);
+    if (ret) {
+        pr_err("%s: Failed to create generator sysfs group\n", vdev->name);
+        goto err_remove_sysfs;
+    }
+    
+    ret = sysfs_create_group(kobj, &vinput_rec_group);
+    if (ret) {
+        pr_err("%s: Failed to create recorder sysfs group\n", vdev->name);
+        goto err_remove_gen;
+    }
+    
+    /* Create character device for binary and shared-ring injection */
+    vdev->fops = vinput_inject_fops;
+    vdev->fops.owner = owner;
+    vdev->misc.minor = MISC_DYNAMIC_MINOR;
+    vdev->misc.name = vdev->misc_name;
+    vdev->misc.fops = &vdev->fops;
+    vdev->misc.mode = 0600;
+    ret = misc_register(&vdev->misc);
+    if (ret) {
+        pr_err("%s: Failed to register injection device\n", vdev->name);
+        goto err_remove_rec;
+    }
+    
+    vinput_debugfs_init(vdev);
+    vdev->registered = true;
+    
+    pr_info("%s: Successfully registered as %s\n", vdev->name,
+            dev_name(&vdev->input->dev));
+    pr_info("%s: Inject via: /sys/devices/virtual/input/%s/%s\n", vdev->name,
+            dev_name(&vdev->input->dev), vdev->cls->groups[0]->attrs[0]->name);
+    pr_info("%s: Binary injection via: /dev/%s\n", vdev->name, vdev->misc.name);
+    
+    return 0;
+
+err_remove_rec:
+    sysfs_remove_group(kobj, &vinput_rec_group);
+err_remove_gen:
+    sysfs_remove_group(kobj, &vinput_gen_group);
+err_remove_sysfs:
+    sysfs_remove_groups(kobj, vdev->cls->groups);
+err_unregister_input:
+    input_unregister_device(vdev->input);
+    vdev->input = NULL;  /* input_unregister_device frees it */
+    return ret;
+}
+EXPORT_SYMBOL_GPL(vinput_register);
+
+void vinput_destroy(struct vinput_device *vdev)
+{
+    if (vdev->registered) {
+        /* Remove statistics */
+        debugfs_remove_recursive(vdev->debugfs);
+    
+        /* Remove character device */
+        misc_deregister(&vdev->misc);
+    
+        /* Remove sysfs interface */
+        sysfs_remove_group(&vdev->input->dev.kobj, &vinput_rec_group);
+        sysfs_remove_group(&vdev->input->dev.kobj, &vinput_gen_group);
+        sysfs_remove_groups(&vdev->input->dev.kobj, vdev->cls->groups);
+    }
+    
+    /* Stop the generator and replay, then bottom-half processing */
+    hrtimer_cancel(&vdev->gen.timer);
+    mutex_destroy(&vdev->gen.lock);
+    hrtimer_cancel(&vdev->rec.timer);
+    mutex_destroy(&vdev->rec.lock);
+    vfree(vdev->rec.buf);
+    vinput_bh_stop(vdev);
+    
+    /* Unregister input device (this also frees it) */
+    if (vdev->registered)
+        input_unregister_device(vdev->input);
+    else if (vdev->input)
+        input_free_device(vdev->input);
+    
+    kvfree(vdev->ring);
+}
+EXPORT_SYMBOL_GPL(vinput_destroy);
+
+#if IS_ENABLED(CONFIG_VINPUT_KUNIT_TEST)
+#include "vinput_core_test.c"
+#endif
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("OS Course Project");
+MODULE_DESCRIPTION("Shared core of the virtual input drivers");
+MODULE_VERSION("1.0");
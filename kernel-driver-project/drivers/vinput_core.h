@@ -0,0 +1,250 @@
+/*
+ * vinput_core.h - Shared plumbing of the virtual input drivers
+ *
+ * The keyboard and mouse drivers only differ in how they decode records
+ * (scan codes, mouse packets) into input events. Everything else lives in
+ * the vinput_core module and is written once:
+ *
+ * - kfifo ring of timestamped records with overflow policies
+ * - budgeted bottom half (tasklet, workqueue or kthread)
+ * - sysfs and character device injection, with a resynchronizing framer
+ *   and the mmap'd shared ring of vinput_inject.h
+ * - hrtimer load generator (generator/ in sysfs)
+ * - capture and timed replay of injected streams (recorder/ in sysfs)
+ * - debugfs statistics and the vinput:* tracepoints
+ *
+ * A driver describes its device type with a struct vinput_class and its
+ * vinput_ops decoder callbacks, embeds a struct vinput_device in every
+ * instance and sets up the input_dev capabilities between vinput_init()
+ * and vinput_register().
+ *
+ * License: MIT
+ */
+
+#ifndef _VINPUT_CORE_H
+#define _VINPUT_CORE_H
+
+#include <linux/types.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/input.h>
+#include <linux/interrupt.h>
+#include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/miscdevice.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/sysfs.h>
+
+#define VINPUT_RECORD_MAX      7    /* Longest record (hires mouse packet) */
+#define VINPUT_NAME_LEN        32
+#define VINPUT_MAX_DEVICES     64   /* Upper bound for num_devices */
+#define VINPUT_RING_SIZE_MIN   16
+#define VINPUT_RING_SIZE_MAX   65536
+#define VINPUT_LAT_BUCKETS     32   /* log2(ns) buckets, last is open-ended */
+#define VINPUT_GEN_PATTERN_MAX (64 * VINPUT_RECORD_MAX)  /* Bytes in a generator pattern */
+
+/* Injection sources, reported by the vinput_inject tracepoint */
+#define VINPUT_SRC_SYSFS  0
+#define VINPUT_SRC_WRITE  1  /* write() on the injection device */
+#define VINPUT_SRC_SHM    2  /* Shared ring, VINPUT_IOC_KICK */
+#define VINPUT_SRC_GEN    3  /* In-kernel hrtimer generator */
+#define VINPUT_SRC_REPLAY 4  /* Recorder replaying a trace */
+
+/* Full-ring policies (overflow parameter) */
+enum vinput_overflow {
+    VINPUT_DROP_NEWEST,
+    VINPUT_DROP_OLDEST,
+    VINPUT_BLOCK,
+};
+
+/* Bottom-half backends (bh_mode parameter) */
+enum vinput_bh_mode {
+    VINPUT_BH_TASKLET,
+    VINPUT_BH_WORKQUEUE,
+    VINPUT_BH_KTHREAD,
+};
+
+/* Ring entry: one record plus its enqueue time for latency accounting */
+struct vinput_entry {
+    u64 enqueue_ns;
+    unsigned char data[VINPUT_RECORD_MAX];
+};
+
+/*
+ * Performance counters
+ * Producer-side fields are updated under producer_lock, consumer-side
+ * fields only by the bottom half; the atomics can come from any writer.
+ */
+struct vinput_stats {
+    /* Producer side */
+    u64 injected;                   /* Records buffered */
+    u32 max_occupancy;
+    atomic64_t drops;               /* Records lost to a full ring */
+    atomic64_t invalid;             /* Rejected by record_start at injection */
+    atomic64_t resync_bytes;        /* Raw bytes skipped to find a record start */
+    /* Consumer side */
+    u64 events_reported;            /* Maintained by the decoder */
+    u64 redundant;                  /* Records that changed no state, not reported */
+    u64 frames;                     /* SYN_REPORT frames, see vinput_sync_frame() */
+    u64 bh_runs;
+    u64 bh_records;
+    u32 bh_max_records;
+    u64 latency_hist[VINPUT_LAT_BUCKETS];  /* Enqueue of oldest record -> input_sync */
+};
+
+/*
+ * Synthetic load generator
+ * Configuration only changes while stopped, so the timer callback reads
+ * it without locking; the callback is the only writer of the counters.
+ */
+struct vinput_gen {
+    struct hrtimer timer;
+    struct mutex lock;                /* Serializes the sysfs controls */
+    bool running;
+    unsigned int rate;                /* Records per second, 0 = flat-out */
+    u64 period_ns;
+    unsigned char pattern[VINPUT_GEN_PATTERN_MAX];
+    unsigned int pattern_len;         /* In records, 0 = ops->gen_record */
+    u64 seq;                          /* Records delivered to the ring */
+    u64 dropped;                      /* Records the ring refused */
+    u64 start_ns, stop_ns;
+};
+
+/* Recorder states (recorder/mode) */
+enum vinput_rec_state {
+    VINPUT_REC_IDLE,
+    VINPUT_REC_CAPTURE,
+    VINPUT_REC_REPLAY,
+};
+
+/*
+ * Record and replay
+ * The trace buffer is allocated before a capture or load starts and is
+ * only written by the producers (under producer_lock) while capturing,
+ * and only read by the timer callback while replaying.
+ */
+struct vinput_recorder {
+    struct hrtimer timer;
+    struct mutex lock;                /* Serializes the controls and trace I/O */
+    int state;                        /* enum vinput_rec_state */
+    struct vinput_trace_record *buf;  /* vmalloc'd, capacity records */
+    unsigned int capacity;
+    unsigned int count;               /* Records in buf */
+    unsigned int loaded;              /* Records announced by a loaded header */
+    unsigned int pos;                 /* Next record to replay */
+    unsigned int speed;               /* Replay speed in percent, 0 = flat-out */
+    u64 overrun;                      /* Captured records that did not fit */
+    u64 dropped;                      /* Replayed records the ring refused */
+    u64 start_ns;
+};
+
+struct vinput_device;
+
+/*
+ * Protocol decoder callbacks
+ * process and flush run in the bottom half, gen_record in hardirq
+ * context from the generator timer. Only process is required.
+ */
+struct vinput_ops {
+    /* Decode count records in ring order and report their events */
+    void (*process)(struct vinput_device *vdev,
+                    const struct vinput_entry *entries, unsigned int count);
+    /* End of a bottom-half run: sync whatever frame is still open */
+    void (*flush)(struct vinput_device *vdev);
+    /* Can this byte start a record? NULL accepts every byte */
+    bool (*record_start)(unsigned char byte);
+    /* Generator record number seq when no pattern is set */
+    void (*gen_record)(struct vinput_device *vdev, u64 seq,
+                       unsigned char *record);
+    /* The generator was stopped, e.g. to release held keys */
+    void (*gen_stop)(struct vinput_device *vdev);
+};
+
+/* Load-time module parameters of one driver, checked by vinput_setup() */
+struct vinput_params {
+    unsigned int ring_size;
+    const char *overflow;
+    const char *bh_mode;
+    const unsigned int *bh_budget;    /* Module parameter, writable at runtime */
+    int bh_cpu;
+    bool bh_spread;
+};
+
+/*
+ * One device type
+ * The driver fills in the descriptive fields, vinput_setup() the rest.
+ */
+struct vinput_class {
+    const char *name;                 /* Driver name and log prefix */
+    const char *short_name;           /* vkbd: vkbd_inject, vkbd_bh/N, vkbd0/input0 */
+    const char *unit;                 /* Records in log messages ("scan codes") */
+    const char *stat_unit;            /* Records in stats keys ("bytes") */
+    unsigned int record_size;         /* Bytes per record */
+    const struct vinput_ops *ops;
+    const struct attribute_group **groups;  /* Driver sysfs groups, injection first */
+    /* Resolved by vinput_setup() */
+    unsigned int ring_size;           /* Power of two */
+    int overflow;                     /* enum vinput_overflow */
+    int bh_mode;                      /* enum vinput_bh_mode */
+    int bh_cpu;
+    bool bh_spread;
+    const unsigned int *bh_budget;
+};
+
+/*
+ * One instance, embedded in the driver's device structure
+ * Instance 0 keeps the unsuffixed names; instance N appends N.
+ */
+struct vinput_device {
+    const struct vinput_class *cls;
+    unsigned int id;
+    char name[VINPUT_NAME_LEN];       /* Log prefix and debugfs directory */
+    char phys[VINPUT_NAME_LEN];
+    char misc_name[VINPUT_NAME_LEN];
+    struct input_dev *input;
+    int bh_cpu;
+    struct tasklet_struct tasklet;
+    struct work_struct work;
+    struct task_struct *bh_thread;
+    unsigned long bh_flags;           /* Pending bit for the kthread */
+    spinlock_t producer_lock;         /* Serializes concurrent writers only */
+    DECLARE_KFIFO_PTR(fifo, struct vinput_entry);
+    struct vinput_entry *ring;        /* kfifo storage, ring_size entries */
+    wait_queue_head_t space_wait;     /* Writers blocked by VINPUT_BLOCK */
+    struct miscdevice misc;
+    struct file_operations fops;      /* Injection fops owned by the driver */
+    struct vinput_stats stats;
+    struct vinput_gen gen;
+    struct vinput_recorder rec;
+    struct dentry *debugfs;
+    bool registered;
+};
+
+/* Setup and teardown */
+int vinput_setup(struct vinput_class *cls, const struct vinput_params *params);
+int vinput_init(struct vinput_device *vdev, const struct vinput_class *cls,
+                unsigned int id);
+int vinput_register(struct vinput_device *vdev, struct module *owner);
+void vinput_destroy(struct vinput_device *vdev);
+void vinput_hrtimer_init(struct hrtimer *timer,
+                         enum hrtimer_restart (*fn)(struct hrtimer *),
+                         enum hrtimer_mode mode);
+
+/* Producer side */
+unsigned int vinput_push(struct vinput_device *vdev,
+                         const unsigned char *records, unsigned int count);
+int vinput_inject(struct vinput_device *vdev, const unsigned char *records,
+                  unsigned int count);
+ssize_t vinput_store_text(struct vinput_device *vdev, const char *buf,
+                          size_t count, bool single);
+ssize_t vinput_store_raw(struct vinput_device *vdev, const char *buf,
+                         size_t count);
+void vinput_schedule_bh(struct vinput_device *vdev);
+
+/* Consumer side */
+u64 vinput_sync_frame(struct vinput_device *vdev, u64 start_ns, u64 last_ns);
+
+#endif /* _VINPUT_CORE_H */
@@ -0,0 +1,405 @@
+/*
+ * vinput_core_test.c - KUnit suites for the ring, bottom half and framer
+ *
+ * Included at the end of vinput_core.c when CONFIG_VINPUT_KUNIT_TEST is
+ * set, so the static helpers are reachable. Every case runs on its own
+ * unregistered instance of a 3-byte record class that, like PS/2, marks
+ * a record start with bit 3. It is driven synchronously: records go in
+ * with vinput_push() or the framer and come out with vinput_bh_run(), no
+ * bottom-half backend is ever scheduled.
+ *
+ * vinput_core_bench times push and drain over several million records
+ * and reports ns/record with kunit_info().
+ *
+ * License: MIT
+ */
+
+#include <kunit/test.h>
+
+#define TEST_RECORD_SIZE  3
+#define TEST_RECORD_START 0x08           /* Like PS2_ALWAYS_ONE */
+#define TEST_RING_SIZE    VINPUT_RING_SIZE_MIN
+#define TEST_SEEN_MAX     64
+
+#define BENCH_RING_SIZE   1024
+#define BENCH_RECORDS     (4U << 20)
+
+/* One instance plus what its decoder callbacks saw */
+struct vinput_test_dev {
+    struct vinput_device core;
+    struct vinput_class cls;
+    unsigned int budget;              /* cls.bh_budget points here */
+    unsigned char seen[TEST_SEEN_MAX];  /* data[1] of processed records */
+    unsigned int count;               /* Records processed */
+    unsigned int process_calls;
+    unsigned int flush_calls;
+    u64 sum;                          /* Benchmark checksum */
+};
+
+#define to_test_dev(vdev) container_of(vdev, struct vinput_test_dev, core)
+
+static void vinput_test_process(struct vinput_device *vdev,
+                                const struct vinput_entry *entries,
+                                unsigned int count)
+{
+    struct vinput_test_dev *t = to_test_dev(vdev);
+    unsigned int i;
+    
+    for (i = 0; i < count; i++) {
+        if (t->count < TEST_SEEN_MAX)
+            t->seen[t->count] = entries[i].data[1];
+        t->sum += entries[i].data[1];
+        t->count++;
+    }
+    t->process_calls++;
+}
+
+static void vinput_test_flush(struct vinput_device *vdev)
+{
+    to_test_dev(vdev)->flush_calls++;
+}
+
+static bool vinput_test_record_start(unsigned char byte)
+{
+    return byte & TEST_RECORD_START;
+}
+
+static const struct vinput_ops vinput_test_ops = {
+    .process      = vinput_test_process,
+    .flush        = vinput_test_flush,
+    .record_start = vinput_test_record_start,
+};
+
+/* Set up an instance with the given ring; released by vinput_test_exit() */
+static struct vinput_test_dev *vinput_test_create(struct kunit *test,
+                                                  unsigned int ring_size,
+                                                  const char *overflow)
+{
+    struct vinput_test_dev *t;
+    struct vinput_params params = {
+        .ring_size = ring_size,
+        .overflow  = overflow,
+        .bh_mode   = "workqueue",
+        .bh_cpu    = -1,
+    };
+    
+    t = kunit_kzalloc(test, sizeof(*t), GFP_KERNEL);
+    KUNIT_ASSERT_NOT_NULL(test, t);
+    
+    t->cls.name = "vinput_test";
+    t->cls.short_name = "vtest";
+    t->cls.unit = "records";
+    t->cls.stat_unit = "records";
+    t->cls.record_size = TEST_RECORD_SIZE;
+    t->cls.ops = &vinput_test_ops;
+    params.bh_budget = &t->budget;
+    
+    KUNIT_ASSERT_EQ(test, vinput_setup(&t->cls, &params), 0);
+    KUNIT_ASSERT_EQ(test, vinput_init(&t->core, &t->cls, 0), 0);
+    test->priv = t;
+    return t;
+}
+
+static void vinput_test_exit(struct kunit *test)
+{
+    struct vinput_test_dev *t = test->priv;
+    
+    if (t)
+        vinput_destroy(&t->core);
+}
+
+/* Fill count records whose data[1] runs from first */
+static void vinput_test_records(unsigned char *buf, unsigned int count,
+                                unsigned int first)
+{
+    unsigned int i;
+    
+    for (i = 0; i < count; i++) {
+        buf[i * TEST_RECORD_SIZE] = TEST_RECORD_START;
+        buf[i * TEST_RECORD_SIZE + 1] = first + i;
+        buf[i * TEST_RECORD_SIZE + 2] = 0;
+    }
+}
+
+static void vinput_test_expect_seen(struct kunit *test,
+                                    struct vinput_test_dev *t,
+                                    unsigned int count, unsigned int first)
+{
+    unsigned int i;
+    
+    KUNIT_ASSERT_EQ(test, t->count, count);
+    for (i = 0; i < count; i++)
+        KUNIT_EXPECT_EQ(test, t->seen[i], (unsigned char)(first + i));
+}
+
+/*
+ * Ring Buffer
+ */
+static void vinput_test_push_drop_newest(struct kunit *test)
+{
+    struct vinput_test_dev *t;
+    unsigned char buf[20 * TEST_RECORD_SIZE];
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    vinput_test_records(buf, 20, 0);
+    
+    /* A full ring refuses the rest; the caller decides what that means */
+    KUNIT_EXPECT_EQ(test, vinput_push(&t->core, buf, 20), TEST_RING_SIZE);
+    KUNIT_EXPECT_EQ(test, vinput_push(&t->core, buf, 1), 0);
+    KUNIT_EXPECT_EQ(test, t->core.stats.injected, (u64)TEST_RING_SIZE);
+    KUNIT_EXPECT_EQ(test, t->core.stats.max_occupancy, TEST_RING_SIZE);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.drops), 0);
+    
+    KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    vinput_test_expect_seen(test, t, TEST_RING_SIZE, 0);
+}
+
+static void vinput_test_push_drop_oldest(struct kunit *test)
+{
+    struct vinput_test_dev *t;
+    unsigned char buf[20 * TEST_RECORD_SIZE];
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-oldest");
+    vinput_test_records(buf, 20, 0);
+    
+    /* Everything is queued, the four oldest records are overwritten */
+    KUNIT_EXPECT_EQ(test, vinput_push(&t->core, buf, 20), 20);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.drops), 4);
+    KUNIT_EXPECT_EQ(test, t->core.stats.max_occupancy, TEST_RING_SIZE);
+    
+    KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    vinput_test_expect_seen(test, t, TEST_RING_SIZE, 4);
+}
+
+static void vinput_test_ring_wrap(struct kunit *test)
+{
+    struct vinput_test_dev *t;
+    unsigned char buf[10 * TEST_RECORD_SIZE];
+    unsigned int i;
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    
+    /* Indices run past the ring size several times */
+    for (i = 0; i < 5; i++) {
+        vinput_test_records(buf, 10, i * 10);
+        KUNIT_ASSERT_EQ(test, vinput_push(&t->core, buf, 10), 10);
+        KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    }
+    vinput_test_expect_seen(test, t, 50, 0);
+    KUNIT_EXPECT_EQ(test, t->core.stats.max_occupancy, 10);
+}
+
+static void vinput_test_bh_budget(struct kunit *test)
+{
+    struct vinput_test_dev *t;
+    unsigned char buf[12 * TEST_RECORD_SIZE];
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    t->budget = 5;
+    vinput_test_records(buf, 12, 0);
+    KUNIT_ASSERT_EQ(test, vinput_push(&t->core, buf, 12), 12);
+    
+    /* Each run stops at the budget and reports what is left */
+    KUNIT_EXPECT_TRUE(test, vinput_bh_run(&t->core));
+    KUNIT_EXPECT_EQ(test, t->count, 5);
+    KUNIT_EXPECT_EQ(test, t->flush_calls, 1);
+    KUNIT_EXPECT_TRUE(test, vinput_bh_run(&t->core));
+    KUNIT_EXPECT_EQ(test, t->count, 10);
+    KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    vinput_test_expect_seen(test, t, 12, 0);
+    
+    KUNIT_EXPECT_EQ(test, t->flush_calls, 3);
+    KUNIT_EXPECT_EQ(test, t->core.stats.bh_runs, 3);
+    KUNIT_EXPECT_EQ(test, t->core.stats.bh_records, 12);
+    KUNIT_EXPECT_EQ(test, t->core.stats.bh_max_records, 5);
+    
+    /* An empty run still closes the decoder's frame */
+    KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    KUNIT_EXPECT_EQ(test, t->flush_calls, 4);
+}
+
+static void vinput_test_bh_chunks(struct kunit *test)
+{
+    struct vinput_test_dev *t;
+    unsigned char buf[40 * TEST_RECORD_SIZE];
+    
+    /* Unlimited budget: the ring is drained in DRAIN_CHUNK spans */
+    t = vinput_test_create(test, 64, "drop-newest");
+    vinput_test_records(buf, 40, 0);
+    KUNIT_ASSERT_EQ(test, vinput_push(&t->core, buf, 40), 40);
+    
+    KUNIT_EXPECT_FALSE(test, vinput_bh_run(&t->core));
+    KUNIT_EXPECT_EQ(test, t->process_calls, DIV_ROUND_UP(40, DRAIN_CHUNK));
+    vinput_test_expect_seen(test, t, 40, 0);
+}
+
+/*
+ * Raw Byte Framer
+ */
+static void vinput_test_framer_resync(struct kunit *test)
+{
+    static const unsigned char bytes[] = {
+        0x00, 0x01,                   /* Junk before the first start */
+        0x08, 0x01, 0x00,
+        0x07,                         /* Lost byte between records */
+        0x09, 0x02, 0x00,
+        0x0A, 0x03, 0x00,
+    };
+    struct vinput_framer fr = { };
+    struct vinput_test_dev *t;
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    
+    KUNIT_EXPECT_EQ(test, vinput_frame_bytes(&t->core, &fr, bytes,
+                                             sizeof(bytes)), sizeof(bytes));
+    KUNIT_EXPECT_EQ(test, fr.idx, 0);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.resync_bytes), 3);
+    
+    vinput_bh_run(&t->core);
+    vinput_test_expect_seen(test, t, 3, 1);
+}
+
+static void vinput_test_framer_split(struct kunit *test)
+{
+    static const unsigned char bytes[] = {
+        0x08, 0x01, 0x00, 0x08, 0x02, 0x00, 0x08, 0x03, 0x00,
+    };
+    struct vinput_framer fr = { };
+    struct vinput_test_dev *t;
+    unsigned int i;
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    
+    /* Records split across writes are reassembled */
+    for (i = 0; i < sizeof(bytes); i++)
+        KUNIT_EXPECT_EQ(test, vinput_frame_bytes(&t->core, &fr,
+                                                 &bytes[i], 1), 1);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.resync_bytes), 0);
+    
+    vinput_bh_run(&t->core);
+    vinput_test_expect_seen(test, t, 3, 1);
+}
+
+static void vinput_test_framer_full(struct kunit *test)
+{
+    unsigned char buf[20 * TEST_RECORD_SIZE + 1];
+    struct vinput_framer fr = { };
+    struct vinput_test_dev *t;
+    
+    t = vinput_test_create(test, TEST_RING_SIZE, "drop-newest");
+    buf[0] = 0x00;
+    vinput_test_records(buf + 1, 20, 0);
+    
+    /* Consumption stops right after the last record that fit */
+    KUNIT_EXPECT_EQ(test, vinput_frame_bytes(&t->core, &fr, buf, sizeof(buf)),
+                    1 + TEST_RING_SIZE * TEST_RECORD_SIZE);
+    KUNIT_EXPECT_EQ(test, fr.idx, 0);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.resync_bytes), 1);
+    
+    /* A full ring takes nothing and leaves the framer as it was */
+    KUNIT_EXPECT_EQ(test, vinput_frame_bytes(&t->core, &fr,
+                                             buf + 1 + TEST_RING_SIZE * TEST_RECORD_SIZE,
+                                             TEST_RECORD_SIZE), 0);
+    KUNIT_EXPECT_EQ(test, fr.idx, 0);
+    
+    vinput_bh_run(&t->core);
+    vinput_test_expect_seen(test, t, TEST_RING_SIZE, 0);
+}
+
+static struct kunit_case vinput_core_test_cases[] = {
+    KUNIT_CASE(vinput_test_push_drop_newest),
+    KUNIT_CASE(vinput_test_push_drop_oldest),
+    KUNIT_CASE(vinput_test_ring_wrap),
+    KUNIT_CASE(vinput_test_bh_budget),
+    KUNIT_CASE(vinput_test_bh_chunks),
+    KUNIT_CASE(vinput_test_framer_resync),
+    KUNIT_CASE(vinput_test_framer_split),
+    KUNIT_CASE(vinput_test_framer_full),
+    {}
+};
+
+static struct kunit_suite vinput_core_test_suite = {
+    .name       = "vinput_core",
+    .exit       = vinput_test_exit,
+    .test_cases = vinput_core_test_cases,
+};
+
+/*
+ * Microbenchmarks
+ * Push a ring's worth in FRAME_BATCH pushes, then drain it in one run,
+ * until BENCH_RECORDS have gone through.
+ */
+static void vinput_bench_push_drain(struct kunit *test)
+{
+    unsigned char buf[FRAME_BATCH * TEST_RECORD_SIZE];
+    struct vinput_test_dev *t;
+    u64 push_ns = 0, drain_ns = 0, t0, t1, expect = 0;
+    unsigned int done, i;
+    
+    t = vinput_test_create(test, BENCH_RING_SIZE, "drop-newest");
+    vinput_test_records(buf, FRAME_BATCH, 0);
+    for (i = 0; i < FRAME_BATCH; i++)
+        expect += buf[i * TEST_RECORD_SIZE + 1];
+    
+    for (done = 0; done < BENCH_RECORDS; done += BENCH_RING_SIZE) {
+        t0 = ktime_get_ns();
+        for (i = 0; i < BENCH_RING_SIZE; i += FRAME_BATCH)
+            vinput_push(&t->core, buf, FRAME_BATCH);
+        t1 = ktime_get_ns();
+        vinput_bh_run(&t->core);
+        drain_ns += ktime_get_ns() - t1;
+        push_ns += t1 - t0;
+        cond_resched();
+    }
+    
+    KUNIT_EXPECT_EQ(test, t->count, BENCH_RECORDS);
+    KUNIT_EXPECT_EQ(test, t->sum, expect * (BENCH_RECORDS / FRAME_BATCH));
+    kunit_info(test, "%u records: push %llu ns/record, drain %llu ns/record\n",
+               BENCH_RECORDS, div_u64(push_ns, BENCH_RECORDS),
+               div_u64(drain_ns, BENCH_RECORDS));
+}
+
+/* The raw byte path: frame a stream with one junk byte per record */
+static void vinput_bench_frame(struct kunit *test)
+{
+    unsigned char buf[FRAME_BATCH * (TEST_RECORD_SIZE + 1)];
+    struct vinput_framer fr = { };
+    struct vinput_test_dev *t;
+    u64 frame_ns = 0, t0;
+    unsigned int done, i;
+    
+    t = vinput_test_create(test, BENCH_RING_SIZE, "drop-newest");
+    for (i = 0; i < FRAME_BATCH; i++) {
+        buf[i * 4] = 0x00;
+        vinput_test_records(&buf[i * 4 + 1], 1, i);
+    }
+    
+    for (done = 0; done < BENCH_RECORDS; done += BENCH_RING_SIZE) {
+        t0 = ktime_get_ns();
+        for (i = 0; i < BENCH_RING_SIZE; i += FRAME_BATCH)
+            vinput_frame_bytes(&t->core, &fr, buf, sizeof(buf));
+        frame_ns += ktime_get_ns() - t0;
+        vinput_bh_run(&t->core);
+        cond_resched();
+    }
+    
+    KUNIT_EXPECT_EQ(test, t->count, BENCH_RECORDS);
+    KUNIT_EXPECT_EQ(test, atomic64_read(&t->core.stats.resync_bytes),
+                    (s64)BENCH_RECORDS);
+    kunit_info(test, "%u records: frame %llu ns/record\n", BENCH_RECORDS,
+               div_u64(frame_ns, BENCH_RECORDS));
+}
+
+static struct kunit_case vinput_core_bench_cases[] = {
+    KUNIT_CASE(vinput_bench_push_drain),
+    KUNIT_CASE(vinput_bench_frame),
+    {}
+};
+
+static struct kunit_suite vinput_core_bench_suite = {
+    .name       = "vinput_core_bench",
+    .exit       = vinput_test_exit,
+    .test_cases = vinput_core_bench_cases,
+};
+
+kunit_test_suites(&vinput_core_test_suite, &vinput_core_bench_suite);
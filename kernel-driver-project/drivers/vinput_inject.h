@@ -0,0 +1,78 @@
+/*
+ * vinput_inject.h - Character device injection interface
+ *
+ * Shared between the virtual keyboard/mouse drivers and user-space tools.
+ * Each driver registers a misc device (/dev/vkbd_inject, /dev/vmouse_inject)
+ * that accepts:
+ *
+ * - write(): raw binary scan codes (keyboard) or a stream of 3-byte packets
+ *   (mouse, resynchronized on the status byte)
+ * - mmap():  a per-open shared ring that user space fills directly
+ * - ioctl(VINPUT_IOC_KICK): doorbell that makes the driver consume the
+ *   shared ring and schedule its bottom half
+ *
+ * Shared ring protocol (single producer per open file):
+ *   1. ioctl(VINPUT_IOC_RING_INFO) to learn the mapping size
+ *   2. mmap() the whole region; the header sits at offset 0 and the data
+ *      area at header->data_offset
+ *   3. Write records at data[head & (size - 1)], then publish the new head
+ *      with a release store
+ *   4. ioctl(VINPUT_IOC_KICK) returns the number of bytes consumed; the
+ *      driver publishes its progress in header->tail. Bytes that did not
+ *      fit into the driver ring stay queued for the next kick.
+ *
+ * Record/replay traces (debugfs <driver>/trace, see README):
+ *   A struct vinput_trace_header followed by header.count fixed-size
+ *   struct vinput_trace_record entries, in time order. The same layout
+ *   is read back after a capture and written to load a replay.
+ *
+ * License: MIT
+ */
+
+#ifndef _VINPUT_INJECT_H
+#define _VINPUT_INJECT_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Data area size in bytes (power of two, free-running indices are masked) */
+#define VINPUT_RING_DATA_SIZE (64 * 1024)
+
+/* Header at the start of the mmap'd region */
+struct vinput_ring_header {
+    __u32 head;         /* Producer index, written by user space */
+    __u32 tail;         /* Consumer index, written by the driver */
+    __u32 size;         /* Data area size in bytes */
+    __u32 data_offset;  /* Offset of data area from start of mapping */
+};
+
+/* Returned by VINPUT_IOC_RING_INFO */
+struct vinput_ring_info {
+    __u32 mmap_size;    /* Length to pass to mmap() */
+    __u32 data_size;    /* Same as header->size */
+    __u32 data_offset;  /* Same as header->data_offset */
+    __u32 record_size;  /* Bytes per event: 1 (keyboard) or 3 (mouse) */
+};
+
+/* Record/replay trace file */
+#define VINPUT_TRACE_MAGIC   0x56545243  /* "CRTV" on little-endian */
+#define VINPUT_TRACE_VERSION 1
+
+struct vinput_trace_header {
+    __u32 magic;        /* VINPUT_TRACE_MAGIC */
+    __u16 version;      /* VINPUT_TRACE_VERSION */
+    __u16 record_size;  /* Bytes of data used per record, must match the device */
+    __u32 count;        /* Records that follow */
+    __u32 reserved;     /* Zero */
+};
+
+struct vinput_trace_record {
+    __u64 time_ns;      /* Since the start of the capture */
+    __u8 data[8];       /* One scan code or packet, zero-padded */
+};
+
+#define VINPUT_IOC_MAGIC     'v'
+#define VINPUT_IOC_RING_INFO _IOR(VINPUT_IOC_MAGIC, 0x00, struct vinput_ring_info)
+#define VINPUT_IOC_KICK      _IO(VINPUT_IOC_MAGIC, 0x01)
+
+#endif /* _VINPUT_INJECT_H */
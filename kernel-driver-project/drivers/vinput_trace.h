@@ -0,0 +1,87 @@
+/*
+ * vinput_trace.h - Tracepoints of the shared vinput core
+ *
+ * Injection and ring events of every virtual input device, tagged with
+ * the instance name. Decoding and reporting are traced by the drivers
+ * (vkbd:*, vmouse:*). Capture them with ftrace or perf:
+ *
+ *   echo 1 > /sys/kernel/tracing/events/vinput/enable
+ *   perf record -e 'vinput:*' -a
+ *
+ * License: MIT
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM vinput
+
+#if !defined(_VINPUT_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _VINPUT_TRACE_H
+
+#include <linux/tracepoint.h>
+#include "vinput_core.h"
+
+#define show_vinput_source(src)                       \
+    __print_symbolic(src,                             \
+                     { VINPUT_SRC_SYSFS,  "sysfs" },  \
+                     { VINPUT_SRC_WRITE,  "write" },  \
+                     { VINPUT_SRC_SHM,    "shm" },    \
+                     { VINPUT_SRC_GEN,    "gen" },    \
+                     { VINPUT_SRC_REPLAY, "replay" })
+
+TRACE_EVENT(vinput_inject,
+    TP_PROTO(const struct vinput_device *vdev, int source, unsigned int bytes),
+    TP_ARGS(vdev, source, bytes),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(int, source)
+        __field(unsigned int, bytes)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->source = source;
+        __entry->bytes = bytes;
+    ),
+    TP_printk("%s source=%s bytes=%u", __entry->dev,
+              show_vinput_source(__entry->source), __entry->bytes)
+);
+
+TRACE_EVENT(vinput_ring_push,
+    TP_PROTO(const struct vinput_device *vdev, unsigned int pushed,
+             unsigned int len),
+    TP_ARGS(vdev, pushed, len),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(unsigned int, pushed)
+        __field(unsigned int, len)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->pushed = pushed;
+        __entry->len = len;
+    ),
+    TP_printk("%s pushed=%u occupancy=%u", __entry->dev, __entry->pushed,
+              __entry->len)
+);
+
+TRACE_EVENT(vinput_ring_drop,
+    TP_PROTO(const struct vinput_device *vdev, unsigned int dropped),
+    TP_ARGS(vdev, dropped),
+    TP_STRUCT__entry(
+        __array(char, dev, VINPUT_NAME_LEN)
+        __field(unsigned int, dropped)
+    ),
+    TP_fast_assign(
+        memcpy(__entry->dev, vdev->name, VINPUT_NAME_LEN);
+        __entry->dropped = dropped;
+    ),
+    TP_printk("%s dropped=%u", __entry->dev, __entry->dropped)
+);
+
+#endif /* _VINPUT_TRACE_H */
+
+/* Out-of-tree module: the header lives next to the source */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE vinput_trace
+#include <trace/define_trace.h>
@@ -22,7 +22,7 @@ if [ "$EUID" -ne 0 ]; then
 fi
 
 # Check if modules are built
-if [ ! -f "$SCRIPT_DIR/drivers/keyboard_driver.ko" ] || [ ! -f "$SCRIPT_DIR/drivers/mouse_driver.ko" ]; then
+if [ ! -f "$SCRIPT_DIR/drivers/vinput_core.ko" ] || [ ! -f "$SCRIPT_DIR/drivers/keyboard_driver.ko" ] || [ ! -f "$SCRIPT_DIR/drivers/mouse_driver.ko" ]; then
     echo -e "${YELLOW}Warning: Kernel modules not found. Building now...${NC}"
     cd "$SCRIPT_DIR"
     make modules
@@ -41,7 +41,21 @@ if lsmod | grep -q "mouse_driver"; then
     rmmod mouse_driver || true
 fi
 
+if lsmod | grep -q "vinput_core"; then
+    echo "Unloading existing vinput_core..."
+    rmmod vinput_core || true
+fi
+
 echo ""
+echo "Loading shared core..."
+insmod "$SCRIPT_DIR/drivers/vinput_core.ko"
+if [ $? -eq 0 ]; then
+    echo -e "${GREEN}✓ vinput_core loaded successfully${NC}"
+else
+    echo -e "${RED}✗ Failed to load vinput_core${NC}"
+    exit 1
+fi
+
 echo "Loading keyboard driver..."
 insmod "$SCRIPT_DIR/drivers/keyboard_driver.ko"
 if [ $? -eq 0 ]; then
@@ -135,5 +149,5 @@ echo "   sudo bash $SCRIPT_DIR/tests/test_keyboard.sh"
 echo "   sudo bash $SCRIPT_DIR/tests/test_mouse.sh"
 echo ""
 echo "5. Unload modules when done:"
-echo "   sudo rmmod mouse_driver keyboard_driver"
+echo "   sudo rmmod mouse_driver keyboard_driver vinput_core"
 echo ""
@@ -0,0 +1,87 @@
+#!/bin/bash
+# test_analyzer.sh - Malformed capture test for the offline analyzer
+# Educational OS Project
+#
+# Needs no root and no loaded driver: the captures are crafted here.
+# Every one must be analyzed up to the bad record with a warning, never
+# crash the analyzer.
+
+RED='\033[0;31m'
+GREEN='\033[0;32m'
+YELLOW='\033[1;33m'
+BLUE='\033[1;34m'
+NC='\033[0m' # No Color
+
+ANALYZER=${ANALYZER:-$(dirname "$0")/../userspace/analyzer}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+FAILED=0
+
+echo "========================================="
+echo "Capture Analyzer Robustness Test"
+echo "========================================="
+echo ""
+
+if [ ! -x "$ANALYZER" ]; then
+    echo -e "${RED}Error: Cannot find $ANALYZER${NC}"
+    echo "Build it first:"
+    echo "  make userspace"
+    exit 1
+fi
+
+# Records of evcap.h: header, DEVICE id "k" "p", TIME 0 0, SELECT id, KEY A
+HEADER='\x7fVEVC\x01'
+DEVICE5='\x7e\x05\x01k\x01p'
+TIME='\x7c\x00\x00'
+KEY_A='\x01\x00\x1e\x02'
+
+# Run the analyzer on one capture and check how it stopped
+check_capture() {
+    local desc=$1
+    local data=$2
+    local expect=$3
+    local out status
+    
+    echo -e "${BLUE}Analyzing:${NC} $desc"
+    printf "$data" > "$TMP/capture.vevc"
+    out=$("$ANALYZER" "$TMP/capture.vevc" 2>&1)
+    status=$?
+    if [ $status -ne 0 ] || ! echo "$out" | grep -q "$expect"; then
+        echo -e "${RED}FAIL: exit status $status, expected \"$expect\"${NC}"
+        echo "$out" | sed 's/^/    /'
+        FAILED=1
+        return
+    fi
+    echo -e "${GREEN}PASS${NC}"
+}
+
+echo -e "${YELLOW}=== Well-formed capture ===${NC}"
+check_capture "one device, one key press" \
+    "$HEADER$DEVICE5$TIME\x7d\x05$KEY_A" "1 events"
+check_capture "clock set back between two key presses" \
+    "$HEADER$DEVICE5\x7c\x0a\x00$KEY_A\x7c\x05\x00$KEY_A" "Gaps:     0 over"
+
+echo ""
+echo -e "${YELLOW}=== Malformed captures ===${NC}"
+check_capture "SELECT of an id below a declared one" \
+    "$HEADER$DEVICE5$TIME\x7d\x02$KEY_A" "Garbage or truncated record at offset 15"
+check_capture "SELECT of an id above every declared one" \
+    "$HEADER$DEVICE5$TIME\x7d\x09$KEY_A" "Garbage or truncated record at offset 15"
+check_capture "SELECT of an id of the previous session" \
+    "$HEADER$DEVICE5\x7e\x01\x01k\x01p$TIME\x7d\x05$KEY_A" "Garbage or truncated record at offset 21"
+check_capture "event before any device" \
+    "$HEADER$TIME$KEY_A" "Garbage or truncated record at offset 9"
+check_capture "record cut short" \
+    "$HEADER$DEVICE5$TIME\x01\x00" "Garbage or truncated record at offset 15"
+check_capture "device name longer than the file" \
+    "$HEADER\x7e\x01\x7fk" "Garbage or truncated record at offset 6"
+
+echo ""
+echo "========================================="
+if [ $FAILED -ne 0 ]; then
+    echo -e "${RED}Test Failed!${NC}"
+    echo "========================================="
+    exit 1
+fi
+echo -e "${GREEN}Test Complete!${NC}"
+echo "========================================="
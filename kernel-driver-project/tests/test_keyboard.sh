@@ -27,6 +27,7 @@ SYSFS_PATH=$(find /sys/devices/virtual/input -name "inject_scancode" 2>/dev/null
 if [ -z "$SYSFS_PATH" ]; then
     echo -e "${RED}Error: Cannot find keyboard driver sysfs interface${NC}"
     echo "Make sure the keyboard_driver module is loaded:"
+    echo "  sudo insmod drivers/vinput_core.ko"
     echo "  sudo insmod drivers/keyboard_driver.ko"
     exit 1
 fi
@@ -117,13 +118,83 @@ echo -e "${YELLOW}=== Testing key repeat (hold) ===${NC}"
 echo -e "${BLUE}Simulating 'A' key held down...${NC}"
 inject_scancode 0x1E "Key 'A' press"
 sleep 0.1
-inject_scancode 0x1E "Key 'A' repeat"
+inject_scancode 0x1E "Key 'A' repeat (held, not reported again)"
 sleep 0.1
-inject_scancode 0x1E "Key 'A' repeat"
+inject_scancode 0x1E "Key 'A' repeat (held, not reported again)"
 sleep 0.1
 inject_scancode 0x9E "Key 'A' release"
 sleep 0.3
 
+# Streaming smoke test: the native injector keeps the node open and writes
+# 64 scan codes per write; every shifted 'A' must be released again
+INJECTOR=$(dirname "$0")/../userspace/injector
+STATS_PATH=/sys/kernel/debug/virtual_keyboard/stats
+
+# Records the full ring dropped so far, 0 without debugfs
+ring_drops() {
+    if [ -r "$STATS_PATH" ]; then
+        awk '/^drops:/ { print $2 }' "$STATS_PATH"
+    else
+        echo 0
+    fi
+}
+
+# Drops would show up as held keys or a moved pointer: name them instead
+check_ring_drops() {
+    local drops=$(( $(ring_drops) - $1 ))
+    
+    if [ "$drops" -ne 0 ]; then
+        echo -e "${RED}FAIL: the ring dropped $drops records at full speed${NC}"
+        echo "Load the driver with overflow=block for this test"
+        exit 1
+    fi
+}
+if [ -x "$INJECTOR" ]; then
+    echo ""
+    echo -e "${YELLOW}=== Streaming smoke test ===${NC}"
+    echo -e "${BLUE}Injecting 5000 shifted 'A's at full speed...${NC}"
+    DROPS_BEFORE=$(ring_drops)
+    if ! "$INJECTOR" -t "$(dirname "$SYSFS_PATH")/inject_scancodes" -b 64 -n 5000 \
+        -p "0x2A 0x1E 0x9E 0xAA"; then
+        echo -e "${RED}FAIL: injector reported errors${NC}"
+        exit 1
+    fi
+    check_ring_drops "$DROPS_BEFORE"
+    sleep 0.3
+    KEYS=$(cat "$(dirname "$SYSFS_PATH")/keys_down")
+    if [ -n "$KEYS" ]; then
+        echo -e "${RED}FAIL: keys still held after the stream: $KEYS${NC}"
+        exit 1
+    fi
+    echo -e "${GREEN}PASS: no keys held${NC}"
+fi
+
+REC_PATH=$(dirname "$SYSFS_PATH")/recorder
+TRACE_PATH=/sys/kernel/debug/virtual_keyboard/trace
+if [ -d "$REC_PATH" ] && [ -e "$TRACE_PATH" ]; then
+    echo ""
+    echo -e "${YELLOW}=== Testing record and replay ===${NC}"
+    echo -e "${BLUE}Capturing a typed 'CAB'...${NC}"
+    echo capture > "$REC_PATH/mode"
+    for code in 0x2E 0xAE 0x1E 0x9E 0x30 0xB0; do
+        echo "$code" > "$SYSFS_PATH"
+        sleep 0.1
+    done
+    echo idle > "$REC_PATH/mode"
+    echo "Captured $(cat "$REC_PATH/records") scan codes"
+    
+    echo -e "${BLUE}Round-tripping the trace and replaying it at 2x...${NC}"
+    cat "$TRACE_PATH" > /tmp/vkbd.trace
+    cat /tmp/vkbd.trace > "$TRACE_PATH"
+    echo 200 > "$REC_PATH/speed"
+    echo replay > "$REC_PATH/mode"
+    sleep 0.5
+    echo "Replayed $(cat "$REC_PATH/position") scan codes, dropped $(cat "$REC_PATH/dropped")"
+    echo 100 > "$REC_PATH/speed"
+    rm -f /tmp/vkbd.trace
+    sleep 0.3
+fi
+
 echo ""
 echo "========================================="
 echo -e "${GREEN}Test Complete!${NC}"
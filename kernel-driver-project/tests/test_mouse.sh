@@ -27,11 +27,14 @@ SYSFS_PATH=$(find /sys/devices/virtual/input -name "inject_packet" 2>/dev/null |
 if [ -z "$SYSFS_PATH" ]; then
     echo -e "${RED}Error: Cannot find mouse driver sysfs interface${NC}"
     echo "Make sure the mouse_driver module is loaded:"
+    echo "  sudo insmod drivers/vinput_core.ko"
     echo "  sudo insmod drivers/mouse_driver.ko"
     exit 1
 fi
 
 echo -e "${GREEN}Found mouse driver at: $SYSFS_PATH${NC}"
+BULK_PATH=$(dirname "$SYSFS_PATH")/inject_packets
+RAW_PATH=$(dirname "$SYSFS_PATH")/inject_packets_raw
 echo ""
 
 # Function to inject mouse packet
@@ -47,6 +50,44 @@ inject_packet() {
     sleep 0.2
 }
 
+# Function to inject several packets in one write
+# Usage: inject_packets "description" "s dx dy" "s dx dy" ...
+inject_packets() {
+    local desc=$1
+    shift
+    echo -e "${BLUE}Injecting $# packets: $desc${NC}"
+    echo "$*" > "$BULK_PATH"
+    sleep 0.2
+}
+
+# The sequences below use 3-byte packets; other protocols get their own test
+PROTOCOL=$(cat /sys/module/mouse_driver/parameters/protocol 2>/dev/null || echo ps2)
+if [ "$PROTOCOL" != "ps2" ]; then
+    echo -e "${YELLOW}=== Testing protocol $PROTOCOL ===${NC}"
+    case $PROTOCOL in
+    imps)
+        inject_packets "wheel up, wheel down" "0x08 0x00 0x00 0xFF" "0x08 0x00 0x00 0x01"
+        ;;
+    exps)
+        inject_packets "wheel up, wheel down" "0x08 0x00 0x00 0x0F" "0x08 0x00 0x00 0x01"
+        inject_packets "side press/release, extra press/release" \
+            "0x08 0x00 0x00 0x10" "0x08 0x00 0x00 0x00" \
+            "0x08 0x00 0x00 0x20" "0x08 0x00 0x00 0x00"
+        ;;
+    hires)
+        inject_packets "move right 1000, up 300" "0x08 0xE8 0x03 0x2C 0x01 0x00 0x00"
+        inject_packets "half detent up twice (one REL_WHEEL)" \
+            "0x08 0x00 0x00 0x00 0x00 0xC4 0xFF" "0x08 0x00 0x00 0x00 0x00 0xC4 0xFF"
+        inject_packets "side press/release" \
+            "0x18 0x00 0x00 0x00 0x00 0x00 0x00" "0x08 0x00 0x00 0x00 0x00 0x00 0x00"
+        ;;
+    esac
+    echo ""
+    echo -e "${GREEN}Test Complete!${NC}"
+    dmesg | grep virtual_mouse | tail -15
+    exit 0
+fi
+
 # Test sequence
 echo "Starting test sequence..."
 echo "Watch dmesg or use the event reader to see the results"
@@ -107,31 +148,26 @@ sleep 0.3
 echo ""
 echo -e "${YELLOW}=== Testing circular motion ===${NC}"
 echo -e "${BLUE}Simulating circular mouse movement...${NC}"
-# Approximate circle with 8 segments
-inject_packet "0x08" "0x14" "0x00" "E  (20, 0)"
-sleep 0.1
-inject_packet "0x08" "0x0E" "0x0E" "SE (14, 14)"
-sleep 0.1
-inject_packet "0x08" "0x00" "0x14" "S  (0, 20)"
-sleep 0.1
-inject_packet "0x08" "0xF2" "0x0E" "SW (-14, 14)"
-sleep 0.1
-inject_packet "0x08" "0xEC" "0x00" "W  (-20, 0)"
-sleep 0.1
-inject_packet "0x08" "0xF2" "0xF2" "NW (-14, -14)"
-sleep 0.1
-inject_packet "0x08" "0x00" "0xEC" "N  (0, -20)"
-sleep 0.1
-inject_packet "0x08" "0x0E" "0xF2" "NE (14, -14)"
+# Approximate circle with 8 segments, queued as one batch
+inject_packets "circle E, SE, S, SW, W, NW, N, NE" \
+    "0x08 0x14 0x00" "0x08 0x0E 0x0E" "0x08 0x00 0x14" "0x08 0xF2 0x0E" \
+    "0x08 0xEC 0x00" "0x08 0xF2 0xF2" "0x08 0x00 0xEC" "0x08 0x0E 0xF2"
 sleep 0.3
 
 echo ""
 echo -e "${YELLOW}=== Testing rapid movements ===${NC}"
 echo -e "${BLUE}Simulating rapid mouse jitter...${NC}"
+JITTER=()
 for i in {1..5}; do
-    inject_packet "0x08" "0x02" "0x02" "Small move"
-    inject_packet "0x08" "0xFE" "0xFE" "Small move back"
+    JITTER+=("0x08 0x02 0x02" "0x08 0xFE 0xFE")
 done
+inject_packets "jitter (small move and back, 5 times)" "${JITTER[@]}"
+sleep 0.3
+
+echo ""
+echo -e "${YELLOW}=== Testing binary bulk injection ===${NC}"
+echo -e "${BLUE}Injecting 100 raw packets (move right by 1 each)...${NC}"
+printf '\x08\x01\x00%.0s' {1..100} > "$RAW_PATH"
 sleep 0.3
 
 echo ""
@@ -145,6 +181,73 @@ sleep 0.2
 inject_packet "0x08" "0x00" "0x81" "Large move up (-127)"
 sleep 0.3
 
+ACCEL_PATH=$(dirname "$SYSFS_PATH")/accel
+if [ -d "$ACCEL_PATH" ]; then
+    echo ""
+    echo -e "${YELLOW}=== Testing pointer acceleration ===${NC}"
+    echo -e "${BLUE}Linear profile: slow moves pass through, fast ones are amplified${NC}"
+    echo linear > "$ACCEL_PATH/profile"
+    inject_packet "0x08" "0x02" "0x00" "Slow move right (2, stays 2)"
+    sleep 0.2
+    inject_packet "0x08" "0x40" "0x00" "Fast move right (64, gain capped at 4x)"
+    sleep 0.2
+    echo -e "${BLUE}Half sensitivity: sub-count remainders add up${NC}"
+    echo flat > "$ACCEL_PATH/profile"
+    echo 128 > "$ACCEL_PATH/sensitivity"
+    inject_packets "4 moves of 1 (reported as 0 1 0 1)" \
+        "0x08 0x01 0x00" "0x08 0x01 0x00" "0x08 0x01 0x00" "0x08 0x01 0x00"
+    sleep 0.2
+    echo 256 > "$ACCEL_PATH/sensitivity"
+    echo -e "${GREEN}Acceleration restored to flat${NC}"
+    sleep 0.3
+fi
+
+# Streaming smoke test: click-and-drag right then back, 64 packets per
+# write; the pointer must end where it started with no button held
+INJECTOR=$(dirname "$0")/../userspace/injector
+STATS_PATH=/sys/kernel/debug/virtual_mouse/stats
+
+# Records the full ring dropped so far, 0 without debugfs
+ring_drops() {
+    if [ -r "$STATS_PATH" ]; then
+        awk '/^drops:/ { print $2 }' "$STATS_PATH"
+    else
+        echo 0
+    fi
+}
+
+# Drops would show up as held keys or a moved pointer: name them instead
+check_ring_drops() {
+    local drops=$(( $(ring_drops) - $1 ))
+    
+    if [ "$drops" -ne 0 ]; then
+        echo -e "${RED}FAIL: the ring dropped $drops records at full speed${NC}"
+        echo "Load the driver with overflow=block for this test"
+        exit 1
+    fi
+}
+if [ -x "$INJECTOR" ]; then
+    echo ""
+    echo -e "${YELLOW}=== Streaming smoke test ===${NC}"
+    echo -e "${BLUE}Injecting 5000 drags at full speed...${NC}"
+    POS_PATH=$(dirname "$SYSFS_PATH")/position
+    BEFORE=$(cat "$POS_PATH")
+    DROPS_BEFORE=$(ring_drops)
+    if ! "$INJECTOR" -m -t "$BULK_PATH" -b 64 -n 5000 -p "0x09 0x01 0x00 0x18 0xFF 0x00"; then
+        echo -e "${RED}FAIL: injector reported errors${NC}"
+        exit 1
+    fi
+    check_ring_drops "$DROPS_BEFORE"
+    sleep 0.3
+    AFTER=$(cat "$POS_PATH")
+    BUTTONS=$(cat "$(dirname "$SYSFS_PATH")/buttons")
+    if [ "$BEFORE" != "$AFTER" ] || [ "$BUTTONS" != "0x00" ]; then
+        echo -e "${RED}FAIL: position $BEFORE -> $AFTER, buttons $BUTTONS${NC}"
+        exit 1
+    fi
+    echo -e "${GREEN}PASS: back at $AFTER, no buttons held${NC}"
+fi
+
 echo ""
 echo "========================================="
 echo -e "${GREEN}Test Complete!${NC}"
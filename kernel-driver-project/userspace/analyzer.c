@@ -0,0 +1,486 @@
+/*
+ * analyzer.c - Offline analysis of reader --record captures
+ *
+ * Maps a capture in the evcap.h format and reports, in one pass:
+ * - the devices of every session with their event, frame and drop counts
+ * - per-key press, release and repeat counts and press rates
+ * - a log2 histogram of the gaps between consecutive frames of a device
+ * - the distribution of frame sizes (events per SYN_REPORT)
+ * - the silences longer than a threshold and every SYN_DROPPED marker
+ * A capture cut short by a crash or a full disk is analyzed up to the
+ * last whole record.
+ *
+ * Usage: ./analyzer [-g MS] [-l N] capture.vevc
+ *
+ * License: MIT
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdint.h>
+
+#include "keynames.h"
+#include "evcap.h"
+
+#define NAME_LEN     256
+#define GAP_BUCKETS  32                 /* log2(us), last is open-ended */
+#define FRAME_MAX    32                 /* Frame sizes, last is open-ended */
+#define BAR_WIDTH    40
+#define NO_DEV       SIZE_MAX           /* Map slot of an undeclared id */
+
+/* One declared device; ids are reused by later sessions */
+struct cap_dev {
+    char name[NAME_LEN];
+    char path[NAME_LEN];
+    unsigned long long events;
+    unsigned long long frames;
+    unsigned long long dropped;         /* SYN_DROPPED markers */
+    unsigned int frame_events;          /* Events of the open frame */
+    unsigned long long last_us;         /* Last event, 0 before the first */
+    unsigned long long last_frame_us;   /* Last SYN_REPORT, 0 before the first */
+};
+
+struct analysis {
+    struct cap_dev *devs;
+    size_t num_devs;
+    size_t *map;                        /* Session id -> index in devs */
+    size_t map_len;
+    unsigned int sessions;
+    unsigned long long events;
+    unsigned long long first_us, last_us;
+    unsigned long long presses[KEY_MAX + 1];
+    unsigned long long releases[KEY_MAX + 1];
+    unsigned long long repeats[KEY_MAX + 1];
+    unsigned long long gap_hist[GAP_BUCKETS];
+    unsigned long long frame_hist[FRAME_MAX + 1];
+    unsigned long long silences;
+    unsigned long long drops;
+    /* Options */
+    unsigned long long gap_us;          /* Silence threshold */
+    unsigned int list_max;              /* Silences and drops listed */
+};
+
+/* Name of a key or button code; unnamed codes are formatted into buf */
+const char *key_name(unsigned int code, char *buf, size_t len)
+{
+    if (code <= KEY_MAX && key_names[code])
+        return key_names[code];
+    
+    snprintf(buf, len, "KEY_%u", code);
+    return buf;
+}
+
+/*
+ * Capture time as local date and time, to the microsecond
+ * Times before 2000 come from reader --clock monotonic or boottime and
+ * are printed as seconds since boot.
+ */
+void format_time(unsigned long long us, char *buf, size_t len)
+{
+    time_t sec = us / 1000000;
+    struct tm tm_info;
+    size_t n;
+    
+    if (sec < 946684800) {
+        snprintf(buf, len, "%19lld.%06llu", (long long)sec, us % 1000000);
+        return;
+    }
+    localtime_r(&sec, &tm_info);
+    n = strftime(buf, len, "%Y-%m-%d %H:%M:%S", &tm_info);
+    snprintf(buf + n, len - n, ".%06llu", us % 1000000);
+}
+
+unsigned int log2_bucket(unsigned long long v)
+{
+    unsigned int b = 0;
+    
+    while (v > 1 && b < GAP_BUCKETS - 1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/*
+ * Record parsing
+ * Each function consumes one record after its tag and returns 0, or -1
+ * if the record is truncated or malformed.
+ */
+int get_string(const unsigned char **pos, const unsigned char *end,
+               char *buf, size_t len)
+{
+    uint64_t n;
+    
+    if (evcap_get_varint(pos, end, &n) < 0 || n > (uint64_t)(end - *pos))
+        return -1;
+    snprintf(buf, len, "%.*s", (int)n, (const char *)*pos);
+    *pos += n;
+    return 0;
+}
+
+int parse_device(struct analysis *a, const unsigned char **pos,
+                 const unsigned char *end, struct cap_dev **cur)
+{
+    struct cap_dev *devs, *dev;
+    size_t *map, i;
+    uint64_t id;
+    
+    if (evcap_get_varint(pos, end, &id) < 0 || id > 1000000)
+        return -1;
+    
+    /*
+     * Ids start at 1 in every session: a repeated low id opens a new one,
+     * and the ids of the previous session are no longer valid
+     */
+    if (id == 1 || !a->sessions) {
+        a->sessions++;
+        for (i = 0; i < a->map_len; i++)
+            a->map[i] = NO_DEV;
+    }
+    
+    devs = realloc(a->devs, (a->num_devs + 1) * sizeof(*devs));
+    if (!devs)
+        return -1;
+    a->devs = devs;
+    dev = &devs[a->num_devs];
+    memset(dev, 0, sizeof(*dev));
+    if (get_string(pos, end, dev->name, sizeof(dev->name)) < 0 ||
+        get_string(pos, end, dev->path, sizeof(dev->path)) < 0)
+        return -1;
+    
+    if (id >= a->map_len) {
+        map = realloc(a->map, (id + 1) * sizeof(*map));
+        if (!map)
+            return -1;
+        for (i = a->map_len; i <= id; i++)
+            map[i] = NO_DEV;
+        a->map = map;
+        a->map_len = id + 1;
+    }
+    a->map[id] = a->num_devs++;
+    *cur = dev;
+    return 0;
+}
+
+int parse_select(struct analysis *a, const unsigned char **pos,
+                 const unsigned char *end, struct cap_dev **cur)
+{
+    uint64_t id;
+    
+    /* Only ids declared in this session */
+    if (evcap_get_varint(pos, end, &id) < 0 || id >= a->map_len ||
+        a->map[id] == NO_DEV)
+        return -1;
+    *cur = &a->devs[a->map[id]];
+    return 0;
+}
+
+void account_event(struct analysis *a, struct cap_dev *dev, unsigned int type,
+                   unsigned int code, int value, unsigned long long us)
+{
+    unsigned long long gap;
+    
+    a->events++;
+    dev->events++;
+    if (!a->first_us)
+        a->first_us = us;
+    if (us > a->last_us)
+        a->last_us = us;
+    
+    /*
+     * A TIME record that goes back (the clock was set back) re-bases the
+     * device: the step is neither a silence nor a frame gap
+     */
+    if (us < dev->last_us)
+        dev->last_us = 0;
+    if (us < dev->last_frame_us)
+        dev->last_frame_us = 0;
+    
+    /* Silences are measured per device, from its previous event */
+    if (dev->last_us && us - dev->last_us >= a->gap_us) {
+        a->silences++;
+        if (a->silences <= a->list_max) {
+            char when[64];
+            
+            format_time(us, when, sizeof(when));
+            printf("  gap    %s  %10.3f s  %s\n", when,
+                   (us - dev->last_us) / 1e6, dev->path);
+        }
+    }
+    dev->last_us = us;
+    
+    if (type == EV_SYN) {
+        if (code == SYN_DROPPED) {
+            a->drops++;
+            dev->dropped++;
+            if (a->drops <= a->list_max) {
+                char when[64];
+                
+                format_time(us, when, sizeof(when));
+                printf("  drop   %s  %12s  %s\n", when, "SYN_DROPPED", dev->path);
+            }
+        } else if (code == SYN_REPORT) {
+            dev->frames++;
+            a->frame_hist[dev->frame_events < FRAME_MAX ? dev->frame_events : FRAME_MAX]++;
+            dev->frame_events = 0;
+            if (dev->last_frame_us) {
+                gap = us - dev->last_frame_us;
+                a->gap_hist[log2_bucket(gap)]++;
+            }
+            dev->last_frame_us = us;
+        }
+        return;
+    }
+    
+    dev->frame_events++;
+    if (type == EV_KEY && code <= KEY_MAX) {
+        if (value == 1)
+            a->presses[code]++;
+        else if (value == 0)
+            a->releases[code]++;
+        else
+            a->repeats[code]++;
+    }
+}
+
+/*
+ * Walk the records of the whole capture
+ * Returns the offset where parsing stopped, the file size if it did not.
+ */
+size_t analyze(struct analysis *a, const unsigned char *data, size_t size)
+{
+    const unsigned char *pos = data + EVCAP_HEADER_LEN;
+    const unsigned char *end = data + size;
+    const unsigned char *record;
+    struct cap_dev *dev = NULL;
+    unsigned long long us = 0;
+    uint64_t delta, code, value, sec, usec;
+    unsigned int tag;
+    
+    while (pos < end) {
+        record = pos;
+        tag = *pos++;
+        
+        switch (tag) {
+            case EVCAP_DEVICE:
+                if (parse_device(a, &pos, end, &dev) < 0)
+                    return record - data;
+                break;
+            case EVCAP_SELECT:
+                if (parse_select(a, &pos, end, &dev) < 0)
+                    return record - data;
+                break;
+            case EVCAP_TIME:
+                if (evcap_get_varint(&pos, end, &sec) < 0 ||
+                    evcap_get_varint(&pos, end, &usec) < 0)
+                    return record - data;
+                us = sec * 1000000 + usec;
+                break;
+            default:
+                if (tag > EVCAP_TYPE_MAX || !dev ||
+                    evcap_get_varint(&pos, end, &delta) < 0 ||
+                    evcap_get_varint(&pos, end, &code) < 0 ||
+                    evcap_get_varint(&pos, end, &value) < 0)
+                    return record - data;
+                us += delta;
+                account_event(a, dev, tag, code, evcap_unzigzag(value), us);
+                break;
+        }
+    }
+    return size;
+}
+
+/* Histogram row with a bar scaled to the largest bucket */
+void print_bar(const char *label, unsigned long long count, unsigned long long max)
+{
+    int width = max ? (int)(count * BAR_WIDTH / max) : 0;
+    
+    printf("  %-16s %10llu  %.*s\n", label, count, width ? width : 1,
+           "########################################");
+}
+
+void print_report(const struct analysis *a, const char *path, size_t size)
+{
+    double span = a->last_us > a->first_us ? (a->last_us - a->first_us) / 1e6 : 0;
+    unsigned long long max, total;
+    char when[64], label[32], name[16];
+    unsigned int order[KEY_MAX + 1];
+    unsigned int i, key, keys, b;
+    size_t d;
+    
+    printf("\nCapture:  %s, %zu bytes, %llu events", path, size, a->events);
+    if (a->events)
+        printf(" (%.1f bytes/event)", (double)size / a->events);
+    printf(", %u session%s\n", a->sessions, a->sessions == 1 ? "" : "s");
+    if (a->events) {
+        format_time(a->first_us, when, sizeof(when));
+        printf("Span:     %s + %.3f s\n", when, span);
+    }
+    printf("Gaps:     %llu over %llu ms\n", a->silences, a->gap_us / 1000);
+    printf("Drops:    %llu SYN_DROPPED\n", a->drops);
+    
+    printf("\nDevices:\n");
+    printf("  %10s %10s %8s  %s\n", "events", "frames", "dropped", "name (path)");
+    for (d = 0; d < a->num_devs; d++) {
+        const struct cap_dev *dev = &a->devs[d];
+        
+        printf("  %10llu %10llu %8llu  %s (%s)\n", dev->events, dev->frames,
+               dev->dropped, dev->name, dev->path);
+    }
+    
+    /* Keys by presses, insertion sort of the few that occur */
+    keys = 0;
+    for (key = 0; key <= KEY_MAX; key++) {
+        if (!a->presses[key] && !a->releases[key] && !a->repeats[key])
+            continue;
+        for (i = keys; i > 0 && a->presses[order[i - 1]] < a->presses[key]; i--)
+            order[i] = order[i - 1];
+        order[i] = key;
+        keys++;
+    }
+    if (keys) {
+        printf("\nKeys and buttons (%u):\n", keys);
+        printf("  %-16s %10s %10s %10s %10s\n", "code", "presses", "releases",
+               "repeats", "presses/s");
+        for (i = 0; i < keys; i++) {
+            key = order[i];
+            printf("  %-16s %10llu %10llu %10llu %10.2f\n",
+                   key_name(key, name, sizeof(name)), a->presses[key],
+                   a->releases[key], a->repeats[key],
+                   span > 0 ? a->presses[key] / span : 0);
+        }
+    }
+    
+    max = total = 0;
+    for (b = 0; b < GAP_BUCKETS; b++) {
+        total += a->gap_hist[b];
+        if (a->gap_hist[b] > max)
+            max = a->gap_hist[b];
+    }
+    if (total) {
+        printf("\nGaps between frames (us):\n");
+        for (b = 0; b < GAP_BUCKETS; b++) {
+            if (!a->gap_hist[b])
+                continue;
+            if (b == 0)
+                snprintf(label, sizeof(label), "< 2");
+            else if (b == GAP_BUCKETS - 1)
+                snprintf(label, sizeof(label), ">= %llu", 1ULL << b);
+            else
+                snprintf(label, sizeof(label), "%llu - %llu", 1ULL << b, (2ULL << b) - 1);
+            print_bar(label, a->gap_hist[b], max);
+        }
+    }
+    
+    max = total = 0;
+    for (b = 0; b <= FRAME_MAX; b++) {
+        total += a->frame_hist[b];
+        if (a->frame_hist[b] > max)
+            max = a->frame_hist[b];
+    }
+    if (total) {
+        printf("\nFrame sizes (events per SYN_REPORT):\n");
+        for (b = 0; b <= FRAME_MAX; b++) {
+            if (!a->frame_hist[b])
+                continue;
+            snprintf(label, sizeof(label), b == FRAME_MAX ? ">= %u" : "%u", b);
+            print_bar(label, a->frame_hist[b], max);
+        }
+    }
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] capture.vevc\n", prog);
+    fprintf(stderr, "  -g, --gap=MS     Report silences of a device of at least MS (default 1000)\n");
+    fprintf(stderr, "  -l, --list=N     List at most N silences and drops (default 20)\n");
+    fprintf(stderr, "\nRecord a capture with: sudo ./userspace/reader -a --record capture.vevc\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "gap",  required_argument, NULL, 'g' },
+        { "list", required_argument, NULL, 'l' },
+        { NULL, 0, NULL, 0 },
+    };
+    static struct analysis a;
+    const unsigned char *data;
+    struct stat st;
+    size_t stopped;
+    int fd, opt;
+    
+    a.gap_us = 1000 * 1000ULL;
+    a.list_max = 20;
+    
+    while ((opt = getopt_long(argc, argv, "g:l:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'g':
+                a.gap_us = strtoull(optarg, NULL, 0) * 1000;
+                break;
+            case 'l':
+                a.list_max = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    fd = open(argv[optind], O_RDONLY);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    if ((size_t)st.st_size < EVCAP_HEADER_LEN) {
+        fprintf(stderr, "Error: %s is not a capture\n", argv[optind]);
+        return 1;
+    }
+    
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map %s: %s\n", argv[optind], strerror(errno));
+        return 1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    
+    if (memcmp(data, EVCAP_MAGIC, EVCAP_MAGIC_LEN) != 0 ||
+        data[EVCAP_MAGIC_LEN] != EVCAP_VERSION) {
+        fprintf(stderr, "Error: %s is not a version %d capture\n", argv[optind],
+                EVCAP_VERSION);
+        return 1;
+    }
+    
+    /* Silences and drops are listed as they are found */
+    printf("Silences and drops:\n");
+    stopped = analyze(&a, data, st.st_size);
+    if (!a.silences && !a.drops)
+        printf("  none\n");
+    else if (a.silences > a.list_max || a.drops > a.list_max)
+        printf("  ... (first %u of each listed)\n", a.list_max);
+    
+    print_report(&a, argv[optind], st.st_size);
+    if (stopped < (size_t)st.st_size)
+        fprintf(stderr, "\nWarning: Garbage or truncated record at offset %zu, "
+                "ignored the last %zu bytes\n", stopped, (size_t)st.st_size - stopped);
+    
+    munmap((void *)data, st.st_size);
+    close(fd);
+    free(a.devs);
+    free(a.map);
+    return 0;
+}
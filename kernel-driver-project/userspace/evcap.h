@@ -0,0 +1,90 @@
+/*
+ * evcap.h - Compact event capture format of reader --record
+ *
+ * A capture is a byte stream that can be appended to by later sessions:
+ *
+ *   File header   EVCAP_MAGIC (5 bytes) followed by EVCAP_VERSION (1 byte)
+ *   Records       one tag byte, then varint fields:
+ *     EVCAP_DEVICE  id, name length, name, path length, path
+ *                   Declares a device and makes it current
+ *     EVCAP_SELECT  id: the events that follow belong to device id
+ *     EVCAP_TIME    sec, usec: absolute time of the next event, written at
+ *                   the start of a session and when the clock goes back
+ *     type < 0x20   one input_event of that type:
+ *                   delta_us, code, zigzag(value)
+ *                   delta_us is the time since the previous event of the
+ *                   file, whatever its device
+ *
+ * Varints are unsigned LEB128, 7 bits per byte, least significant first.
+ * A key press is typically 5 bytes against 24 for struct input_event and
+ * several times that as text. Device ids are only valid within a
+ * session; every session declares its devices again.
+ *
+ * License: MIT
+ */
+
+#ifndef _EVCAP_H
+#define _EVCAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EVCAP_MAGIC      "\x7f" "VEVC"
+#define EVCAP_MAGIC_LEN  5
+#define EVCAP_VERSION    1
+#define EVCAP_HEADER_LEN (EVCAP_MAGIC_LEN + 1)
+
+#define EVCAP_TIME       0x7C
+#define EVCAP_SELECT     0x7D
+#define EVCAP_DEVICE     0x7E
+#define EVCAP_TYPE_MAX   0x1F           /* EV_MAX: tags above are records */
+
+#define EVCAP_VARINT_MAX 10             /* Bytes of a 64-bit varint */
+
+/* Append v to buf, returns the bytes written */
+static inline size_t evcap_put_varint(unsigned char *buf, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        buf[n++] = (v & 0x7F) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    return n;
+}
+
+/*
+ * Read a varint at *pos, at most up to end
+ * Returns 0 and advances *pos, -1 if the varint is truncated or too long.
+ */
+static inline int evcap_get_varint(const unsigned char **pos,
+                                   const unsigned char *end, uint64_t *v)
+{
+    const unsigned char *p = *pos;
+    unsigned int shift = 0;
+
+    *v = 0;
+    while (p < end && shift < 64) {
+        *v |= (uint64_t)(*p & 0x7F) << shift;
+        if (!(*p++ & 0x80)) {
+            *pos = p;
+            return 0;
+        }
+        shift += 7;
+    }
+    return -1;
+}
+
+/* Signed values: small magnitudes of either sign stay small */
+static inline uint64_t evcap_zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t evcap_unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+#endif /* _EVCAP_H */
@@ -0,0 +1,53 @@
+# gen_keynames.awk - Build the reader's key name table
+#
+# Reads linux/input-event-codes.h and prints a header with a dense,
+# statically initialized table of KEY_* and BTN_* names indexed by code:
+#
+#   awk -f userspace/gen_keynames.awk input-event-codes.h > keynames.h
+#
+# Aliases defined as another macro (KEY_HANGUEL, BTN_A, ...) are skipped.
+# When several numeric definitions share a code, the last one wins, which
+# picks the specific name over the range marker (BTN_LEFT over BTN_MOUSE,
+# BTN_0 over BTN_MISC). KEY_ is stripped, BTN_ is kept.
+#
+# License: MIT
+
+function value(s,    i, n, c) {
+    if (s !~ /^0[xX]/)
+        return s + 0
+    n = 0
+    s = tolower(substr(s, 3))
+    for (i = 1; i <= length(s); i++) {
+        c = index("0123456789abcdef", substr(s, i, 1)) - 1
+        n = n * 16 + c
+    }
+    return n
+}
+
+$1 == "#define" && $2 ~ /^(KEY|BTN)_/ && $3 ~ /^(0[xX][0-9a-fA-F]+|[0-9]+)$/ {
+    if ($2 == "KEY_MAX" || $2 == "KEY_CNT")
+        next
+    v = value($3)
+    if (!(v in names))
+        order[count++] = v
+    names[v] = $2
+}
+
+END {
+    print "/* Generated by userspace/gen_keynames.awk - do not edit */"
+    print ""
+    print "#ifndef _KEYNAMES_H"
+    print "#define _KEYNAMES_H"
+    print ""
+    print "#include <linux/input.h>"
+    print ""
+    print "static const char * const key_names[KEY_MAX + 1] = {"
+    for (i = 0; i < count; i++) {
+        label = names[order[i]]
+        sub(/^KEY_/, "", label)
+        printf "    [%s] = \"%s\",\n", names[order[i]], label
+    }
+    print "};"
+    print ""
+    print "#endif /* _KEYNAMES_H */"
+}
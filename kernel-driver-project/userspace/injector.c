@@ -0,0 +1,472 @@
+/*
+ * injector.c - Paced scan code / packet injector
+ *
+ * Streams records into a virtual keyboard or mouse from a file, a
+ * pattern or stdin, keeping the injection node open for the whole run
+ * instead of a fork/exec per record as in an echo loop. Records are
+ * written in batches, paced on an absolute CLOCK_MONOTONIC schedule
+ * with clock_nanosleep(TIMER_ABSTIME), or back to back at full speed.
+ * At exit it reports the achieved rate, any write() errors and the
+ * records a full ring refused; any of the latter fails the run.
+ *
+ * Input is the text format of the sysfs attributes ("0x1E 0x9E", any
+ * whitespace, '#' to the end of the line is a comment) or, with -x, raw
+ * record bytes such as a captured stream.
+ *
+ * Targets:
+ *   inject_scancodes / inject_packets (default, found under
+ *   /sys/devices/virtual/input) - hex text, up to a page per write
+ *   inject_packets_raw, /dev/vkbd_inject, /dev/vmouse_inject - raw bytes
+ *
+ * Usage: ./injector [-m] [-t TARGET] [-r RATE] [-b BATCH] [-n COUNT]
+ *                   [-x] [-p PATTERN | FILE | -]
+ *
+ * License: MIT
+ */
+
+#define _GNU_SOURCE  /* clock_nanosleep() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <getopt.h>
+#include <signal.h>
+
+#define SYSFS_PAGE   4096               /* Largest sysfs store */
+#define RECORD_MAX   7                  /* Hires mouse packet */
+#define BATCH_MAX    4096               /* Records per write */
+#define PATTERN_MAX  4096               /* Records in a -p pattern */
+#define NSEC_PER_SEC 1000000000LL
+
+#define KBD_ATTR     "/sys/devices/virtual/input/input*/inject_scancodes"
+#define MOUSE_ATTR   "/sys/devices/virtual/input/input*/inject_packets"
+
+/* Where the records come from */
+struct source {
+    FILE *file;                         /* NULL for a pattern */
+    int binary;                         /* Raw bytes instead of hex text */
+    unsigned char pattern[PATTERN_MAX * RECORD_MAX];
+    size_t pattern_len;                 /* Bytes */
+    size_t pos;
+    unsigned long long pass_records;    /* Records of the current pass */
+    unsigned long repeat;               /* Passes left, 0 = forever */
+    int forever;
+};
+
+static volatile sig_atomic_t stop;
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+long long now_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Next byte of the hex text format
+ * Returns 1 with the value, 0 at the end of the input, -1 on a bad token.
+ */
+int read_text_byte(FILE *f, unsigned char *byte)
+{
+    char token[16];
+    unsigned long v;
+    char *end;
+    int c;
+    size_t len;
+    
+    for (;;) {
+        c = getc(f);
+        if (c == EOF)
+            return 0;
+        if (c == '#') {
+            while (c != '\n' && c != EOF)
+                c = getc(f);
+            continue;
+        }
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r' && c != ',')
+            break;
+    }
+    
+    len = 0;
+    while (c != EOF && c != ' ' && c != '\t' && c != '\n' && c != '\r' &&
+           c != ',' && c != '#') {
+        if (len == sizeof(token) - 1)
+            return -1;
+        token[len++] = c;
+        c = getc(f);
+    }
+    token[len] = '\0';
+    if (c == '#')
+        ungetc(c, f);
+    
+    v = strtoul(token, &end, 0);
+    if (*end || v > 0xFF)
+        return -1;
+    *byte = v;
+    return 1;
+}
+
+/* One pass over a file, rewound for the next */
+int read_file_record(struct source *src, unsigned char *rec,
+                     unsigned int size)
+{
+    unsigned int i;
+    int ret;
+    
+    if (src->binary)
+        return fread(rec, size, 1, src->file) == 1 ? 1 : ferror(src->file) ? -1 : 0;
+    
+    for (i = 0; i < size; i++) {
+        ret = read_text_byte(src->file, &rec[i]);
+        if (ret <= 0)
+            return ret < 0 || i ? -1 : 0;  /* A partial record is an error */
+    }
+    return 1;
+}
+
+/*
+ * Next record of the source, repeating it as asked
+ * Returns 1, 0 when done, -1 on malformed input.
+ */
+int next_record(struct source *src, unsigned char *rec, unsigned int size)
+{
+    int ret;
+    
+    for (;;) {
+        if (src->file) {
+            ret = read_file_record(src, rec, size);
+            if (ret) {
+                src->pass_records += ret > 0;
+                return ret;
+            }
+        } else if (src->pos + size <= src->pattern_len) {
+            memcpy(rec, src->pattern + src->pos, size);
+            src->pos += size;
+            src->pass_records++;
+            return 1;
+        }
+        
+        /* End of one pass; an empty one would repeat forever */
+        if (!src->pass_records || (!src->forever && --src->repeat == 0))
+            return 0;
+        src->pos = 0;
+        src->pass_records = 0;
+        if (src->file && fseek(src->file, 0, SEEK_SET) < 0)
+            return 0;  /* stdin or a pipe: a single pass */
+    }
+}
+
+/* Parse a -p pattern into whole records */
+int parse_pattern(struct source *src, const char *text, unsigned int size)
+{
+    FILE *f = fmemopen((void *)text, strlen(text), "r");
+    unsigned char byte;
+    int ret;
+    
+    if (!f)
+        return -1;
+    
+    src->pattern_len = 0;
+    while ((ret = read_text_byte(f, &byte)) > 0) {
+        if (src->pattern_len == sizeof(src->pattern)) {
+            ret = -1;
+            break;
+        }
+        src->pattern[src->pattern_len++] = byte;
+    }
+    fclose(f);
+    
+    if (ret < 0 || !src->pattern_len || src->pattern_len % size)
+        return -1;
+    return 0;
+}
+
+/* Packet size of the loaded mouse driver's protocol parameter */
+unsigned int mouse_packet_size(void)
+{
+    char proto[16] = "";
+    FILE *f;
+    
+    f = fopen("/sys/module/mouse_driver/parameters/protocol", "r");
+    if (f) {
+        if (!fgets(proto, sizeof(proto), f))
+            proto[0] = '\0';
+        fclose(f);
+    }
+    if (strncmp(proto, "hires", 5) == 0)
+        return 7;
+    if (strncmp(proto, "imps", 4) == 0 || strncmp(proto, "exps", 4) == 0)
+        return 4;
+    return 3;
+}
+
+/* First device's bulk injection attribute */
+int find_target(const char *pattern, char *path, size_t len)
+{
+    glob_t g;
+    int ret = -1;
+    
+    if (glob(pattern, 0, NULL, &g) == 0 && g.gl_pathc > 0) {
+        snprintf(path, len, "%s", g.gl_pathv[0]);
+        ret = 0;
+    }
+    globfree(&g);
+    return ret;
+}
+
+/* The /dev injection nodes, as opposed to sysfs attributes */
+int target_is_chardev(const char *path)
+{
+    struct stat st;
+    
+    return stat(path, &st) == 0 && S_ISCHR(st.st_mode);
+}
+
+/* Raw targets take record bytes, the text attributes hex */
+int target_is_raw(const char *path)
+{
+    size_t len = strlen(path);
+    
+    if (target_is_chardev(path))
+        return 1;
+    return len >= 4 && strcmp(path + len - 4, "_raw") == 0;
+}
+
+/* Sleep until an absolute CLOCK_MONOTONIC time */
+void sleep_until(long long deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / NSEC_PER_SEC,
+        .tv_nsec = deadline % NSEC_PER_SEC,
+    };
+    
+    while (!stop && clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] [-p PATTERN | FILE | -]\n", prog);
+    fprintf(stderr, "  -m, --mouse           Mouse packets (default: keyboard scan codes)\n");
+    fprintf(stderr, "  -t, --target=PATH     Injection node (default: first device's bulk attribute)\n");
+    fprintf(stderr, "  -s, --size=BYTES      Record size (default: 1, or the mouse protocol's)\n");
+    fprintf(stderr, "  -r, --rate=N          Records per second, 0 = full speed (default 0)\n");
+    fprintf(stderr, "  -b, --batch=N         Records per write (default 1)\n");
+    fprintf(stderr, "  -n, --count=N         Passes over the input, 0 = until interrupted (default 1)\n");
+    fprintf(stderr, "  -p, --pattern=TEXT    Records to inject, e.g. \"0x1E 0x9E\"\n");
+    fprintf(stderr, "  -x, --binary          FILE holds raw record bytes\n");
+    fprintf(stderr, "  -q, --quiet           No summary unless write() failed\n");
+    fprintf(stderr, "\nExample: sudo %s -p \"0x1E 0x9E\" -n 10000 -r 5000 -b 8\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "mouse",   no_argument,       NULL, 'm' },
+        { "target",  required_argument, NULL, 't' },
+        { "size",    required_argument, NULL, 's' },
+        { "rate",    required_argument, NULL, 'r' },
+        { "batch",   required_argument, NULL, 'b' },
+        { "count",   required_argument, NULL, 'n' },
+        { "pattern", required_argument, NULL, 'p' },
+        { "binary",  no_argument,       NULL, 'x' },
+        { "quiet",   no_argument,       NULL, 'q' },
+        { NULL, 0, NULL, 0 },
+    };
+    static struct source src;
+    static char buf[BATCH_MAX * RECORD_MAX * 5];
+    struct sigaction sa = { .sa_handler = handle_signal };
+    char target[4096] = "";
+    const char *pattern = NULL;
+    unsigned int size = 0, rate = 0, batch = 1, max_batch, count, j;
+    unsigned long long records = 0, writes = 0, errors = 0, refused = 0, short_writes = 0;
+    unsigned char rec[RECORD_MAX];
+    long long period = 0, start, deadline, elapsed;
+    int mouse = 0, quiet = 0, raw, chardev, fd, ret = 0, last_errno = 0, opt;
+    size_t len, rec_bytes;
+    ssize_t n;
+    
+    src.repeat = 1;
+    
+    while ((opt = getopt_long(argc, argv, "mt:s:r:b:n:p:xq", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                mouse = 1;
+                break;
+            case 't':
+                snprintf(target, sizeof(target), "%s", optarg);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                rate = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                batch = strtoul(optarg, NULL, 0);
+                break;
+            case 'n':
+                src.repeat = strtoul(optarg, NULL, 0);
+                src.forever = !src.repeat;
+                break;
+            case 'p':
+                pattern = optarg;
+                break;
+            case 'x':
+                src.binary = 1;
+                break;
+            case 'q':
+                quiet = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (argc - optind > (pattern ? 0 : 1)) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    if (!size)
+        size = mouse ? mouse_packet_size() : 1;
+    if (size > RECORD_MAX) {
+        fprintf(stderr, "Error: Records are at most %d bytes\n", RECORD_MAX);
+        return 1;
+    }
+    
+    if (!target[0] && find_target(mouse ? MOUSE_ATTR : KBD_ATTR, target, sizeof(target)) < 0) {
+        fprintf(stderr, "Error: No virtual %s found, is the driver loaded?\n",
+                mouse ? "mouse" : "keyboard");
+        return 1;
+    }
+    raw = target_is_raw(target);
+    chardev = target_is_chardev(target);
+    rec_bytes = raw ? size : 5 * size;  /* "0xNN " per byte as text */
+    
+    /* Sysfs stores take at most a page, of "0xNN " text or raw bytes */
+    max_batch = chardev ? BATCH_MAX : SYSFS_PAGE / rec_bytes;
+    if (!batch || batch > max_batch) {
+        fprintf(stderr, "Error: Batch size must be 1..%u for %s\n", max_batch, target);
+        return 1;
+    }
+    
+    /* Input */
+    if (pattern) {
+        if (parse_pattern(&src, pattern, size) < 0) {
+            fprintf(stderr, "Error: Pattern must be whole %u-byte records of hex bytes\n", size);
+            return 1;
+        }
+    } else if (optind == argc || strcmp(argv[optind], "-") == 0) {
+        src.file = stdin;
+    } else {
+        src.file = fopen(argv[optind], src.binary ? "rb" : "r");
+        if (!src.file) {
+            perror("Error opening input");
+            return 1;
+        }
+    }
+    
+    fd = open(target, O_WRONLY);
+    if (fd < 0) {
+        perror("Error opening target");
+        fprintf(stderr, "Hint: Try running with sudo\n");
+        return 1;
+    }
+    
+    /* No SA_RESTART: Ctrl+C ends the run and the summary still gets printed */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    
+    if (rate)
+        period = batch * NSEC_PER_SEC / rate;
+    start = deadline = now_ns();
+    
+    while (!stop) {
+        /* Collect one batch */
+        len = 0;
+        for (count = 0; count < batch; count++) {
+            ret = next_record(&src, rec, size);
+            if (ret <= 0)
+                break;
+            for (j = 0; j < size; j++) {
+                if (raw)
+                    buf[len++] = rec[j];
+                else
+                    len += snprintf(buf + len, sizeof(buf) - len, "0x%02x ", rec[j]);
+            }
+        }
+        if (ret < 0) {
+            fprintf(stderr, "Error: Malformed input after %llu records\n", records + count);
+            break;
+        }
+        if (!count)
+            break;
+        
+        if (period) {
+            sleep_until(deadline);
+            deadline += period;
+        }
+        
+        /* Sysfs attributes take each write whole from offset 0 */
+        n = raw ? write(fd, buf, len) : pwrite(fd, buf, len, 0);
+        writes++;
+        if (n < 0) {
+            if (errno == EINTR)
+                break;
+            errors++;
+            last_errno = errno;
+            continue;
+        }
+        
+        /*
+         * Under drop-newest the injection nodes report a short count for
+         * what the full ring refused: only whole records written count
+         */
+        records += n / rec_bytes;
+        if ((size_t)n < len) {
+            short_writes++;
+            refused += count - n / rec_bytes;
+        }
+        
+        if (count < batch)
+            break;
+    }
+    elapsed = now_ns() - start;
+    
+    if (!quiet || errors || short_writes) {
+        fprintf(stderr, "Injected %llu records in %llu writes to %s in %.3f s: ",
+                records, writes, target, (double)elapsed / NSEC_PER_SEC);
+        fprintf(stderr, "%.0f records/s", elapsed > 0 ? records * (double)NSEC_PER_SEC / elapsed : 0);
+        if (rate)
+            fprintf(stderr, " (target %u)", rate);
+        fprintf(stderr, "\n");
+        if (errors)
+            fprintf(stderr, "write() errors: %llu (last: %s)\n", errors, strerror(last_errno));
+        if (short_writes)
+            fprintf(stderr, "Refused by a full ring: %llu records in %llu short writes\n",
+                    refused, short_writes);
+    }
+    
+    close(fd);
+    if (src.file && src.file != stdin)
+        fclose(src.file);
+    
+    /* Scripts check the status: every record must have gone in */
+    return errors || short_writes || ret < 0 ? 1 : 0;
+}
@@ -0,0 +1,602 @@
+/*
+ * latbench.c - Injection-to-delivery latency benchmark
+ *
+ * Injects records into a virtual keyboard or mouse at a controlled rate
+ * and measures how long each one takes to come back out of its evdev
+ * node: sysfs store, ring, bottom half, input_sync, evdev and read().
+ * Every write is timestamped with CLOCK_MONOTONIC just before it is
+ * issued and every read just after it returns.
+ *
+ * Each record changes exactly one key or button, so it produces exactly
+ * one EV_KEY event and the stream can be matched record by record:
+ *   keyboard - make and break of 26 letter keys in turn (Set 1 codes,
+ *              default keymap)
+ *   mouse    - left, right, middle pressed, then released in the same
+ *              order, with no motion
+ * A record whose event never arrives is counted as lost: dropped by the
+ * ring, skipped as redundant after a drop, or lost to an evdev overrun
+ * (SYN_DROPPED). Mouse records are matched through a 6-packet cycle, so
+ * loss accounting is approximate there; prefer the keyboard for it.
+ *
+ * The device is grabbed (EVIOCGRAB) for the run, so the injected keys
+ * and clicks reach only the benchmark.
+ *
+ * Every combination of rate and batch size is run as one step:
+ *   rate  - records per second, 0 = flat-out
+ *   batch - records per write(); 1 uses inject_scancode/inject_packet,
+ *           larger batches inject_scancodes/inject_packets, -w a
+ *           /dev/v*_inject node
+ *
+ * Usage: ./latbench [-m] [-d /dev/input/eventX] [-w /dev/vkbd_inject]
+ *                   [-r RATES] [-b BATCHES] [-t SECONDS]
+ *
+ * License: MIT
+ */
+
+#define _GNU_SOURCE  /* ppoll() */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <signal.h>
+
+#define EVENT_BATCH  64                 /* Events per read() */
+#define INPUT_DIR    "/dev/input"
+#define PATH_LEN     (sizeof(INPUT_DIR) + 256)
+#define SYSFS_PAGE   4096               /* Largest sysfs store */
+#define RECORD_MAX   7                  /* Hires mouse packet */
+#define SEQ_WINDOW   (1 << 16)          /* Records in flight, power of two */
+#define MAX_STEPS    16                 /* Values per sweep list */
+#define SETTLE_MS    200                /* Wait for stragglers after a step */
+#define NSEC_PER_SEC 1000000000ULL
+
+#define DEFAULT_RATES   "1000,10000,50000,0"
+#define DEFAULT_BATCHES "1,16,128"
+
+/* Set 1 make codes of A-Z in keyboard order; equal to the keycodes */
+static const unsigned char kbd_keys[] = {
+    0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19,  /* Q-P */
+    0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26,        /* A-L */
+    0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32,                    /* Z-M */
+};
+#define KBD_CYCLE (2 * sizeof(kbd_keys))
+
+/* Mouse button cycle: one button changes per packet */
+static const unsigned char mouse_buttons[] = { 0x01, 0x03, 0x07, 0x06, 0x04, 0x00 };
+static const unsigned short mouse_codes[] = {
+    BTN_LEFT, BTN_RIGHT, BTN_MIDDLE, BTN_LEFT, BTN_RIGHT, BTN_MIDDLE,
+};
+#define MOUSE_CYCLE (sizeof(mouse_buttons))
+
+/* Benchmark target */
+struct bench {
+    int mouse;
+    unsigned int record_size;
+    unsigned int cycle;                 /* Records before the pattern repeats */
+    int ev_fd;
+    int single_fd;                      /* inject_scancode / inject_packet */
+    int bulk_fd;                        /* inject_scancodes / inject_packets */
+    int raw;                            /* bulk_fd is a /dev/v*_inject node */
+    /* Sequence state, reset per step */
+    unsigned long long sent;            /* Records written */
+    unsigned long long next;            /* Next record expected back */
+    unsigned long long received;
+    unsigned long long lost;
+    unsigned long long overruns;        /* SYN_DROPPED seen */
+    unsigned long long sent_ns[SEQ_WINDOW];
+    unsigned long long last_ns;         /* Time of the last matched event */
+    unsigned long long *lat;            /* Latencies of this step, ns */
+    size_t lat_len, lat_cap;
+    int dropping;
+};
+
+static volatile sig_atomic_t stop;
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/*
+ * Pattern record seq: its bytes, and the event it must produce
+ */
+void pattern_record(const struct bench *b, unsigned long long seq,
+                    unsigned char *rec)
+{
+    unsigned int i = seq % b->cycle;
+    
+    if (b->mouse) {
+        memset(rec, 0, b->record_size);
+        rec[0] = 0x08 | mouse_buttons[i];  /* Always-one bit */
+        return;
+    }
+    rec[0] = kbd_keys[i / 2] | (i & 1 ? 0x80 : 0);
+}
+
+void pattern_event(const struct bench *b, unsigned long long seq,
+                   unsigned short *code, int *value)
+{
+    unsigned int i = seq % b->cycle;
+    
+    if (b->mouse) {
+        *code = mouse_codes[i];
+        *value = i < MOUSE_CYCLE / 2;
+        return;
+    }
+    *code = kbd_keys[i / 2];
+    *value = !(i & 1);
+}
+
+/*
+ * Inject count records as one write
+ * Sysfs takes hex text; the injection node takes the raw bytes.
+ */
+int inject_batch(struct bench *b, unsigned int count)
+{
+    static char buf[SYSFS_PAGE * 4];
+    unsigned char rec[RECORD_MAX];
+    size_t len = 0;
+    unsigned int i, j;
+    unsigned long long t;
+    int fd = count == 1 && !b->raw ? b->single_fd : b->bulk_fd;
+    ssize_t n;
+    
+    for (i = 0; i < count; i++) {
+        pattern_record(b, b->sent + i, rec);
+        for (j = 0; j < b->record_size; j++) {
+            if (b->raw)
+                buf[len++] = rec[j];
+            else
+                len += snprintf(buf + len, sizeof(buf) - len, "0x%02x ", rec[j]);
+        }
+    }
+    
+    /* Records that fell out of the window can no longer be matched */
+    if (b->sent + count - b->next > SEQ_WINDOW) {
+        b->lost += b->sent + count - SEQ_WINDOW - b->next;
+        b->next = b->sent + count - SEQ_WINDOW;
+    }
+    
+    t = now_ns();
+    n = b->raw ? write(fd, buf, len) : pwrite(fd, buf, len, 0);
+    if (n < 0)
+        return errno == EINTR ? 0 : -1;
+    
+    for (i = 0; i < count; i++)
+        b->sent_ns[(b->sent + i) & (SEQ_WINDOW - 1)] = t;
+    b->sent += count;
+    return 0;
+}
+
+void record_latency(struct bench *b, unsigned long long ns)
+{
+    if (b->lat_len == b->lat_cap) {
+        size_t cap = b->lat_cap ? b->lat_cap * 2 : 65536;
+        unsigned long long *lat = realloc(b->lat, cap * sizeof(*lat));
+        
+        if (!lat)
+            return;
+        b->lat = lat;
+        b->lat_cap = cap;
+    }
+    b->lat[b->lat_len++] = ns;
+}
+
+/*
+ * Match one EV_KEY event to the oldest outstanding record that
+ * produces it; the records skipped on the way are lost.
+ */
+void match_event(struct bench *b, const struct input_event *ev,
+                 unsigned long long t)
+{
+    unsigned long long seq;
+    unsigned short code;
+    int value;
+    
+    for (seq = b->next; seq < b->sent && seq < b->next + b->cycle; seq++) {
+        pattern_event(b, seq, &code, &value);
+        if (code == ev->code && value == ev->value)
+            break;
+    }
+    if (seq >= b->sent || seq >= b->next + b->cycle)
+        return;  /* Not ours, e.g. a key held before the run */
+    
+    b->lost += seq - b->next;
+    record_latency(b, t - b->sent_ns[seq & (SEQ_WINDOW - 1)]);
+    b->received++;
+    b->last_ns = t;
+    b->next = seq + 1;
+}
+
+/*
+ * Read whatever the device has and match it
+ * Autorepeat (value 2) is ignored; after SYN_DROPPED the events up
+ * to the next SYN_REPORT are incomplete and skipped.
+ */
+int drain_events(struct bench *b)
+{
+    struct input_event ev[EVENT_BATCH];
+    unsigned long long t;
+    ssize_t n;
+    size_t i;
+    
+    while ((n = read(b->ev_fd, ev, sizeof(ev))) > 0) {
+        t = now_ns();
+        for (i = 0; i < n / sizeof(ev[0]); i++) {
+            if (ev[i].type == EV_SYN) {
+                if (ev[i].code == SYN_DROPPED) {
+                    b->overruns++;
+                    b->dropping = 1;
+                } else if (ev[i].code == SYN_REPORT) {
+                    b->dropping = 0;
+                }
+                continue;
+            }
+            if (b->dropping || ev[i].type != EV_KEY || ev[i].value == 2)
+                continue;
+            match_event(b, &ev[i], t);
+        }
+    }
+    
+    return n < 0 && errno != EAGAIN ? -1 : 0;
+}
+
+/* Wait for the event node, at most timeout_ns */
+int wait_events(struct bench *b, unsigned long long timeout_ns)
+{
+    struct pollfd pfd = { .fd = b->ev_fd, .events = POLLIN };
+    struct timespec ts = {
+        .tv_sec = timeout_ns / NSEC_PER_SEC,
+        .tv_nsec = timeout_ns % NSEC_PER_SEC,
+    };
+    int ret;
+    
+    ret = ppoll(&pfd, 1, &ts, NULL);
+    if (ret < 0)
+        return errno == EINTR ? 0 : -1;
+    if (ret && (pfd.revents & POLLIN))
+        return drain_events(b);
+    if (ret && (pfd.revents & (POLLHUP | POLLERR))) {
+        errno = ENODEV;
+        return -1;
+    }
+    return 0;
+}
+
+/* Give the bottom half and evdev time to deliver what is outstanding */
+int settle(struct bench *b)
+{
+    unsigned long long start = now_ns(), t;
+    
+    while (!stop && b->next < b->sent &&
+           (t = now_ns()) - start < SETTLE_MS * 1000000ULL) {
+        if (wait_events(b, start + SETTLE_MS * 1000000ULL - t) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+int cmp_u64(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long *)a;
+    unsigned long long y = *(const unsigned long long *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of the sorted latencies, in microseconds */
+double percentile(const struct bench *b, double p)
+{
+    size_t rank;
+    
+    if (!b->lat_len)
+        return 0;
+    rank = (size_t)(p / 100.0 * b->lat_len + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    if (rank > b->lat_len)
+        rank = b->lat_len;
+    return b->lat[rank - 1] / 1000.0;
+}
+
+/*
+ * One step of the sweep: inject at rate for duration, then wait for
+ * the stragglers and report
+ * Writes follow an absolute schedule; a step that cannot keep up
+ * writes back to back and achieves a lower rate than asked.
+ */
+int run_step(struct bench *b, unsigned int rate, unsigned int batch,
+             unsigned int seconds)
+{
+    unsigned long long period, start, end, deadline, t;
+    char rate_str[16] = "max";
+    double elapsed;
+    
+    b->sent = b->next = b->received = b->lost = b->overruns = 0;
+    b->lat_len = 0;
+    b->dropping = 0;
+    
+    period = rate ? batch * NSEC_PER_SEC / rate : 0;
+    start = deadline = now_ns();
+    end = start + seconds * NSEC_PER_SEC;
+    
+    while (!stop && (t = now_ns()) < end) {
+        if (t >= deadline) {
+            if (inject_batch(b, batch) < 0)
+                return -1;
+            deadline += period;
+            if (!period && drain_events(b) < 0)
+                return -1;
+            continue;
+        }
+        if (wait_events(b, deadline - t) < 0)
+            return -1;
+    }
+    
+    if (settle(b) < 0)
+        return -1;
+    b->lost += b->sent - b->next;
+    
+    qsort(b->lat, b->lat_len, sizeof(*b->lat), cmp_u64);
+    elapsed = b->last_ns > start ? (double)(b->last_ns - start) / NSEC_PER_SEC : 0;
+    if (rate)
+        snprintf(rate_str, sizeof(rate_str), "%u", rate);
+    
+    printf("%8s %6u %9llu %9llu %7llu %5llu %10.0f %8.1f %8.1f %8.1f %9.1f\n",
+           rate_str, batch, b->sent, b->received, b->lost, b->overruns,
+           elapsed > 0 ? b->received / elapsed : 0,
+           percentile(b, 50), percentile(b, 99), percentile(b, 99.9),
+           b->lat_len ? b->lat[b->lat_len - 1] / 1000.0 : 0);
+    fflush(stdout);
+    
+    /*
+     * The pattern may stop with keys or buttons held: release them in one
+     * write and swallow the events, so the next step starts clean
+     */
+    if (b->sent % b->cycle) {
+        if (inject_batch(b, b->cycle - b->sent % b->cycle) < 0)
+            return -1;
+        if (settle(b) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/* Comma-separated unsigned list: "1000,10000,0" */
+int parse_list(const char *arg, unsigned int *vals, int max)
+{
+    char *end;
+    int n = 0;
+    
+    while (*arg) {
+        unsigned long v = strtoul(arg, &end, 0);
+    
+        if (end == arg || n == max || (*end && *end != ','))
+            return -1;
+        vals[n++] = v;
+        arg = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+/* First event node whose name starts with prefix */
+int find_device(const char *prefix, char *path, size_t len)
+{
+    char name[256];
+    struct dirent *de;
+    DIR *dir;
+    int fd, found = 0;
+    
+    dir = opendir(INPUT_DIR);
+    if (!dir)
+        return -1;
+    
+    while (!found && (de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "event", 5) != 0)
+            continue;
+        snprintf(path, len, INPUT_DIR "/%s", de->d_name);
+        fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) >= 0 &&
+            strncmp(name, prefix, strlen(prefix)) == 0)
+            found = 1;
+        close(fd);
+    }
+    closedir(dir);
+    return found ? 0 : -1;
+}
+
+/* Packet size of the loaded mouse driver's protocol parameter */
+unsigned int mouse_packet_size(void)
+{
+    char proto[16] = "";
+    FILE *f;
+    
+    f = fopen("/sys/module/mouse_driver/parameters/protocol", "r");
+    if (f) {
+        if (!fgets(proto, sizeof(proto), f))
+            proto[0] = '\0';
+        fclose(f);
+    }
+    if (strncmp(proto, "hires", 5) == 0)
+        return 7;
+    if (strncmp(proto, "imps", 4) == 0 || strncmp(proto, "exps", 4) == 0)
+        return 4;
+    return 3;
+}
+
+/* Injection attribute of the input device behind an event node */
+int open_attr(const char *ev_path, const char *attr)
+{
+    char path[PATH_LEN + 64];
+    const char *node = strrchr(ev_path, '/');
+    
+    snprintf(path, sizeof(path), "/sys/class/input/%s/device/%s",
+             node ? node + 1 : ev_path, attr);
+    return open(path, O_WRONLY);
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  -m, --mouse          Benchmark the mouse instead of the keyboard\n");
+    fprintf(stderr, "  -d, --device=PATH    Event node (default: first virtual device)\n");
+    fprintf(stderr, "  -w, --write=PATH     Inject through a /dev/v*_inject node instead of sysfs\n");
+    fprintf(stderr, "  -r, --rates=LIST     Records per second, 0 = flat-out (default %s)\n",
+            DEFAULT_RATES);
+    fprintf(stderr, "  -b, --batches=LIST   Records per write (default %s)\n", DEFAULT_BATCHES);
+    fprintf(stderr, "  -t, --time=SECONDS   Duration of each step (default 2)\n");
+    fprintf(stderr, "\nExample: sudo %s -r 5000,0 -b 1,64\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "mouse",   no_argument,       NULL, 'm' },
+        { "device",  required_argument, NULL, 'd' },
+        { "write",   required_argument, NULL, 'w' },
+        { "rates",   required_argument, NULL, 'r' },
+        { "batches", required_argument, NULL, 'b' },
+        { "time",    required_argument, NULL, 't' },
+        { NULL, 0, NULL, 0 },
+    };
+    static struct bench bench;
+    struct bench *b = &bench;
+    struct sigaction sa = { .sa_handler = handle_signal };
+    unsigned int rates[MAX_STEPS], batches[MAX_STEPS];
+    int nrates, nbatches, max_batch, i, j, opt;
+    unsigned int seconds = 2;
+    char dev_path[PATH_LEN] = "", name[256] = "Unknown Device";
+    const char *write_path = NULL;
+    int ret = 1;
+    
+    nrates = parse_list(DEFAULT_RATES, rates, MAX_STEPS);
+    nbatches = parse_list(DEFAULT_BATCHES, batches, MAX_STEPS);
+    
+    while ((opt = getopt_long(argc, argv, "md:w:r:b:t:", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                b->mouse = 1;
+                break;
+            case 'd':
+                snprintf(dev_path, sizeof(dev_path), "%s", optarg);
+                break;
+            case 'w':
+                write_path = optarg;
+                break;
+            case 'r':
+                nrates = parse_list(optarg, rates, MAX_STEPS);
+                break;
+            case 'b':
+                nbatches = parse_list(optarg, batches, MAX_STEPS);
+                break;
+            case 't':
+                seconds = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    
+    if (nrates <= 0 || nbatches <= 0 || !seconds || optind != argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    b->record_size = b->mouse ? mouse_packet_size() : 1;
+    b->cycle = b->mouse ? MOUSE_CYCLE : KBD_CYCLE;
+    b->raw = write_path != NULL;
+    
+    /* Sysfs stores take at most a page of "0xNN " text */
+    max_batch = b->raw ? SYSFS_PAGE * 4 / b->record_size : SYSFS_PAGE / (5 * b->record_size);
+    for (i = 0; i < nbatches; i++) {
+        if (!batches[i] || batches[i] > (unsigned int)max_batch) {
+            fprintf(stderr, "Error: Batch sizes must be 1..%d\n", max_batch);
+            return 1;
+        }
+    }
+    
+    if (!dev_path[0] &&
+        find_device(b->mouse ? "Virtual PS/2 Mouse" : "Virtual PS/2 Keyboard",
+                    dev_path, sizeof(dev_path)) < 0) {
+        fprintf(stderr, "Error: No virtual %s found, is the driver loaded?\n",
+                b->mouse ? "mouse" : "keyboard");
+        return 1;
+    }
+    
+    b->ev_fd = open(dev_path, O_RDONLY | O_NONBLOCK);
+    if (b->ev_fd < 0) {
+        perror("Error opening device");
+        fprintf(stderr, "Hint: Try running with sudo\n");
+        return 1;
+    }
+    ioctl(b->ev_fd, EVIOCGNAME(sizeof(name)), name);
+    
+    /* Keep the injected keys and clicks away from the console and desktop */
+    if (ioctl(b->ev_fd, EVIOCGRAB, 1) < 0)
+        fprintf(stderr, "Warning: Could not grab %s: %s\n", dev_path, strerror(errno));
+    
+    if (b->raw) {
+        b->bulk_fd = open(write_path, O_WRONLY);
+        b->single_fd = -1;
+    } else {
+        b->single_fd = open_attr(dev_path, b->mouse ? "inject_packet" : "inject_scancode");
+        b->bulk_fd = open_attr(dev_path, b->mouse ? "inject_packets" : "inject_scancodes");
+    }
+    if (b->bulk_fd < 0 || (!b->raw && b->single_fd < 0)) {
+        perror("Error opening injection interface");
+        goto out;
+    }
+    
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    
+    printf("Device:    %s (%s)\n", dev_path, name);
+    printf("Injection: %s, %u-byte records, %u s per step\n",
+           b->raw ? write_path : "sysfs", b->record_size, seconds);
+    printf("\n%8s %6s %9s %9s %7s %5s %10s %8s %8s %8s %9s\n",
+           "rate", "batch", "sent", "recv", "lost", "ovr", "events/s",
+           "p50 us", "p99 us", "p99.9 us", "max us");
+    
+    for (i = 0; i < nrates && !stop; i++) {
+        for (j = 0; j < nbatches && !stop; j++) {
+            if (run_step(b, rates[i], batches[j], seconds) < 0) {
+                perror("Error during benchmark");
+                goto out;
+            }
+        }
+    }
+    ret = 0;
+
+out:
+    ioctl(b->ev_fd, EVIOCGRAB, 0);
+    if (b->single_fd >= 0)
+        close(b->single_fd);
+    if (b->bulk_fd >= 0)
+        close(b->bulk_fd);
+    close(b->ev_fd);
+    free(b->lat);
+    return ret;
+}
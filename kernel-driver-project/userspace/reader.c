@@ -5,8 +5,36 @@
  * and displays them in human-readable format.
  *
  * Supports keyboard and mouse events from our virtual drivers.
+ * Events are read in batches, up to EVENT_BATCH per read(), and output
+ * is flushed once per batch, so the reader keeps up with replay and
+ * generator rates. With -n the device is opened O_NONBLOCK and drained
+ * after every poll() wakeup.
  *
- * Usage: ./reader /dev/input/eventX
+ * Given several devices, or -a to discover every "Virtual PS/2" device,
+ * the reader multiplexes them in one epoll loop and tags each event with
+ * its source node. With -a it also watches /dev/input through inotify,
+ * so instances that come and go are picked up without a restart.
+ *
+ * Output modes (--mode):
+ *   human   - one colored line per event, event time to the microsecond
+ *             (default on a terminal; colors only on a terminal)
+ *   compact - one plain line per SYN_REPORT frame (default otherwise)
+ *   raw     - the struct input_event stream, unmodified
+ *   quiet   - counters only, once per second and at exit (-q)
+ * All modes write through a 64 KiB stdout buffer flushed once per batch.
+ *
+ * --record FILE appends every event to FILE in the compact format of
+ * evcap.h, whatever the output mode (quiet unless one is given); the
+ * analyzer tool reads it back.
+ *
+ * --types and --codes select events inside the kernel with EVIOCSMASK,
+ * so the rest is never queued, copied or woken up for. --clock picks
+ * the evdev timestamp clock (EVIOCSCLOCKID) and --grab takes the devices
+ * for exclusive use (EVIOCGRAB), away from the console and desktop.
+ *
+ * Usage: ./reader [-n] [--mode=MODE] [--record FILE] /dev/input/eventX
+ *        ./reader [--mode=MODE] /dev/input/eventX /dev/input/eventY ...
+ *        ./reader [--mode=MODE] -a
  *
  * License: MIT
  */
@@ -21,118 +49,124 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+
+#include "keynames.h"
+#include "evcap.h"
+
+#define EVENT_BATCH 64                /* Events per read() */
+#define MAX_DEVICES 64                /* Devices watched by one monitor */
+#define INPUT_DIR   "/dev/input"
+#define MATCH_NAME  "Virtual PS/2"    /* Devices picked up by -a */
+#define PATH_LEN    (sizeof(INPUT_DIR) + 256)
+
+#define OUTPUT_BUFFER (64 * 1024)       /* stdout buffer, flushed per batch */
+#define LINE_LEN      256               /* Compact mode line per device */
+
+enum output_mode {
+    MODE_HUMAN,
+    MODE_COMPACT,
+    MODE_RAW,
+    MODE_QUIET,
+};
+
+static const char * const mode_names[] = {
+    [MODE_HUMAN]   = "human",
+    [MODE_COMPACT] = "compact",
+    [MODE_RAW]     = "raw",
+    [MODE_QUIET]   = "quiet",
+};
+
+static int output_mode = -1;  /* Chosen in main() */
+static int use_color;         /* Human mode on a terminal */
+static volatile sig_atomic_t stop;
+
+static const struct {
+    const char *name;
+    clockid_t id;
+} clock_names[] = {
+    { "realtime",  CLOCK_REALTIME },
+    { "monotonic", CLOCK_MONOTONIC },
+    { "boottime",  CLOCK_BOOTTIME },
+};
+
+static int clock_id = CLOCK_REALTIME;  /* evdev timestamps, see --clock */
+static int grab;                       /* EVIOCGRAB every device */
+static int show_syn = 1;               /* Human mode: print frame ends */
 
-/* Color codes for pretty output */
-#define COLOR_RESET   "\033[0m"
-#define COLOR_BLUE    "\033[1;34m"
-#define COLOR_GREEN   "\033[1;32m"
-#define COLOR_YELLOW  "\033[1;33m"
-#define COLOR_RED     "\033[1;31m"
-#define COLOR_CYAN    "\033[1;36m"
+/* Color codes for pretty output, empty when not writing to a terminal */
+#define COLOR_RESET   (use_color ? "\033[0m" : "")
+#define COLOR_BLUE    (use_color ? "\033[1;34m" : "")
+#define COLOR_GREEN   (use_color ? "\033[1;32m" : "")
+#define COLOR_YELLOW  (use_color ? "\033[1;33m" : "")
+#define COLOR_RED     (use_color ? "\033[1;31m" : "")
+#define COLOR_CYAN    (use_color ? "\033[1;36m" : "")
+
+/* Status messages go to stderr when stdout carries data */
+#define status_out (output_mode == MODE_HUMAN ? stdout : stderr)
 
 /*
- * Convert Linux keycode to readable string
+ * Convert a Linux key or button code to its name ("A", "LEFTSHIFT",
+ * "BTN_LEFT"). key_names comes from keynames.h, generated from
+ * linux/input-event-codes.h by the Makefile, so every code up to KEY_MAX
+ * is a single lookup. Unnamed codes are formatted into buf; nothing is
+ * shared between calls.
  */
-const char* keycode_to_string(unsigned int code)
-{
-    static char buffer[32];
-    
-    /* Common keys */
-    switch (code) {
-        case KEY_ESC: return "ESC";
-        case KEY_1: return "1";
-        case KEY_2: return "2";
-        case KEY_3: return "3";
-        case KEY_4: return "4";
-        case KEY_5: return "5";
-        case KEY_6: return "6";
-        case KEY_7: return "7";
-        case KEY_8: return "8";
-        case KEY_9: return "9";
-        case KEY_0: return "0";
-        case KEY_MINUS: return "MINUS";
-        case KEY_EQUAL: return "EQUAL";
-        case KEY_BACKSPACE: return "BACKSPACE";
-        case KEY_TAB: return "TAB";
-        case KEY_Q: return "Q";
-        case KEY_W: return "W";
-        case KEY_E: return "E";
-        case KEY_R: return "R";
-        case KEY_T: return "T";
-        case KEY_Y: return "Y";
-        case KEY_U: return "U";
-        case KEY_I: return "I";
-        case KEY_O: return "O";
-        case KEY_P: return "P";
-        case KEY_LEFTBRACE: return "LEFT_BRACE";
-        case KEY_RIGHTBRACE: return "RIGHT_BRACE";
-        case KEY_ENTER: return "ENTER";
-        case KEY_LEFTCTRL: return "LEFT_CTRL";
-        case KEY_A: return "A";
-        case KEY_S: return "S";
-        case KEY_D: return "D";
-        case KEY_F: return "F";
-        case KEY_G: return "G";
-        case KEY_H: return "H";
-        case KEY_J: return "J";
-        case KEY_K: return "K";
-        case KEY_L: return "L";
-        case KEY_SEMICOLON: return "SEMICOLON";
-        case KEY_APOSTROPHE: return "APOSTROPHE";
-        case KEY_GRAVE: return "GRAVE";
-        case KEY_LEFTSHIFT: return "LEFT_SHIFT";
-        case KEY_BACKSLASH: return "BACKSLASH";
-        case KEY_Z: return "Z";
-        case KEY_X: return "X";
-        case KEY_C: return "C";
-        case KEY_V: return "V";
-        case KEY_B: return "B";
-        case KEY_N: return "N";
-        case KEY_M: return "M";
-        case KEY_COMMA: return "COMMA";
-        case KEY_DOT: return "DOT";
-        case KEY_SLASH: return "SLASH";
-        case KEY_RIGHTSHIFT: return "RIGHT_SHIFT";
-        case KEY_KPASTERISK: return "KEYPAD_*";
-        case KEY_LEFTALT: return "LEFT_ALT";
-        case KEY_SPACE: return "SPACE";
-        case KEY_CAPSLOCK: return "CAPS_LOCK";
-        case KEY_F1: return "F1";
-        case KEY_F2: return "F2";
-        case KEY_F3: return "F3";
-        case KEY_F4: return "F4";
-        case KEY_F5: return "F5";
-        case KEY_F6: return "F6";
-        case KEY_F7: return "F7";
-        case KEY_F8: return "F8";
-        case KEY_F9: return "F9";
-        case KEY_F10: return "F10";
-        case BTN_LEFT: return "MOUSE_LEFT";
-        case BTN_RIGHT: return "MOUSE_RIGHT";
-        case BTN_MIDDLE: return "MOUSE_MIDDLE";
-        default:
-            snprintf(buffer, sizeof(buffer), "KEY_%u", code);
-            return buffer;
-    }
+const char *keycode_to_string(unsigned int code, char *buf, size_t len)
+{
+    if (code <= KEY_MAX && key_names[code])
+        return key_names[code];
+    
+    snprintf(buf, len, "KEY_%u", code);
+    return buf;
 }
 
 /*
- * Get current timestamp string
+ * Format the event's own timestamp, as set by evdev: HH:MM:SS.uuuuuu on
+ * the wall clock, seconds.uuuuuu on the others. Only the microseconds
+ * change within a second, so the rest is cached.
  */
-void get_timestamp(char *buf, size_t len)
+void get_timestamp(const struct input_event *ev, char *buf, size_t len)
 {
-    time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
-    strftime(buf, len, "%H:%M:%S", tm_info);
+    static time_t cached_sec = -1;
+    static char cached[32];
+    time_t sec = ev->input_event_sec;
+    struct tm tm_info;
+    
+    if (clock_id != CLOCK_REALTIME) {
+        snprintf(buf, len, "%ld.%06ld", (long)sec, (long)ev->input_event_usec);
+        return;
+    }
+    
+    if (sec != cached_sec) {
+        localtime_r(&sec, &tm_info);
+        strftime(cached, sizeof(cached), "%H:%M:%S", &tm_info);
+        cached_sec = sec;
+    }
+    snprintf(buf, len, "%s.%06ld", cached, (long)ev->input_event_usec);
 }
 
 /*
  * Print event in human-readable format
  */
-void print_event(struct input_event *ev)
+void print_event(const struct input_event *ev, const char *tag)
 {
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
+    char timestamp[64], name[16];
+    get_timestamp(ev, timestamp, sizeof(timestamp));
+    
+    /* In monitor mode the source node goes next to the time */
+    if (tag) {
+        size_t len = strlen(timestamp);
+        snprintf(timestamp + len, sizeof(timestamp) - len, " %s", tag);
+    }
     
     /* Event type */
     switch (ev->type) {
@@ -143,7 +177,7 @@ void print_event(struct input_event *ev)
                 printf("%s[%s]%s %sMOUSE_BTN%s %-15s %s%s%s\n",
                        COLOR_CYAN, timestamp, COLOR_RESET,
                        COLOR_YELLOW, COLOR_RESET,
-                       keycode_to_string(ev->code),
+                       keycode_to_string(ev->code, name, sizeof(name)),
                        ev->value ? COLOR_GREEN : COLOR_RED,
                        ev->value ? "PRESSED" : "RELEASED",
                        COLOR_RESET);
@@ -152,7 +186,7 @@ void print_event(struct input_event *ev)
                 printf("%s[%s]%s %sKEY%s       %-15s %s%s%s\n",
                        COLOR_CYAN, timestamp, COLOR_RESET,
                        COLOR_BLUE, COLOR_RESET,
-                       keycode_to_string(ev->code),
+                       keycode_to_string(ev->code, name, sizeof(name)),
                        ev->value ? COLOR_GREEN : COLOR_RED,
                        ev->value ? "PRESSED" : "RELEASED",
                        COLOR_RESET);
@@ -176,6 +210,11 @@ void print_event(struct input_event *ev)
                        COLOR_CYAN, timestamp, COLOR_RESET,
                        COLOR_YELLOW, COLOR_RESET,
                        ev->value);
+            } else if (ev->code == REL_WHEEL_HI_RES) {
+                printf("%s[%s]%s %sMOUSE%s     WHEEL_HI_RES: %+4d\n",
+                       COLOR_CYAN, timestamp, COLOR_RESET,
+                       COLOR_YELLOW, COLOR_RESET,
+                       ev->value);
             } else {
                 printf("%s[%s]%s %sREL%s       code=%u value=%d\n",
                        COLOR_CYAN, timestamp, COLOR_RESET,
@@ -194,10 +233,14 @@ void print_event(struct input_event *ev)
             
         case EV_SYN:
             /* Synchronization event - indicates end of event group */
-            if (ev->code == SYN_REPORT) {
+            if (ev->code == SYN_REPORT && show_syn) {
                 printf("%s[%s]%s %s--- EVENT COMPLETE ---%s\n",
                        COLOR_CYAN, timestamp, COLOR_RESET,
                        COLOR_RESET, COLOR_RESET);
+            } else if (ev->code == SYN_DROPPED) {
+                printf("%s[%s]%s %s--- EVENTS DROPPED (reader fell behind) ---%s\n",
+                       COLOR_CYAN, timestamp, COLOR_RESET,
+                       COLOR_RED, COLOR_RESET);
             }
             break;
             
@@ -216,8 +259,6 @@ void print_event(struct input_event *ev)
                    ev->type, ev->code, ev->value);
             break;
     }
-    
-    fflush(stdout);
 }
 
 /*
@@ -232,69 +273,1090 @@ int get_device_name(int fd, char *name, size_t len)
 }
 
 /*
- * Main function
+ * Event Selection
+ * --types and --codes build one EVIOCSMASK mask of event types and one
+ * mask of codes per type with a --codes list. evdev then drops the other
+ * events before queueing them, and a frame left empty is dropped with
+ * its SYN_REPORT, so no wakeup happens for it at all. EV_SYN itself
+ * cannot be masked; unless "syn" is selected, human mode just stops
+ * printing the SYN_REPORT lines.
  */
-int main(int argc, char *argv[])
+#define LONG_BITS     (8 * sizeof(unsigned long))
+#define MASK_LONGS(n) (((n) + LONG_BITS - 1) / LONG_BITS)
+
+static const struct {
+    const char *name;
+    unsigned int type;
+    unsigned int codes;  /* Codes evdev can mask, 0 = type only */
+} type_names[] = {
+    { "syn",       EV_SYN,       0 },
+    { "key",       EV_KEY,       KEY_CNT },
+    { "rel",       EV_REL,       REL_CNT },
+    { "abs",       EV_ABS,       ABS_CNT },
+    { "msc",       EV_MSC,       MSC_CNT },
+    { "sw",        EV_SW,        SW_CNT },
+    { "led",       EV_LED,       LED_CNT },
+    { "snd",       EV_SND,       SND_CNT },
+    { "rep",       EV_REP,       0 },
+    { "ff",        EV_FF,        FF_CNT },
+    { "pwr",       EV_PWR,       0 },
+    { "ff_status", EV_FF_STATUS, 0 },
+};
+
+#define NUM_TYPES (sizeof(type_names) / sizeof(type_names[0]))
+
+static int filtering;                               /* --types or --codes given */
+static unsigned long type_mask[MASK_LONGS(EV_CNT)];
+static unsigned long code_masks[EV_CNT][MASK_LONGS(KEY_CNT)];
+static unsigned char code_masked[EV_CNT];           /* Type has a --codes list */
+
+static void mask_set(unsigned long *mask, unsigned int bit)
+{
+    mask[bit / LONG_BITS] |= 1UL << (bit % LONG_BITS);
+}
+
+/* Index into type_names of a name or number, -1 if unknown */
+int parse_type(const char *name)
+{
+    unsigned long v;
+    size_t i;
+    char *end;
+    
+    for (i = 0; i < NUM_TYPES; i++) {
+        if (strcasecmp(name, type_names[i].name) == 0)
+            return i;
+    }
+    
+    v = strtoul(name, &end, 0);
+    for (i = 0; *name && !*end && i < NUM_TYPES; i++) {
+        if (type_names[i].type == v)
+            return i;
+    }
+    return -1;
+}
+
+/* A code of type t: a number, or for keys a name as printed ("A", "BTN_LEFT") */
+int parse_code(int t, const char *name, unsigned int *code)
+{
+    unsigned long v;
+    unsigned int i;
+    char *end;
+    
+    v = strtoul(name, &end, 0);
+    if (*name && !*end) {
+        *code = v;
+        return v < type_names[t].codes ? 0 : -1;
+    }
+    
+    if (type_names[t].type != EV_KEY)
+        return -1;
+    if (strncasecmp(name, "KEY_", 4) == 0)
+        name += 4;
+    for (i = 0; i <= KEY_MAX; i++) {
+        if (key_names[i] && strcasecmp(name, key_names[i]) == 0) {
+            *code = i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* --types key,rel,... */
+int parse_types(const char *list)
+{
+    char buf[256], *tok, *save;
+    int t;
+    
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        t = parse_type(tok);
+        if (t < 0) {
+            fprintf(stderr, "Error: Unknown event type '%s'\n", tok);
+            return -1;
+        }
+        mask_set(type_mask, type_names[t].type);
+    }
+    filtering = 1;
+    return 0;
+}
+
+/* --codes key:A,key:30-38,rel:0x08,... */
+int parse_codes(const char *list)
 {
+    char buf[1024], *tok, *save, *sep, *hi;
+    unsigned int lo_code, hi_code, code, type;
+    int t;
+    
+    snprintf(buf, sizeof(buf), "%s", list);
+    for (tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        sep = strchr(tok, ':');
+        if (!sep) {
+            fprintf(stderr, "Error: '%s' is not TYPE:CODE[-CODE]\n", tok);
+            return -1;
+        }
+        *sep++ = '\0';
+        t = parse_type(tok);
+        if (t < 0 || !type_names[t].codes) {
+            fprintf(stderr, "Error: Codes of type '%s' cannot be selected\n", tok);
+            return -1;
+        }
+    
+        hi = strchr(sep, '-');
+        if (hi)
+            *hi++ = '\0';
+        if (parse_code(t, sep, &lo_code) < 0 ||
+            parse_code(t, hi ? hi : sep, &hi_code) < 0 || hi_code < lo_code) {
+            fprintf(stderr, "Error: Bad %s code '%s%s%s'\n", type_names[t].name,
+                    sep, hi ? "-" : "", hi ? hi : "");
+            return -1;
+        }
+    
+        type = type_names[t].type;
+        for (code = lo_code; code <= hi_code; code++)
+            mask_set(code_masks[type], code);
+        code_masked[type] = 1;
+        mask_set(type_mask, type);
+    }
+    filtering = 1;
+    return 0;
+}
+
+/*
+ * Apply --clock, the event masks and --grab to a freshly opened device
+ * Returns -1 with errno set if the kernel refused one of them.
+ */
+int setup_device(int fd)
+{
+    struct input_mask mask;
+    unsigned int type;
+    
+    if (clock_id != CLOCK_REALTIME && ioctl(fd, EVIOCSCLOCKID, &clock_id) < 0)
+        return -1;
+    
+    if (filtering) {
+        /* EV_SYN stands for the mask of event types */
+        mask.type = EV_SYN;
+        mask.codes_size = sizeof(type_mask);
+        mask.codes_ptr = (uintptr_t)type_mask;
+        if (ioctl(fd, EVIOCSMASK, &mask) < 0)
+            return -1;
+    
+        for (type = 0; type < EV_CNT; type++) {
+            if (!code_masked[type])
+                continue;
+            mask.type = type;
+            mask.codes_size = sizeof(code_masks[type]);
+            mask.codes_ptr = (uintptr_t)code_masks[type];
+            if (ioctl(fd, EVIOCSMASK, &mask) < 0)
+                return -1;
+        }
+    }
+    
+    if (grab && ioctl(fd, EVIOCGRAB, 1) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * One watched device
+ * evdev only returns whole events, but a reader must not rely on it:
+ * a trailing partial event is kept in the buffer and completed by the
+ * next read.
+ */
+struct reader_dev {
     int fd;
-    struct input_event ev;
+    char path[PATH_LEN];
+    char tag[16];  /* "event5", empty when reading a single device */
+    char line[LINE_LEN];  /* Compact mode: fields of the open frame */
+    size_t line_len;
+    union {
+        struct input_event events[EVENT_BATCH];
+        unsigned char bytes[EVENT_BATCH * sizeof(struct input_event)];
+    };
+    size_t fill;   /* Bytes of a partial event carried over */
+    int dropping;  /* Skipping to SYN_REPORT after SYN_DROPPED */
+    int rec_id;    /* Capture device id, 0 until declared */
+};
+
+/*
+ * Compact Mode
+ * One line per frame: "<sec>.<usec> [<tag>] <field>..." where a field is
+ * KEY=1 (press), KEY=0 (release), KEY=2 (repeat), X=+5, SCAN=0x1e, ...
+ * A frame too long for the line is split over several.
+ */
+void compact_field(const struct input_event *ev, char *buf, size_t len)
+{
+    char name[16];
+    
+    switch (ev->type) {
+        case EV_KEY:
+            snprintf(buf, len, "%s=%d",
+                     keycode_to_string(ev->code, name, sizeof(name)), ev->value);
+            break;
+        case EV_REL:
+            if (ev->code == REL_X)
+                snprintf(buf, len, "X=%+d", ev->value);
+            else if (ev->code == REL_Y)
+                snprintf(buf, len, "Y=%+d", ev->value);
+            else if (ev->code == REL_WHEEL)
+                snprintf(buf, len, "WHEEL=%+d", ev->value);
+            else if (ev->code == REL_WHEEL_HI_RES)
+                snprintf(buf, len, "WHEEL_HI_RES=%+d", ev->value);
+            else
+                snprintf(buf, len, "REL%u=%+d", ev->code, ev->value);
+            break;
+        case EV_MSC:
+            if (ev->code == MSC_SCAN)
+                snprintf(buf, len, "SCAN=0x%02x", ev->value);
+            else
+                snprintf(buf, len, "MSC%u=%d", ev->code, ev->value);
+            break;
+        default:
+            snprintf(buf, len, "%u:%u=%d", ev->type, ev->code, ev->value);
+            break;
+    }
+}
+
+void compact_flush(struct reader_dev *dev)
+{
+    if (!dev->line_len)
+        return;
+    
+    fwrite(dev->line, 1, dev->line_len, stdout);
+    putchar('\n');
+    dev->line_len = 0;
+}
+
+void compact_event(struct reader_dev *dev, const struct input_event *ev)
+{
+    char field[64];
+    int n;
+    
+    if (ev->type == EV_SYN) {
+        if (ev->code == SYN_DROPPED) {
+            compact_flush(dev);
+            printf("%ld.%06ld%s%s DROPPED\n", (long)ev->input_event_sec,
+                   (long)ev->input_event_usec, dev->tag[0] ? " " : "", dev->tag);
+        } else if (ev->code == SYN_REPORT) {
+            compact_flush(dev);
+        }
+        return;
+    }
+    
+    compact_field(ev, field, sizeof(field));
+    if (dev->line_len && dev->line_len + 1 + strlen(field) >= LINE_LEN)
+        compact_flush(dev);
+    if (!dev->line_len) {
+        n = snprintf(dev->line, LINE_LEN, "%ld.%06ld%s%s",
+                     (long)ev->input_event_sec, (long)ev->input_event_usec,
+                     dev->tag[0] ? " " : "", dev->tag);
+        dev->line_len = n;
+    }
+    n = snprintf(dev->line + dev->line_len, LINE_LEN - dev->line_len, " %s",
+                 field);
+    dev->line_len += n;
+    if (dev->line_len >= LINE_LEN)
+        dev->line_len = LINE_LEN - 1;  /* Truncated by snprintf */
+}
+
+/*
+ * Quiet Mode
+ * Counts instead of printing; the totals go out at most once per second
+ * (checked per batch) and at exit.
+ */
+struct counters {
+    unsigned long long events;
+    unsigned long long frames;
+    unsigned long long keys;
+    unsigned long long buttons;
+    unsigned long long motion;
+    unsigned long long dropped;  /* SYN_DROPPED, i.e. overruns */
+};
+
+static struct counters totals;
+static time_t last_report;
+
+void count_event(const struct input_event *ev)
+{
+    totals.events++;
+    switch (ev->type) {
+        case EV_KEY:
+            if (ev->code >= BTN_MOUSE && ev->code < BTN_JOYSTICK)
+                totals.buttons++;
+            else
+                totals.keys++;
+            break;
+        case EV_REL:
+            totals.motion++;
+            break;
+        case EV_SYN:
+            if (ev->code == SYN_REPORT)
+                totals.frames++;
+            else if (ev->code == SYN_DROPPED)
+                totals.dropped++;
+            break;
+    }
+}
+
+void print_counters(void)
+{
+    printf("events=%llu frames=%llu keys=%llu buttons=%llu motion=%llu dropped=%llu\n",
+           totals.events, totals.frames, totals.keys, totals.buttons,
+           totals.motion, totals.dropped);
+}
+
+void maybe_print_counters(void)
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec == last_report)
+        return;
+    if (last_report)
+        print_counters();  /* Not on the first batch, nothing to report yet */
+    last_report = now.tv_sec;
+}
+
+/*
+ * Capture
+ * Events are recorded as delivered, SYN_DROPPED and the broken frame
+ * included, so the analyzer sees what the device sent. Each device is
+ * declared on its first batch; the file is flushed once per batch.
+ */
+static FILE *record_file;
+static int record_next_id = 1;
+static int record_current;          /* Device of the last recorded event */
+static int record_timed;            /* Time base written this session */
+static uint64_t record_last_us;
+static int record_failed;
+
+/* Open for appending; a new file gets the header, an old one must have it */
+int record_open(const char *path)
+{
+    char magic[EVCAP_HEADER_LEN];
+    struct stat st;
+    
+    record_file = fopen(path, "a+b");
+    if (!record_file)
+        return -1;
+    setvbuf(record_file, NULL, _IOFBF, OUTPUT_BUFFER);
+    
+    if (fstat(fileno(record_file), &st) < 0)
+        return -1;
+    if (!st.st_size) {
+        fwrite(EVCAP_MAGIC, 1, EVCAP_MAGIC_LEN, record_file);
+        putc(EVCAP_VERSION, record_file);
+        return 0;
+    }
+    if (fread(magic, 1, sizeof(magic), record_file) != sizeof(magic) ||
+        memcmp(magic, EVCAP_MAGIC, EVCAP_MAGIC_LEN) != 0 ||
+        magic[EVCAP_MAGIC_LEN] != EVCAP_VERSION) {
+        errno = EINVAL;  /* Not a capture of this version */
+        return -1;
+    }
+    return 0;
+}
+
+void record_string(const char *str)
+{
+    unsigned char len[EVCAP_VARINT_MAX];
+    size_t n = strlen(str);
+    
+    fwrite(len, 1, evcap_put_varint(len, n), record_file);
+    fwrite(str, 1, n, record_file);
+}
+
+void record_declare(struct reader_dev *dev)
+{
+    unsigned char buf[1 + EVCAP_VARINT_MAX];
+    char name[256] = "Unknown Device";
+    size_t n = 0;
+    
+    get_device_name(dev->fd, name, sizeof(name));
+    dev->rec_id = record_next_id++;
+    buf[n++] = EVCAP_DEVICE;
+    n += evcap_put_varint(buf + n, dev->rec_id);
+    fwrite(buf, 1, n, record_file);
+    record_string(name);
+    record_string(dev->path);
+    record_current = dev->rec_id;
+}
+
+void record_events(struct reader_dev *dev, size_t count)
+{
+    /* Worst case per event: TIME record plus the event record */
+    unsigned char buf[EVENT_BATCH * (2 + 5 * EVCAP_VARINT_MAX) + 1 + EVCAP_VARINT_MAX];
+    size_t i, n = 0;
+    uint64_t us;
+    
+    if (!dev->rec_id) {
+        record_declare(dev);
+    } else if (dev->rec_id != record_current) {
+        buf[n++] = EVCAP_SELECT;
+        n += evcap_put_varint(buf + n, dev->rec_id);
+        record_current = dev->rec_id;
+    }
+    
+    for (i = 0; i < count; i++) {
+        const struct input_event *ev = &dev->events[i];
+        
+        us = (uint64_t)ev->input_event_sec * 1000000 + ev->input_event_usec;
+        if (!record_timed || us < record_last_us) {
+            buf[n++] = EVCAP_TIME;
+            n += evcap_put_varint(buf + n, ev->input_event_sec);
+            n += evcap_put_varint(buf + n, ev->input_event_usec);
+            record_last_us = us;
+            record_timed = 1;
+        }
+        buf[n++] = ev->type <= EVCAP_TYPE_MAX ? ev->type : EVCAP_TYPE_MAX;
+        n += evcap_put_varint(buf + n, us - record_last_us);
+        n += evcap_put_varint(buf + n, ev->code);
+        n += evcap_put_varint(buf + n, evcap_zigzag(ev->value));
+        record_last_us = us;
+    }
+    fwrite(buf, 1, n, record_file);
+}
+
+/* Flush the batch; a full disk ends the run rather than losing events silently */
+void record_flush(void)
+{
+    if (fflush(record_file) == 0)
+        return;
+    fprintf(stderr, "\nError: Cannot write capture: %s\n", strerror(errno));
+    record_failed = 1;
+    stop = 1;
+}
+
+/* Returns -1 if any part of the capture could not be written */
+int record_close(void)
+{
+    if (!record_file)
+        return 0;
+    if (fclose(record_file) != 0 && !record_failed) {
+        fprintf(stderr, "\nError: Cannot write capture: %s\n", strerror(errno));
+        record_failed = 1;
+    }
+    return record_failed ? -1 : 0;
+}
+
+/*
+ * Event batch processing
+ * After SYN_DROPPED, evdev discards events up to the next SYN_REPORT
+ * from the client's point of view: the events of the broken frame are
+ * incomplete and are skipped.
+ */
+void output_event(struct reader_dev *dev, const struct input_event *ev)
+{
+    switch (output_mode) {
+        case MODE_HUMAN:
+            print_event(ev, dev->tag[0] ? dev->tag : NULL);
+            break;
+        case MODE_COMPACT:
+            compact_event(dev, ev);
+            break;
+        case MODE_QUIET:
+            count_event(ev);
+            break;
+    }
+}
+
+void process_events(struct reader_dev *dev, size_t count)
+{
+    size_t i;
+    
+    if (record_file) {
+        record_events(dev, count);
+        record_flush();
+    }
+    
+    /* Passthrough: the stream as evdev delivered it */
+    if (output_mode == MODE_RAW) {
+        fwrite(dev->events, sizeof(struct input_event), count, stdout);
+        fflush(stdout);
+        return;
+    }
+    
+    for (i = 0; i < count; i++) {
+        const struct input_event *ev = &dev->events[i];
+        
+        if (ev->type == EV_SYN && ev->code == SYN_DROPPED) {
+            output_event(dev, ev);
+            dev->dropping = 1;
+            continue;
+        }
+        if (dev->dropping) {
+            if (ev->type == EV_SYN && ev->code == SYN_REPORT)
+                dev->dropping = 0;
+            continue;
+        }
+        output_event(dev, ev);
+    }
+    
+    /* One write per batch instead of one per line */
+    if (output_mode == MODE_QUIET)
+        maybe_print_counters();
+    fflush(stdout);
+}
+
+/*
+ * Read and process one batch
+ * Returns 1 if events were read, 0 on EOF, -1 with errno set on error
+ * (EAGAIN when a non-blocking device is drained).
+ */
+int read_batch(struct reader_dev *dev)
+{
+    size_t whole;
     ssize_t bytes;
+    
+    bytes = read(dev->fd, dev->bytes + dev->fill, sizeof(dev->bytes) - dev->fill);
+    if (bytes <= 0)
+        return bytes < 0 ? -1 : 0;
+    
+    dev->fill += bytes;
+    whole = dev->fill / sizeof(struct input_event);
+    process_events(dev, whole);
+    
+    /* Move the partial tail, if any, to the front */
+    dev->fill -= whole * sizeof(struct input_event);
+    if (dev->fill)
+        memmove(dev->bytes, dev->bytes + whole * sizeof(struct input_event),
+                dev->fill);
+    
+    return 1;
+}
+
+/*
+ * Drain a non-blocking device
+ * Returns 1 once it would block, 0 on EOF, -1 on error.
+ */
+int drain_device(struct reader_dev *dev)
+{
+    int ret;
+    
+    do {
+        ret = read_batch(dev);
+    } while (!stop && (ret > 0 || (ret < 0 && errno == EINTR)));
+    
+    if (ret < 0 && errno == EAGAIN)
+        return 1;
+    return ret;
+}
+
+/*
+ * Blocking mode: each read() sleeps until at least one event is ready
+ */
+int run_blocking(struct reader_dev *dev)
+{
+    int ret;
+    
+    while (!stop) {
+        ret = read_batch(dev);
+        if (ret > 0)
+            continue;
+        if (ret < 0 && errno == EINTR) {
+            if (stop)
+                return 0;
+            continue;  /* Interrupted by signal, continue */
+        }
+        return ret;
+    }
+    return 0;
+}
+
+/*
+ * Non-blocking mode: sleep in poll(), then drain until EAGAIN
+ */
+int run_nonblocking(struct reader_dev *dev)
+{
+    struct pollfd pfd = { .fd = dev->fd, .events = POLLIN };
+    int ret;
+    
+    while (!stop) {
+        ret = poll(&pfd, 1, -1);
+        if (ret < 0) {
+            if (errno == EINTR && !stop)
+                continue;
+            return stop ? 0 : -1;
+        }
+        if (!(pfd.revents & POLLIN)) {
+            errno = ENODEV;  /* POLLERR/POLLHUP: device removed */
+            return -1;
+        }
+    
+        ret = drain_device(dev);
+        if (ret <= 0)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * Multi-Device Monitor
+ * Every device is non-blocking and registered with epoll; the epoll data
+ * points at its reader_dev, or at inotify_tag for the /dev/input watch.
+ * Nodes usually appear before udev has made them readable, so IN_ATTRIB
+ * retries a node whose open failed on IN_CREATE.
+ */
+static struct reader_dev *devices[MAX_DEVICES];
+static int num_devices;
+static int epoll_fd = -1;
+static int inotify_tag;
+
+struct reader_dev *find_device(const char *path)
+{
+    int i;
+    
+    for (i = 0; i < num_devices; i++) {
+        if (strcmp(devices[i]->path, path) == 0)
+            return devices[i];
+    }
+    return NULL;
+}
+
+int is_watched(const struct reader_dev *dev)
+{
+    int i;
+    
+    for (i = 0; i < num_devices; i++) {
+        if (devices[i] == dev)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * Open and watch one device. With match set, devices whose name does not
+ * contain MATCH_NAME are skipped. Returns 1 if added, 0 if skipped or
+ * already watched, -1 with errno set on error.
+ */
+int monitor_add(const char *path, int match)
+{
+    struct epoll_event ev = { .events = EPOLLIN };
+    char name[256] = "Unknown Device", phys[64] = "";
+    struct reader_dev *dev;
+    char tmp[PATH_LEN];
+    int fd;
+    
+    if (find_device(path))
+        return 0;
+    if (num_devices == MAX_DEVICES) {
+        errno = ENOSPC;
+        return -1;
+    }
+    
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    
+    get_device_name(fd, name, sizeof(name));
+    if (match && !strstr(name, MATCH_NAME)) {
+        close(fd);
+        return 0;
+    }
+    if (setup_device(fd) < 0) {
+        if (match)
+            fprintf(status_out, "%s! %s: %s: %s%s\n", COLOR_RED, path, name,
+                    strerror(errno), COLOR_RESET);
+        close(fd);
+        return -1;
+    }
+    ioctl(fd, EVIOCGPHYS(sizeof(phys)), phys);
+    
+    dev = calloc(1, sizeof(*dev));
+    if (!dev) {
+        close(fd);
+        return -1;
+    }
+    dev->fd = fd;
+    snprintf(dev->path, sizeof(dev->path), "%s", path);
+    snprintf(tmp, sizeof(tmp), "%s", path);
+    snprintf(dev->tag, sizeof(dev->tag), "%s", basename(tmp));
+    
+    ev.data.ptr = dev;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(fd);
+        free(dev);
+        return -1;
+    }
+    devices[num_devices++] = dev;
+    
+    fprintf(status_out, "%s+ %s: %s%s%s%s%s\n", COLOR_GREEN, dev->tag, name,
+            phys[0] ? " (" : "", phys, phys[0] ? ")" : "", COLOR_RESET);
+    fflush(status_out);
+    return 1;
+}
+
+void monitor_remove(struct reader_dev *dev, const char *why)
+{
+    int i;
+    
+    for (i = 0; i < num_devices; i++) {
+        if (devices[i] == dev) {
+            devices[i] = devices[--num_devices];
+            break;
+        }
+    }
+    
+    if (output_mode == MODE_COMPACT)
+        compact_flush(dev);
+    fprintf(status_out, "%s- %s: %s%s\n", COLOR_RED, dev->tag, why, COLOR_RESET);
+    fflush(status_out);
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, dev->fd, NULL);
+    close(dev->fd);
+    free(dev);
+}
+
+/* Add every matching eventN node that exists right now */
+void monitor_scan(void)
+{
+    char path[PATH_LEN];
+    struct dirent *de;
+    DIR *dir;
+    
+    dir = opendir(INPUT_DIR);
+    if (!dir)
+        return;
+    
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "event", 5) != 0)
+            continue;
+        snprintf(path, sizeof(path), INPUT_DIR "/%s", de->d_name);
+        monitor_add(path, 1);
+    }
+    closedir(dir);
+}
+
+/* Node hot-add and removal, from the /dev/input inotify watch */
+void monitor_inotify(int fd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ie;
+    struct reader_dev *dev;
+    char path[PATH_LEN];
+    ssize_t len;
+    char *p;
+    
+    while ((len = read(fd, buf, sizeof(buf))) > 0) {
+        for (p = buf; p < buf + len; p += sizeof(*ie) + ie->len) {
+            ie = (const struct inotify_event *)p;
+            if (!ie->len || strncmp(ie->name, "event", 5) != 0)
+                continue;
+    
+            snprintf(path, sizeof(path), INPUT_DIR "/%s", ie->name);
+            if (ie->mask & (IN_CREATE | IN_ATTRIB)) {
+                monitor_add(path, 1);  /* Not yet readable: retried on IN_ATTRIB */
+            } else if (ie->mask & IN_DELETE) {
+                dev = find_device(path);
+                if (dev)
+                    monitor_remove(dev, "removed");
+            }
+        }
+    }
+}
+
+/*
+ * Monitor mode: the given devices, or with discover every matching one,
+ * present and future. Returns when no device is left to watch (only
+ * without discover) or on error.
+ */
+int run_monitor(char **paths, int count, int discover)
+{
+    struct epoll_event events[16];
+    struct epoll_event ev = { .events = EPOLLIN };
+    struct reader_dev *dev;
+    int inotify_fd = -1;
+    int i, n, ret;
+    
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0)
+        return -1;
+    
+    if (discover) {
+        /* Watch first, then scan, so no node can slip in between */
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd < 0 ||
+            inotify_add_watch(inotify_fd, INPUT_DIR,
+                              IN_CREATE | IN_ATTRIB | IN_DELETE) < 0)
+            return -1;
+        ev.data.ptr = &inotify_tag;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &ev) < 0)
+            return -1;
+        monitor_scan();
+        if (!num_devices)
+            fprintf(status_out, "Waiting for \"%s\" devices...\n", MATCH_NAME);
+    }
+    
+    for (i = 0; i < count; i++) {
+        if (monitor_add(paths[i], 0) < 0) {
+            fprintf(stderr, "Error: Cannot open %s: %s\n", paths[i],
+                    strerror(errno));
+            return -1;
+        }
+    }
+    fflush(stdout);
+    
+    while (!stop && (discover || num_devices)) {
+        n = epoll_wait(epoll_fd, events, 16, -1);
+        if (n < 0) {
+            if (errno == EINTR && !stop)
+                continue;
+            return stop ? 0 : -1;
+        }
+    
+        for (i = 0; i < n; i++) {
+            if (events[i].data.ptr == &inotify_tag) {
+                monitor_inotify(inotify_fd);
+                continue;
+            }
+    
+            dev = events[i].data.ptr;
+            if (!is_watched(dev))
+                continue;  /* Removed earlier in this batch */
+            ret = (events[i].events & EPOLLIN) ? drain_device(dev) : 0;
+            if (ret <= 0)
+                monitor_remove(dev, ret < 0 ? strerror(errno) : "disconnected");
+        }
+    }
+    
+    return 0;
+}
+
+void handle_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] /dev/input/eventX\n", prog);
+    fprintf(stderr, "       %s [options] /dev/input/eventX /dev/input/eventY ...\n", prog);
+    fprintf(stderr, "       %s [options] -a [/dev/input/eventX ...]\n", prog);
+    fprintf(stderr, "\n  -n, --nonblock  Non-blocking reads driven by poll() (one device)\n");
+    fprintf(stderr, "  -a, --all       Watch every \"%s\" device, including hot-added ones\n",
+            MATCH_NAME);
+    fprintf(stderr, "  -m, --mode=MODE human, compact, raw or quiet (default: human on a\n");
+    fprintf(stderr, "                  terminal, compact otherwise)\n");
+    fprintf(stderr, "  -q, --quiet     Same as --mode=quiet: counters only\n");
+    fprintf(stderr, "  -r, --record=FILE\n");
+    fprintf(stderr, "                  Append the events to FILE in the compact capture\n");
+    fprintf(stderr, "                  format (see analyzer); quiet unless --mode is given\n");
+    fprintf(stderr, "  -t, --types=LIST\n");
+    fprintf(stderr, "                  Only these event types, filtered in the kernel:\n");
+    fprintf(stderr, "                  syn,key,rel,abs,msc,sw,led,snd,rep,ff,pwr,ff_status\n");
+    fprintf(stderr, "                  or numbers (frame ends are shown only with syn)\n");
+    fprintf(stderr, "  -c, --codes=LIST\n");
+    fprintf(stderr, "                  Only these codes of their type, TYPE:CODE[-CODE],...\n");
+    fprintf(stderr, "                  CODE is a number or, for keys, a name (key:A,key:BTN_LEFT)\n");
+    fprintf(stderr, "  -k, --clock=CLOCK\n");
+    fprintf(stderr, "                  Event timestamps: realtime (default), monotonic or\n");
+    fprintf(stderr, "                  boottime\n");
+    fprintf(stderr, "  -g, --grab      Exclusive access: nobody else receives the events\n");
+    fprintf(stderr, "\nExample:\n");
+    fprintf(stderr, "  %s /dev/input/event0\n", prog);
+    fprintf(stderr, "  %s --mode=raw /dev/input/event0 > events.bin\n", prog);
+    fprintf(stderr, "  %s -a --record capture.vevc\n", prog);
+    fprintf(stderr, "  %s --codes key:Q-P --clock monotonic --grab /dev/input/event0\n", prog);
+    fprintf(stderr, "\nTip: Use 'cat /proc/bus/input/devices' to find devices\n");
+}
+
+int parse_mode(const char *name)
+{
+    size_t i;
+    
+    for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); i++) {
+        if (strcmp(name, mode_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int parse_clock(const char *name)
+{
+    size_t i;
+    
+    for (i = 0; i < sizeof(clock_names) / sizeof(clock_names[0]); i++) {
+        if (strcmp(name, clock_names[i].name) == 0)
+            return clock_names[i].id;
+    }
+    return -1;
+}
+
+/*
+ * Main function
+ */
+int main(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        { "nonblock", no_argument,       NULL, 'n' },
+        { "all",      no_argument,       NULL, 'a' },
+        { "mode",     required_argument, NULL, 'm' },
+        { "quiet",    no_argument,       NULL, 'q' },
+        { "record",   required_argument, NULL, 'r' },
+        { "types",    required_argument, NULL, 't' },
+        { "codes",    required_argument, NULL, 'c' },
+        { "clock",    required_argument, NULL, 'k' },
+        { "grab",     no_argument,       NULL, 'g' },
+        { NULL, 0, NULL, 0 },
+    };
+    static struct reader_dev single;
+    struct sigaction sa = { .sa_handler = handle_signal };
     char device_name[256] = "Unknown Device";
+    const char *path, *record_path = NULL;
+    int nonblock = 0, discover = 0, syn_selected;
+    int i, ret, opt;
+    
+    while ((opt = getopt_long(argc, argv, "nam:qr:t:c:k:g", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n':
+                nonblock = 1;
+                break;
+            case 'a':
+                discover = 1;
+                break;
+            case 'm':
+                output_mode = parse_mode(optarg);
+                if (output_mode < 0) {
+                    fprintf(stderr, "Error: Unknown mode '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'q':
+                output_mode = MODE_QUIET;
+                break;
+            case 'r':
+                record_path = optarg;
+                break;
+            case 't':
+                if (parse_types(optarg) < 0)
+                    return 1;
+                break;
+            case 'c':
+                if (parse_codes(optarg) < 0)
+                    return 1;
+                break;
+            case 'k':
+                clock_id = parse_clock(optarg);
+                if (clock_id < 0) {
+                    fprintf(stderr, "Error: Unknown clock '%s'\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'g':
+                grab = 1;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
     
     /* Check arguments */
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s /dev/input/eventX\n", argv[0]);
-        fprintf(stderr, "\nExample:\n");
-        fprintf(stderr, "  %s /dev/input/event0\n", argv[0]);
-        fprintf(stderr, "\nTip: Use 'cat /proc/bus/input/devices' to find devices\n");
+    if (!discover && optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    
+    /* EV_SYN is never masked, selecting it only shows the frame ends */
+    syn_selected = type_mask[0] & (1UL << EV_SYN);
+    show_syn = !filtering || syn_selected;
+    
+    if (output_mode < 0 && record_path)
+        output_mode = MODE_QUIET;
+    if (output_mode < 0)
+        output_mode = isatty(STDOUT_FILENO) ? MODE_HUMAN : MODE_COMPACT;
+    use_color = output_mode == MODE_HUMAN && isatty(STDOUT_FILENO);
+    
+    if (record_path && record_open(record_path) < 0) {
+        fprintf(stderr, "Error: Cannot record to %s: %s\n", record_path, strerror(errno));
         return 1;
     }
     
+    /* Output is flushed per batch, see process_events() */
+    setvbuf(stdout, NULL, _IOFBF, OUTPUT_BUFFER);
+    
+    /* No SA_RESTART: Ctrl+C interrupts the wait so the totals get printed */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    
+    /* Several devices: one epoll loop, events tagged with their node */
+    if (discover || argc - optind > 1) {
+        if (output_mode == MODE_HUMAN) {
+            printf("\n");
+            printf("========================================\n");
+            printf("Input Event Monitor\n");
+            printf("========================================\n");
+            printf("Listening for events... (Press Ctrl+C to exit)\n");
+            printf("========================================\n\n");
+            fflush(stdout);
+        }
+    
+        ret = run_monitor(argv + optind, argc - optind, discover);
+        if (ret < 0)
+            fprintf(stderr, "\nError: %s\n", strerror(errno));
+        for (i = 0; i < num_devices && output_mode == MODE_COMPACT; i++)
+            compact_flush(devices[i]);
+        if (output_mode == MODE_QUIET)
+            print_counters();
+        fflush(stdout);
+        if (record_close() < 0)
+            ret = -1;
+        return ret < 0 ? 1 : 0;
+    }
+    path = argv[optind];
+    
     /* Open input device */
-    fd = open(argv[1], O_RDONLY);
-    if (fd < 0) {
-        fprintf(stderr, "Error: Cannot open %s: %s\n", argv[1], strerror(errno));
-        fprintf(stderr, "Try running with sudo: sudo %s %s\n", argv[0], argv[1]);
+    snprintf(single.path, sizeof(single.path), "%s", path);
+    single.fd = open(path, O_RDONLY | (nonblock ? O_NONBLOCK : 0));
+    if (single.fd < 0) {
+        fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(errno));
+        fprintf(stderr, "Try running with sudo: sudo %s %s\n", argv[0], path);
+        return 1;
+    }
+    
+    if (setup_device(single.fd) < 0) {
+        fprintf(stderr, "Error: Cannot set up %s: %s\n", path, strerror(errno));
+        close(single.fd);
         return 1;
     }
     
     /* Get device name */
-    get_device_name(fd, device_name, sizeof(device_name));
+    get_device_name(single.fd, device_name, sizeof(device_name));
     
     /* Print header */
-    printf("\n");
-    printf("========================================\n");
-    printf("Input Event Reader\n");
-    printf("========================================\n");
-    printf("Device:  %s\n", argv[1]);
-    printf("Name:    %s\n", device_name);
-    printf("========================================\n");
-    printf("Listening for events... (Press Ctrl+C to exit)\n");
-    printf("========================================\n\n");
+    if (output_mode == MODE_HUMAN) {
+        printf("\n");
+        printf("========================================\n");
+        printf("Input Event Reader\n");
+        printf("========================================\n");
+        printf("Device:  %s\n", path);
+        printf("Name:    %s\n", device_name);
+        printf("Mode:    %s%s\n", nonblock ? "non-blocking (poll)" : "blocking",
+               grab ? ", grabbed" : "");
+        if (filtering)
+            printf("Filter:  in kernel (EVIOCSMASK)\n");
+        printf("========================================\n");
+        printf("Listening for events... (Press Ctrl+C to exit)\n");
+        printf("========================================\n\n");
+        fflush(stdout);
+    }
     
     /* Read events in a loop */
-    while (1) {
-        bytes = read(fd, &ev, sizeof(ev));
-        
-        if (bytes < 0) {
-            if (errno == EINTR) {
-                /* Interrupted by signal, continue */
-                continue;
-            }
-            fprintf(stderr, "\nError reading event: %s\n", strerror(errno));
-            break;
-        }
-        
-        if (bytes != sizeof(ev)) {
-            fprintf(stderr, "\nError: Short read (got %zd bytes, expected %zu)\n",
-                    bytes, sizeof(ev));
-            break;
-        }
-        
-        /* Print the event */
-        print_event(&ev);
-    }
+    ret = nonblock ? run_nonblocking(&single) : run_blocking(&single);
+    if (ret < 0)
+        fprintf(stderr, "\nError reading events: %s\n", strerror(errno));
+    else if (single.fill && !stop)
+        fprintf(stderr, "\nError: Device closed inside an event (%zu stray bytes)\n",
+                single.fill);
     
-    close(fd);
-    return 0;
+    if (output_mode == MODE_COMPACT)
+        compact_flush(&single);
+    if (output_mode == MODE_QUIET)
+        print_counters();
+    fflush(stdout);
+    if (record_close() < 0)
+        ret = -1;
+    
+    close(single.fd);
+    return ret < 0 ? 1 : 0;
 }